@@ -0,0 +1,328 @@
+/*
+ * Copyright (c) 2019-2020, University of Southampton and Contributors.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+/**
+ * Microbenchmark for the RSP packet codec and the Utils and request parsing
+ * hot paths. RspConnection::getPkt() and putPkt() are run over a socketpair
+ * (in no-ack mode, as GDB uses them) for each kind of packet GDB commonly
+ * exchanges, and for a mix weighted as in a typical session. Reports
+ * throughput and the per-packet latency distribution, then the cost of the
+ * Utils conversions and of the sscanf() parsing done by rspReadMem(),
+ * rspWriteMemBin() and rspInsertMatchpoint().
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <gdb-server/RspConnection.hpp>
+#include <gdb-server/RspPacket.hpp>
+#include <gdb-server/Utils.hpp>
+#include <iostream>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+//! Packet buffer size, as GdbServer::RSP_PKT_DEFAULT
+static const int PKT_SIZE = 0x4000;
+
+//! Packets timed per measurement
+static const size_t N_PACKETS = 20000;
+
+//! A packet payload, and how often it turns up in a session
+struct PacketKind {
+  const char *name;
+  std::string payload;
+  int weight;
+};
+
+//! Keeps results alive so the compiler can't drop the work
+static volatile uint32_t sink;
+
+static std::string randomBinary(size_t len) {
+  std::string s(len, '\0');
+  for (size_t i = 0; i < len; i++) {
+    s[i] = rand() & 0xff;
+  }
+  return s;
+}
+
+static std::string randomHex(size_t len) {
+  static const char digits[] = "0123456789abcdef";
+  std::string s(len, '0');
+  for (size_t i = 0; i < len; i++) {
+    s[i] = digits[rand() & 0xf];
+  }
+  return s;
+}
+
+//! Frame a payload as the client would send it
+static std::string frame(const std::string &payload) {
+  std::string out("$");
+  unsigned char csum = 0;
+  for (size_t i = 0; i < payload.size(); i++) {
+    unsigned char ch = payload[i];
+    if (('$' == ch) || ('#' == ch) || ('*' == ch) || ('}' == ch)) {
+      out += '}';
+      csum += '}';
+      ch ^= 0x20;
+    }
+    out += (char)ch;
+    csum += ch;
+  }
+  char tail[4];
+  snprintf(tail, sizeof(tail), "#%02x", csum);
+  return out + tail;
+}
+
+//! Pick N_PACKETS payloads from kinds, in proportion to their weights
+static std::vector<const std::string *> pickMix(
+    const std::vector<PacketKind> &kinds) {
+  std::vector<const std::string *> mix;
+  int total = 0;
+  for (size_t k = 0; k < kinds.size(); k++) {
+    total += kinds[k].weight;
+  }
+  for (size_t i = 0; i < N_PACKETS; i++) {
+    int w = rand() % total;
+    size_t k = 0;
+    while (w >= kinds[k].weight) {
+      w -= kinds[k].weight;
+      k++;
+    }
+    mix.push_back(&kinds[k].payload);
+  }
+  return mix;
+}
+
+static void report(const char *name, const std::vector<double> &ns,
+                   size_t bytes, double secs) {
+  std::vector<double> sorted(ns);
+  std::sort(sorted.begin(), sorted.end());
+  printf("%-16s %8.0f %12.0f %10.1f %9.0f %9.0f\n", name,
+         (double)bytes / ns.size(), ns.size() / secs, bytes / secs / 1e6,
+         sorted[sorted.size() / 2], sorted[sorted.size() * 99 / 100]);
+}
+
+//! Time getPkt () for each payload, sent framed from the other end of a
+//! socketpair
+static void benchGetPkt(const char *name,
+                        const std::vector<const std::string *> &payloads) {
+  int sv[2];
+  if (0 != socketpair(AF_UNIX, SOCK_STREAM, 0, sv)) {
+    perror("socketpair");
+    exit(1);
+  }
+
+  std::string wire;
+  size_t bytes = 0;
+  for (size_t i = 0; i < payloads.size(); i++) {
+    wire += frame(*payloads[i]);
+    bytes += payloads[i]->size();
+  }
+  std::thread writer([&]() {
+    size_t done = 0;
+    while (done < wire.size()) {
+      ssize_t n = write(sv[1], wire.data() + done, wire.size() - done);
+      if (n <= 0) {
+        break;
+      }
+      done += n;
+    }
+  });
+
+  RspConnection conn(1);
+  RspPacket pkt(PKT_SIZE);
+  conn.rspAttach(sv[0]);
+  conn.setNoAckMode(true);
+
+  std::vector<double> ns(payloads.size());
+  Clock::time_point start = Clock::now();
+  for (size_t i = 0; i < payloads.size(); i++) {
+    Clock::time_point t0 = Clock::now();
+    if (!conn.getPkt(&pkt)) {
+      fprintf(stderr, "getPkt failed\n");
+      exit(1);
+    }
+    ns[i] = std::chrono::duration<double, std::nano>(Clock::now() - t0).count();
+  }
+  double secs = std::chrono::duration<double>(Clock::now() - start).count();
+
+  writer.join();
+  close(sv[1]);
+  report(name, ns, bytes, secs);
+}
+
+//! Time putPkt () for each payload, drained from the other end of a
+//! socketpair
+static void benchPutPkt(const char *name,
+                        const std::vector<const std::string *> &payloads) {
+  int sv[2];
+  if (0 != socketpair(AF_UNIX, SOCK_STREAM, 0, sv)) {
+    perror("socketpair");
+    exit(1);
+  }
+
+  std::thread reader([&]() {
+    char buf[65536];
+    while (read(sv[1], buf, sizeof(buf)) > 0) {
+    }
+  });
+
+  RspConnection conn(1);
+  RspPacket pkt(PKT_SIZE);
+  conn.rspAttach(sv[0]);
+  conn.setNoAckMode(true);
+
+  std::vector<double> ns(payloads.size());
+  size_t bytes = 0;
+  Clock::time_point start = Clock::now();
+  for (size_t i = 0; i < payloads.size(); i++) {
+    const std::string &p = *payloads[i];
+    Clock::time_point t0 = Clock::now();
+    memcpy(pkt.data, p.data(), p.size());
+    pkt.setLen(p.size());
+    if (!conn.putPkt(&pkt)) {
+      fprintf(stderr, "putPkt failed\n");
+      exit(1);
+    }
+    ns[i] = std::chrono::duration<double, std::nano>(Clock::now() - t0).count();
+    bytes += p.size();
+  }
+  double secs = std::chrono::duration<double>(Clock::now() - start).count();
+
+  shutdown(sv[0], SHUT_WR);
+  reader.join();
+  close(sv[1]);
+  report(name, ns, bytes, secs);
+}
+
+//! Run fn repeatedly for ~100 ms, and return ns per call
+template <typename Fn>
+static double nsPerCall(Fn fn) {
+  size_t iters = 0;
+  Clock::time_point start = Clock::now();
+  Clock::duration elapsed;
+
+  do {
+    for (int i = 0; i < 256; i++) {
+      fn();
+    }
+    iters += 256;
+    elapsed = Clock::now() - start;
+  } while (elapsed < std::chrono::milliseconds(100));
+
+  return std::chrono::duration<double, std::nano>(elapsed).count() / iters;
+}
+
+int main() {
+  srand(1);
+  std::cout.rdbuf(NULL);  // RspConnection reports each close on cout
+
+  // Requests GDB sends, and replies we send, with typical sizes
+  char buf[64];
+  std::vector<PacketKind> requests;
+  requests.push_back({"m (64 B)", "m20001f40,40", 40});
+  requests.push_back({"p", "p0", 15});
+  requests.push_back({"g", "g", 10});
+  requests.push_back({"Z0", "Z0,8000fb2,2", 5});
+  requests.push_back({"vCont", "vCont;s:1;c", 10});
+  for (size_t len : {256, 1024, 4096}) {
+    snprintf(buf, sizeof(buf), "X%x,%zx:", 0x20000000, len);
+    requests.push_back({len == 256    ? "X (256 B)"
+                        : len == 1024 ? "X (1 KiB)"
+                                      : "X (4 KiB)",
+                        buf + randomBinary(len), len == 4096 ? 10 : 5});
+  }
+
+  std::vector<PacketKind> replies;
+  replies.push_back({"OK", "OK", 20});
+  replies.push_back({"T05", "T05thread:1;", 10});
+  replies.push_back({"p reply", randomHex(8), 20});
+  replies.push_back({"g reply", randomHex(17 * 8), 10});
+  replies.push_back({"m (64 B)", randomHex(2 * 64), 30});
+  replies.push_back({"m (4 KiB)", randomHex(2 * 4096), 10});
+
+  printf("%-16s %8s %12s %10s %9s %9s\n", "getPkt", "bytes", "packets/s",
+         "MB/s", "p50 ns", "p99 ns");
+  for (size_t k = 0; k < requests.size(); k++) {
+    std::vector<const std::string *> same(N_PACKETS, &requests[k].payload);
+    benchGetPkt(requests[k].name, same);
+  }
+  benchGetPkt("mix", pickMix(requests));
+
+  printf("\n%-16s %8s %12s %10s %9s %9s\n", "putPkt", "bytes", "packets/s",
+         "MB/s", "p50 ns", "p99 ns");
+  for (size_t k = 0; k < replies.size(); k++) {
+    std::vector<const std::string *> same(N_PACKETS, &replies[k].payload);
+    benchPutPkt(replies[k].name, same);
+  }
+  benchPutPkt("mix", pickMix(replies));
+
+  // Utils conversions
+  printf("\n%-28s %9s %10s\n", "Utils", "ns/call", "MB/s");
+  std::string hex = randomHex(4096);
+  double ns = nsPerCall([&]() {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < hex.size(); i++) {
+      sum += Utils::char2Hex(hex[i]);
+    }
+    sink = sum;
+  });
+  printf("%-28s %9.1f %10.1f\n", "char2Hex (x4096)", ns, hex.size() / ns * 1e3);
+
+  char regBuf[9];
+  uint32_t reg = 0x12345678;
+  ns = nsPerCall([&]() { Utils::reg2Hex(reg++, regBuf); });
+  printf("%-28s %9.1f\n", "reg2Hex", ns);
+
+  ns = nsPerCall([&]() { sink = Utils::hex2Reg(regBuf, 4); });
+  printf("%-28s %9.1f\n", "hex2Reg", ns);
+
+  // X payloads as received, escapes and all, restored before each call
+  for (size_t len : {256, 4096}) {
+    std::string wire = frame(randomBinary(len));
+    wire = wire.substr(1, wire.size() - 4);
+    std::vector<char> work(wire.size());
+    double copy = nsPerCall([&]() {
+      memcpy(work.data(), wire.data(), wire.size());
+      sink = work[0];
+    });
+    ns = nsPerCall([&]() {
+      memcpy(work.data(), wire.data(), wire.size());
+      sink = Utils::rspUnescape(work.data(), wire.size());
+    });
+    snprintf(buf, sizeof(buf), "rspUnescape (%zu B)", len);
+    printf("%-28s %9.1f %10.1f\n", buf, ns - copy, len / (ns - copy) * 1e3);
+  }
+
+  // The request parsers, on the packets GDB sends
+  printf("\n%-28s %9s\n", "Parsers", "ns/call");
+  unsigned int addr, len;
+  int type;
+  ns = nsPerCall([&]() {
+    sink = sscanf("m20001f40,40", "m%x,%x:", &addr, &len);
+  });
+  printf("%-28s %9.1f\n", "rspReadMem (m)", ns);
+
+  ns = nsPerCall([&]() {
+    sink = sscanf("X20000000,1000:", "X%x,%x:", &addr, &len);
+  });
+  printf("%-28s %9.1f\n", "rspWriteMemBin (X)", ns);
+
+  ns = nsPerCall([&]() {
+    sink = sscanf("Z0,8000fb2,2", "Z%1d,%x,%x", &type, &addr, &len);
+  });
+  printf("%-28s %9.1f\n", "rspInsertMatchpoint (Z)", ns);
+
+  return 0;
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2019-2020, University of Southampton and Contributors.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+/**
+ * Microbenchmark for the bulk hex kernels in Utils. Reports encode/decode
+ * throughput (GB/s of binary data) for every implementation the host CPU
+ * supports, after checking each against the scalar implementation.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <gdb-server/Utils.hpp>
+#include <vector>
+
+static const char *implName(Utils::HexImpl impl) {
+  switch (impl) {
+    case Utils::HEX_IMPL_SCALAR:
+      return "scalar";
+    case Utils::HEX_IMPL_SSE2:
+      return "sse2";
+    case Utils::HEX_IMPL_AVX2:
+      return "avx2";
+  }
+  return "?";
+}
+
+//! Run fn repeatedly for ~100 ms, and return bytes/s for len bytes per call
+template <typename Fn>
+static double throughput(size_t len, Fn fn) {
+  typedef std::chrono::steady_clock Clock;
+  size_t iters = 0;
+  Clock::time_point start = Clock::now();
+  Clock::duration elapsed;
+
+  do {
+    for (int i = 0; i < 64; i++) {
+      fn();
+    }
+    iters += 64;
+    elapsed = Clock::now() - start;
+  } while (elapsed < std::chrono::milliseconds(100));
+
+  double secs = std::chrono::duration<double>(elapsed).count();
+  return (double)len * iters / secs;
+}
+
+int main() {
+  const size_t sizes[] = {16, 256, 4096, 65536};
+  const size_t maxLen = 65536;
+  const Utils::HexImpl impls[] = {Utils::HEX_IMPL_SCALAR, Utils::HEX_IMPL_SSE2,
+                                  Utils::HEX_IMPL_AVX2};
+  const Utils::HexImpl best = Utils::getHexImpl();
+
+  std::vector<uint8_t> bin(maxLen), out(maxLen);
+  std::vector<char> hex(2 * maxLen), ref(2 * maxLen);
+  srand(1);
+  for (size_t i = 0; i < maxLen; i++) {
+    bin[i] = rand() & 0xff;
+  }
+
+  Utils::setHexImpl(Utils::HEX_IMPL_SCALAR);
+  Utils::bytesToHex(bin.data(), maxLen, ref.data());
+
+  printf("%-8s %8s %12s %12s\n", "impl", "bytes", "encode GB/s",
+         "decode GB/s");
+  for (Utils::HexImpl impl : impls) {
+    if (!Utils::setHexImpl(impl)) {
+      printf("%-8s not supported by this CPU\n", implName(impl));
+      continue;
+    }
+
+    // Check against the scalar implementation, including odd lengths
+    for (size_t len = 0; len < 200; len++) {
+      Utils::bytesToHex(bin.data(), len, hex.data());
+      if (0 != memcmp(hex.data(), ref.data(), 2 * len) ||
+          !Utils::hexToBytes(hex.data(), len, out.data()) ||
+          0 != memcmp(out.data(), bin.data(), len)) {
+        printf("%-8s MISMATCH at length %zu\n", implName(impl), len);
+        return 1;
+      }
+    }
+    hex[101] = 'g';
+    if (Utils::hexToBytes(hex.data(), 100, out.data())) {
+      printf("%-8s failed to reject malformed digit\n", implName(impl));
+      return 1;
+    }
+
+    Utils::bytesToHex(bin.data(), maxLen, hex.data());
+    for (size_t len : sizes) {
+      double enc = throughput(
+          len, [&]() { Utils::bytesToHex(bin.data(), len, hex.data()); });
+      double dec = throughput(
+          len, [&]() { Utils::hexToBytes(hex.data(), len, out.data()); });
+      printf("%-8s %8zu %12.2f %12.2f\n", implName(impl), len, enc / 1e9,
+             dec / 1e9);
+    }
+  }
+
+  Utils::setHexImpl(best);
+  printf("selected at runtime: %s\n", implName(best));
+  return 0;
+}
@@ -0,0 +1,408 @@
+/*
+ * Copyright (c) 2019-2020, University of Southampton and Contributors.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+/**
+ * End-to-end latency harness. Runs GdbServer::serverThread() on a loopback
+ * port against an in-process mock simulator, and drives it with a built-in
+ * RSP client through the packet sequences GDB sends for common operations:
+ * attaching, stepi, load, stopping with a backtrace, and breakpoint churn.
+ * Reports the latency of each operation (p50/p99) and the simulator calls it
+ * took. Needs no GDB, and exits with a failure status if any reply is wrong,
+ * so it can run in CI.
+ *
+ * Usage: gdb-server-bench-latency [-p port] [-mem bytes] [-regs n]
+ *                                 [-latency ns]
+ */
+
+#include "RspClient.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <gdb-server/GdbServer.hpp>
+#include <gdb-server/Utils.hpp>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+//! Mock simulator. Memory and registers are plain arrays; the target runs to
+//! the next breakpoint above the PC as soon as it is resumed. Every call
+//! costs a configurable busy wait, standing in for a real simulator.
+class MockSimulator : public SimulationControlInterface {
+ public:
+  static const uint32_t PC_REG = 0;
+  static const uint32_t SP_REG = 1;
+
+  MockSimulator(size_t memSize, uint32_t nRegs, uint32_t latencyNs)
+      : mem(memSize, 0),
+        regs(nRegs, 0),
+        latency(latencyNs),
+        stalled(true),
+        running(false),
+        stop(false),
+        calls(0) {
+    regs[SP_REG] = memSize - 0x100;
+  }
+
+  void kill() override { call(); }
+  void reset() override { call(); }
+
+  void stall() override {
+    call();
+    halt();
+  }
+
+  void unstall() override {
+    call();
+    stalled = false;
+    if (!breakpoints.empty()) {
+      // Run to the next breakpoint, wrapping round
+      std::set<uint32_t>::const_iterator it =
+          breakpoints.upper_bound(regs[PC_REG]);
+      regs[PC_REG] = (breakpoints.end() == it) ? *breakpoints.begin() : *it;
+      halt();
+    }
+  }
+
+  bool isStalled() override {
+    call();
+    return stalled;
+  }
+
+  bool setStallCallback(std::function<void()> cb) override {
+    stallCb = cb;
+    return true;
+  }
+
+  void step() override {
+    call();
+    stalled = false;
+    regs[PC_REG] += 2;
+    halt();
+  }
+
+  void insertBreakpoint(unsigned addr) override {
+    call();
+    breakpoints.insert(addr);
+  }
+
+  void removeBreakpoint(unsigned addr) override {
+    call();
+    breakpoints.erase(addr);
+  }
+
+  uint32_t readReg(std::size_t num) override {
+    call();
+    return (num < regs.size()) ? regs[num] : 0;
+  }
+
+  void writeReg(std::size_t num, uint32_t value) override {
+    call();
+    if (num < regs.size()) {
+      regs[num] = value;
+    }
+  }
+
+  void readRegs(uint32_t *out, std::size_t first, std::size_t count) override {
+    call();
+    memcpy(out, &regs[first], count * sizeof(uint32_t));
+  }
+
+  void writeRegs(const uint32_t *src, std::size_t first,
+                 std::size_t count) override {
+    call();
+    memcpy(&regs[first], src, count * sizeof(uint32_t));
+  }
+
+  bool readMem(uint8_t *out, unsigned addr, std::size_t len) override {
+    call();
+    if ((uint64_t)addr + len > mem.size()) {
+      return false;
+    }
+    memcpy(out, &mem[addr], len);
+    return true;
+  }
+
+  bool writeMem(uint8_t *src, unsigned addr, std::size_t len) override {
+    call();
+    if ((uint64_t)addr + len > mem.size()) {
+      return false;
+    }
+    memcpy(&mem[addr], src, len);
+    return true;
+  }
+
+  uint32_t pcRegNum() override { return PC_REG; }
+  uint32_t nRegs() override { return regs.size(); }
+  uint32_t wordSize() override { return 4; }
+  void stopServer() override { stop = true; }
+  bool shouldStopServer() override { return stop; }
+  bool isServerRunning() override { return running; }
+  void setServerRunning(bool status) override { running = status; }
+  uint32_t htotl(uint32_t hostVal) override { return hostVal; }
+  uint32_t ttohl(uint32_t targetVal) override { return targetVal; }
+
+  uint64_t callCount() const { return calls; }
+
+ private:
+  std::vector<uint8_t> mem;
+  std::vector<uint32_t> regs;
+  std::set<uint32_t> breakpoints;
+  uint32_t latency;
+  bool stalled;
+  bool running;
+  std::atomic<bool> stop;
+  std::atomic<uint64_t> calls;
+  std::function<void()> stallCb;
+
+  void call() {
+    calls++;
+    if (0 != latency) {
+      Clock::time_point end = Clock::now() + std::chrono::nanoseconds(latency);
+      while (Clock::now() < end) {
+      }
+    }
+  }
+
+  void halt() {
+    bool wasStalled = stalled;
+    stalled = true;
+    if (!wasStalled && stallCb) {
+      stallCb();
+    }
+  }
+};
+
+//! Set by expect () when a reply is wrong
+static bool failed = false;
+
+//! Send a request and check the reply starts with want
+static std::string expect(RspClient *client, const std::string &req,
+                          const char *want) {
+  std::string reply = client->request(req);
+  if (0 != reply.compare(0, strlen(want), want)) {
+    if (!failed) {
+      fprintf(stderr, "%s: expected \"%s\", got \"%.40s\"\n",
+              req.substr(0, 40).c_str(), want, reply.c_str());
+    }
+    failed = true;
+  }
+  return reply;
+}
+
+static std::string hexAddr(const char *fmt, uint32_t a, uint32_t b = 0) {
+  char buf[64];
+  snprintf(buf, sizeof(buf), fmt, a, b);
+  return buf;
+}
+
+//! Register num from a g reply. Registers are sent lowest byte first.
+static uint32_t regValue(std::string &regs, uint32_t num) {
+  if (regs.size() < 8 * (num + 1)) {
+    return 0;
+  }
+  return __builtin_bswap32(Utils::hex2Reg(&regs[8 * num], 4));
+}
+
+//! What GDB sends when it attaches, up to reading the first frame
+static void attach(RspClient *client, int port) {
+  client->disconnect();
+  if (!client->connectTo(port)) {
+    fprintf(stderr, "Cannot connect to port %d\n", port);
+    exit(1);
+  }
+  expect(client,
+         "qSupported:multiprocess+;swbreak+;hwbreak+;qRelocInsn+;"
+         "fork-events+;vfork-events+;exec-events+;vContSupported+;"
+         "QThreadEvents+;no-resumed+",
+         "PacketSize=");
+  expect(client, "vMustReplyEmpty", "");
+  if ("OK" == expect(client, "QStartNoAckMode", "OK")) {
+    client->setNoAck();
+  }
+  expect(client, "Hg0", "OK");
+  expect(client, "qTStatus", "T0");
+  expect(client, "?", "S05");
+  expect(client, "qfThreadInfo", "m");
+  expect(client, "qsThreadInfo", "l");
+  expect(client, "qAttached", "");
+  expect(client, "Hc-1", "OK");
+  expect(client, "qC", "");
+  expect(client, "qOffsets", "");
+  expect(client, "g", "");
+  expect(client, "m0,4", "");
+}
+
+//! Sample latencies of one workload
+struct Result {
+  const char *name;
+  std::vector<double> us;
+  uint64_t simCalls;
+};
+
+static Result run(const char *name, MockSimulator *sim, size_t n,
+                  std::function<void(size_t)> op) {
+  Result res;
+  res.name = name;
+  res.us.resize(n);
+  uint64_t calls = sim->callCount();
+  for (size_t i = 0; i < n; i++) {
+    Clock::time_point t0 = Clock::now();
+    op(i);
+    res.us[i] =
+        std::chrono::duration<double, std::micro>(Clock::now() - t0).count();
+  }
+  res.simCalls = sim->callCount() - calls;
+  return res;
+}
+
+int main(int argc, char **argv) {
+  int port = 51235;
+  size_t memSize = 2 << 20;
+  uint32_t nRegs = 17;
+  uint32_t latency = 0;
+
+  for (int i = 1; i < argc; i += 2) {
+    const char *val = (i + 1 < argc) ? argv[i + 1] : NULL;
+    if ((NULL != val) && (0 == strcmp("-p", argv[i]))) {
+      port = atoi(val);
+    } else if ((NULL != val) && (0 == strcmp("-mem", argv[i]))) {
+      memSize = strtoul(val, NULL, 0);
+    } else if ((NULL != val) && (0 == strcmp("-regs", argv[i]))) {
+      nRegs = strtoul(val, NULL, 0);
+    } else if ((NULL != val) && (0 == strcmp("-latency", argv[i]))) {
+      latency = strtoul(val, NULL, 0);
+    } else {
+      fprintf(stderr,
+              "Usage: %s [-p port] [-mem bytes] [-regs n] [-latency ns]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+  if ((memSize < (2 << 20)) || (nRegs < 2)) {
+    fprintf(stderr, "Need at least 2 MiB of memory and 2 registers\n");
+    return 1;
+  }
+
+  std::cout.rdbuf(NULL);  // RspConnection reports each close on cout
+
+  MockSimulator sim(memSize, nRegs, latency);
+  GdbServer server(&sim, port);
+  std::thread serverThread(&GdbServer::serverThread, &server);
+
+  RspClient client;
+  std::vector<Result> results;
+
+  results.push_back(
+      run("attach", &sim, 100, [&](size_t) { attach(&client, port); }));
+
+  // stepi: step, then read the registers and the next instruction
+  results.push_back(run("stepi", &sim, 10000, [&](size_t) {
+    std::string reply = expect(&client, "vCont;s:1", "S05");
+    std::string regs = expect(&client, "g", "");
+    uint32_t pc = regValue(regs, MockSimulator::PC_REG);
+    expect(&client, hexAddr("m%x,4", pc & 0xfffff), "");
+  }));
+
+  // load: 1 MiB in X packets. Like GDB, fill each packet up to the packet
+  // size once escaped, leaving room for the header.
+  const size_t maxEscaped = 0x3f00;
+  std::string image(1 << 20, '\0');
+  for (size_t i = 0; i < image.size(); i++) {
+    image[i] = (i * 7) ^ (i >> 8);
+  }
+  std::vector<size_t> chunks;  // Start of each packet's data
+  for (size_t off = 0, escaped = 0; off < image.size(); off++) {
+    char ch = image[off];
+    size_t n = (('$' == ch) || ('#' == ch) || ('*' == ch) || ('}' == ch)) ? 2
+                                                                          : 1;
+    if (chunks.empty() || (escaped + n > maxEscaped)) {
+      chunks.push_back(off);
+      escaped = 0;
+    }
+    escaped += n;
+  }
+  chunks.push_back(image.size());
+  results.push_back(
+      run("load (X packet)", &sim, chunks.size() - 1, [&](size_t i) {
+        size_t off = chunks[i];
+        size_t len = chunks[i + 1] - off;
+        expect(&client, hexAddr("X%x,%x:", off, len) + image.substr(off, len),
+               "OK");
+      }));
+  std::string check = expect(&client, "m1000,4", "");
+  uint32_t word;
+  memcpy(&word, &image[0x1000], sizeof(word));
+  if (check != hexAddr("%08x", __builtin_bswap32(word))) {
+    fprintf(stderr, "load: memory read back wrong\n");
+    failed = true;
+  }
+
+  // Stop at a breakpoint and backtrace through ten frames
+  expect(&client, "Z0,2000,2", "OK");
+  results.push_back(run("stop + backtrace", &sim, 1000, [&](size_t) {
+    expect(&client, "vCont;c", "S05");
+    std::string regs = expect(&client, "g", "");
+    uint32_t sp = regValue(regs, MockSimulator::SP_REG);
+    for (int frame = 0; frame < 10; frame++) {
+      expect(&client, hexAddr("m%x,4", sp + 16 * frame), "");
+      expect(&client, hexAddr("m%x,4", sp + 16 * frame + 4), "");
+      expect(&client, hexAddr("m%x,2", 0x2000 + 0x40 * frame), "");
+    }
+  }));
+  expect(&client, "z0,2000,2", "OK");
+
+  // GDB inserts every breakpoint before resuming and removes them all once
+  // the target stops
+  results.push_back(run("breakpoint churn", &sim, 1000, [&](size_t) {
+    for (uint32_t b = 0; b < 20; b++) {
+      expect(&client, hexAddr("Z0,%x,2", 0x1000 + 0x100 * b), "OK");
+    }
+    expect(&client, "vCont;c", "S05");
+    expect(&client, "g", "");
+    for (uint32_t b = 0; b < 20; b++) {
+      expect(&client, hexAddr("z0,%x,2", 0x1000 + 0x100 * b), "OK");
+    }
+  }));
+
+  sim.stopServer();
+  client.send("k");
+  client.disconnect();
+  serverThread.join();
+
+  printf("%-18s %7s %10s %10s %10s %10s\n", "workload", "ops", "p50 us",
+         "p99 us", "mean us", "sim calls");
+  uint64_t totalCalls = 0;
+  for (size_t i = 0; i < results.size(); i++) {
+    Result &r = results[i];
+    std::vector<double> sorted(r.us);
+    std::sort(sorted.begin(), sorted.end());
+    double sum = 0;
+    for (size_t j = 0; j < sorted.size(); j++) {
+      sum += sorted[j];
+    }
+    printf("%-18s %7zu %10.1f %10.1f %10.1f %10llu\n", r.name, sorted.size(),
+           sorted[sorted.size() / 2], sorted[sorted.size() * 99 / 100],
+           sum / sorted.size(), (unsigned long long)r.simCalls);
+    totalCalls += r.simCalls;
+  }
+  printf("total simulator calls: %llu\n", (unsigned long long)totalCalls);
+
+  if (failed) {
+    fprintf(stderr, "FAILED: unexpected replies\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,497 @@
+/*
+ * Copyright (c) 2019-2020, University of Southampton and Contributors.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+/**
+ * Replays a session log written by SessionRecorder into a GdbServer, as fast
+ * as the server answers. The simulator is a mock that gives back the results
+ * recorded for the same calls, and the client sends the recorded packets,
+ * reading as many replies as were recorded after each one. Reports the
+ * server's latency per request next to the recorded latency, and counts the
+ * replies that differ from the recorded ones.
+ *
+ * Usage: gdb-server-replay [-p port] [-v] <log>
+ */
+
+#include "RspClient.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <gdb-server/GdbServer.hpp>
+#include <gdb-server/SessionRecorder.hpp>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef SessionRecorder::Record Record;
+typedef std::chrono::steady_clock Clock;
+
+//! Set once the replay is over, to stop the server
+static std::atomic<bool> replayDone(false);
+
+//! How far past the last matched call to look for the next one
+static const size_t MATCH_WINDOW = 256;
+
+//! How long to wait for the server to catch up with the recording before
+//! sending a request anyway
+static const int CATCH_UP_TIMEOUT_MS = 1000;
+
+//! Mock simulator that answers each call with the result recorded for the
+//! same call, found by looking forward from the last one matched. Calls that
+//! don't match are answered from the registers and memory seen so far. The
+//! target runs until the server stalls it if that is what happened in the
+//! recording, and otherwise stops as soon as it is resumed.
+class ReplaySimulator : public SimulationControlInterface {
+ public:
+  ReplaySimulator(const std::vector<Record> &log, int core)
+      : cursor(0),
+        stalled(true),
+        serverRunning(false),
+        nRegs_(32),
+        pcReg(0),
+        word(4),
+        bigEndian(false),
+        matched(0),
+        unmatched(0) {
+    for (size_t i = 0; i < log.size(); i++) {
+      const Record &r = log[i];
+      if (r.core != core) {
+        continue;
+      }
+      if (SessionRecorder::SIM_INFO == r.kind) {
+        uint32_t one = 1;
+        nRegs_ = r.args[0];
+        pcReg = r.args[1];
+        word = r.args[2];
+        if (r.data.size() == sizeof(one)) {
+          memcpy(&one, r.data.data(), sizeof(one));
+        }
+        bigEndian = (1 != one);
+      } else if (SessionRecorder::SIM_CALL == r.kind) {
+        calls.push_back(&r);
+        logIndex.push_back(i);
+      }
+    }
+    regs.assign(nRegs_, 0);
+  }
+
+  void kill() override { find(SessionRecorder::SIM_KILL); }
+  void reset() override { find(SessionRecorder::SIM_RESET); }
+
+  void stall() override {
+    find(SessionRecorder::SIM_STALL);
+    stop();
+  }
+
+  void unstall() override {
+    find(SessionRecorder::SIM_UNSTALL);
+    stalled = false;
+    if (!stalledByServer()) {
+      stop();
+    }
+  }
+
+  bool isStalled() override { return stalled; }
+
+  bool setStallCallback(std::function<void()> cb) override {
+    stallCb = cb;
+    return true;
+  }
+
+  void step() override {
+    find(SessionRecorder::SIM_STEP);
+    stalled = false;
+    if (!stalledByServer()) {
+      stop();
+    }
+  }
+
+  void insertBreakpoint(unsigned addr) override {
+    find(SessionRecorder::SIM_INSERT_BP, 1, addr);
+  }
+
+  void removeBreakpoint(unsigned addr) override {
+    find(SessionRecorder::SIM_REMOVE_BP, 1, addr);
+  }
+
+  bool insertWatchpoint(WatchType type, unsigned addr,
+                        std::size_t len) override {
+    const Record *r = find(SessionRecorder::SIM_INSERT_WP, 2, addr, len);
+    return (NULL != r) && (0 != r->args[2]);
+  }
+
+  bool removeWatchpoint(WatchType type, unsigned addr,
+                        std::size_t len) override {
+    const Record *r = find(SessionRecorder::SIM_REMOVE_WP, 2, addr, len);
+    return (NULL != r) && (0 != r->args[2]);
+  }
+
+  bool getWatchpointHit(WatchType *type, unsigned *addr) override {
+    const Record *r = find(SessionRecorder::SIM_WATCH_HIT);
+    if ((NULL == r) || (0 == r->args[2])) {
+      return false;
+    }
+    *addr = r->args[0];
+    *type = (WatchType)r->args[1];
+    return true;
+  }
+
+  uint32_t readReg(std::size_t num) override {
+    const Record *r = find(SessionRecorder::SIM_READ_REG, 1, num);
+    if (num >= regs.size()) {
+      return 0;
+    }
+    if (NULL != r) {
+      regs[num] = r->args[2];
+    }
+    return regs[num];
+  }
+
+  void writeReg(std::size_t num, uint32_t value) override {
+    find(SessionRecorder::SIM_WRITE_REG, 2, num, value);
+    if (num < regs.size()) {
+      regs[num] = value;
+    }
+  }
+
+  void readRegs(uint32_t *out, std::size_t first, std::size_t count) override {
+    const Record *r = find(SessionRecorder::SIM_READ_REGS, 2, first, count);
+    if (first + count > regs.size()) {
+      memset(out, 0, count * sizeof(uint32_t));
+      return;
+    }
+    if ((NULL != r) && (r->data.size() == count * sizeof(uint32_t))) {
+      memcpy(&regs[first], r->data.data(), r->data.size());
+    }
+    memcpy(out, &regs[first], count * sizeof(uint32_t));
+  }
+
+  void writeRegs(const uint32_t *src, std::size_t first,
+                 std::size_t count) override {
+    find(SessionRecorder::SIM_WRITE_REGS, 2, first, count);
+    if (first + count <= regs.size()) {
+      memcpy(&regs[first], src, count * sizeof(uint32_t));
+    }
+  }
+
+  bool readMem(uint8_t *out, unsigned addr, std::size_t len) override {
+    const Record *r = find(SessionRecorder::SIM_READ_MEM, 2, addr, len);
+    if (NULL != r) {
+      if (0 == r->args[2]) {
+        return false;
+      }
+      if (r->data.size() == len) {
+        storeMem(r->data.data(), addr, len);
+      }
+    }
+    for (std::size_t i = 0; i < len; i++) {
+      std::map<uint32_t, uint8_t>::const_iterator it = mem.find(addr + i);
+      out[i] = (mem.end() == it) ? 0 : it->second;
+    }
+    return true;
+  }
+
+  bool writeMem(uint8_t *src, unsigned addr, std::size_t len) override {
+    const Record *r = find(SessionRecorder::SIM_WRITE_MEM, 2, addr, len);
+    storeMem(src, addr, len);
+    return (NULL == r) || (0 != r->args[2]);
+  }
+
+  uint32_t pcRegNum() override { return pcReg; }
+  uint32_t nRegs() override { return nRegs_; }
+  uint32_t wordSize() override { return word; }
+  void stopServer() override { replayDone = true; }
+  bool shouldStopServer() override { return replayDone; }
+  bool isServerRunning() override { return serverRunning; }
+  void setServerRunning(bool status) override { serverRunning = status; }
+  uint32_t htotl(uint32_t hostVal) override { return swap(hostVal); }
+  uint32_t ttohl(uint32_t targetVal) override { return swap(targetVal); }
+
+  //! How many of this core's calls the server had made by record logPos in
+  //! the recording, not counting polls of isStalled ()
+  size_t callsBefore(size_t logPos) const {
+    size_t n = std::lower_bound(logIndex.begin(), logIndex.end(), logPos) -
+               logIndex.begin();
+    while ((n > 0) && (SessionRecorder::SIM_IS_STALLED == calls[n - 1]->op)) {
+      n--;
+    }
+    return n;
+  }
+
+  //! How many of this core's calls have been replayed
+  size_t position() const { return cursor; }
+
+  size_t matchedCalls() const { return matched; }
+  size_t unmatchedCalls() const { return unmatched; }
+
+ private:
+  std::vector<const Record *> calls;  //!< This core's calls, in order
+  std::vector<size_t> logIndex;       //!< Where each call is in the log
+  std::atomic<size_t> cursor;         //!< Next call to look at
+  bool stalled;
+  bool serverRunning;
+  std::function<void()> stallCb;
+  uint32_t nRegs_;
+  uint32_t pcReg;
+  uint32_t word;
+  bool bigEndian;
+  std::vector<uint32_t> regs;
+  std::map<uint32_t, uint8_t> mem;
+  size_t matched;
+  size_t unmatched;
+
+  //! Find the next recorded call of op whose first nArgs arguments are a
+  //! and b, and move past it. The search doesn't go past a stall, resume or
+  //! step, so the replay can't get ahead of the target.
+  const Record *find(SessionRecorder::SimOp op, int nArgs = 0, uint32_t a = 0,
+                     uint32_t b = 0) {
+    size_t end = std::min(calls.size(), cursor + MATCH_WINDOW);
+    for (size_t i = cursor; i < end; i++) {
+      const Record *r = calls[i];
+      if ((r->op == op) && ((nArgs < 1) || (r->args[0] == a)) &&
+          ((nArgs < 2) || (r->args[1] == b))) {
+        cursor = i + 1;
+        matched++;
+        return r;
+      }
+      if (isRunControl(r->op)) {
+        break;
+      }
+    }
+    unmatched++;
+    return NULL;
+  }
+
+  static bool isRunControl(SessionRecorder::SimOp op) {
+    return (SessionRecorder::SIM_STALL == op) ||
+           (SessionRecorder::SIM_UNSTALL == op) ||
+           (SessionRecorder::SIM_STEP == op);
+  }
+
+  //! Did the server stall the target, rather than it stopping by itself,
+  //! after the last matched resume or step
+  bool stalledByServer() const {
+    for (size_t i = cursor; i < calls.size(); i++) {
+      switch (calls[i]->op) {
+        case SessionRecorder::SIM_STALL:
+          return true;
+        case SessionRecorder::SIM_IS_STALLED:
+          if (0 != calls[i]->args[2]) {
+            return false;
+          }
+          break;
+        case SessionRecorder::SIM_UNSTALL:
+        case SessionRecorder::SIM_STEP:
+          return false;
+        default:
+          break;
+      }
+    }
+    return false;
+  }
+
+  void stop() {
+    bool wasStalled = stalled;
+    stalled = true;
+    if (!wasStalled && stallCb) {
+      stallCb();
+    }
+  }
+
+  void storeMem(const uint8_t *src, uint32_t addr, std::size_t len) {
+    for (std::size_t i = 0; i < len; i++) {
+      mem[addr + i] = src[i];
+    }
+  }
+
+  uint32_t swap(uint32_t v) const {
+    if (!bigEndian) {
+      return v;
+    }
+    return ((v & 0xff) << 24) | ((v & 0xff00) << 8) | ((v >> 8) & 0xff00) |
+           (v >> 24);
+  }
+};
+
+//! The p'th percentile (0 to 1) of some samples
+static double percentile(std::vector<double> samples, double p) {
+  if (samples.empty()) {
+    return 0;
+  }
+  std::sort(samples.begin(), samples.end());
+  return samples[(size_t)(p * (samples.size() - 1))];
+}
+
+static std::string printable(const std::string &s) {
+  std::string out;
+  for (size_t i = 0; (i < s.size()) && (out.size() < 60); i++) {
+    out += ((s[i] >= ' ') && (s[i] <= '~')) ? s[i] : '.';
+  }
+  return out;
+}
+
+int main(int argc, char **argv) {
+  int port = 51234;
+  bool verbose = false;
+  const char *path = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if ((0 == strcmp("-p", argv[i])) && (i + 1 < argc)) {
+      port = atoi(argv[++i]);
+    } else if (0 == strcmp("-v", argv[i])) {
+      verbose = true;
+    } else {
+      path = argv[i];
+    }
+  }
+  if (NULL == path) {
+    fprintf(stderr, "Usage: %s [-p port] [-v] <log>\n", argv[0]);
+    return 1;
+  }
+
+  std::vector<Record> log;
+  if (!SessionRecorder::load(path, &log)) {
+    fprintf(stderr, "Cannot read session log %s\n", path);
+    return 1;
+  }
+
+  int nCores = 0;
+  for (size_t i = 0; i < log.size(); i++) {
+    if (SessionRecorder::SIM_INFO == log[i].kind) {
+      nCores = std::max(nCores, log[i].core + 1);
+    }
+  }
+  if (0 == nCores) {
+    fprintf(stderr, "Warning: no simulator calls recorded\n");
+    nCores = 1;
+  }
+
+  std::vector<ReplaySimulator *> sims;
+  std::vector<SimulationControlInterface *> simCtrls;
+  for (int i = 0; i < nCores; i++) {
+    sims.push_back(new ReplaySimulator(log, i));
+    simCtrls.push_back(sims[i]);
+  }
+  GdbServer *server = new GdbServer(simCtrls, port);
+  std::thread serverThread(&GdbServer::serverThread, server);
+
+  RspClient client;
+  if (!client.connectTo(port)) {
+    fprintf(stderr, "Cannot connect to the server on port %d\n", port);
+    return 1;
+  }
+
+  // Latency of a request: from sending it to its last reply
+  std::vector<double> latency, recLatency;
+  size_t requests = 0, replies = 0, mismatches = 0;
+  Clock::time_point sent, lastReply;
+  uint64_t recSent = 0, recLastReply = 0;
+  bool answered = false, noAckRequested = false, ok = true;
+  Clock::time_point start = Clock::now();
+
+  for (size_t i = 0; ok && (i <= log.size()); i++) {
+    bool request = (i == log.size()) ||
+                   (SessionRecorder::PKT_RX == log[i].kind) ||
+                   (SessionRecorder::BREAK_RX == log[i].kind);
+    bool reply = (i < log.size()) &&
+                 ((SessionRecorder::PKT_TX == log[i].kind) ||
+                  (SessionRecorder::NOTIFY_TX == log[i].kind));
+
+    if (request) {
+      if (answered) {
+        latency.push_back(
+            std::chrono::duration<double, std::micro>(lastReply - sent)
+                .count());
+        recLatency.push_back((recLastReply - recSent) / 1000.0);
+      }
+      answered = false;
+      if (i == log.size()) {
+        break;
+      }
+
+      // A request may arrive while the target runs (an interrupt, or any
+      // request in non-stop mode), so wait until the server has made the
+      // simulator calls it had made by then in the recording
+      Clock::time_point deadline =
+          Clock::now() + std::chrono::milliseconds(CATCH_UP_TIMEOUT_MS);
+      for (int c = 0; c < nCores; c++) {
+        size_t target = sims[c]->callsBefore(i);
+        while ((sims[c]->position() < target) && (Clock::now() < deadline)) {
+          std::this_thread::yield();
+        }
+      }
+
+      const Record &r = log[i];
+      std::string data(r.data.begin(), r.data.end());
+      noAckRequested = ("QStartNoAckMode" == data);
+      sent = Clock::now();
+      recSent = r.time;
+      requests++;
+      ok = (SessionRecorder::BREAK_RX == r.kind) ? client.sendBreak()
+                                                 : client.send(data);
+    } else if (reply) {
+      const Record &r = log[i];
+      std::string want(r.data.begin(), r.data.end()), got;
+      bool notification;
+      if (!client.recv(&got, &notification)) {
+        fprintf(stderr, "No reply from the server at record %zu\n", i);
+        ok = false;
+        break;
+      }
+
+      lastReply = Clock::now();
+      recLastReply = r.time;
+      answered = true;
+      replies++;
+      if ((got != want) ||
+          (notification != (SessionRecorder::NOTIFY_TX == r.kind))) {
+        mismatches++;
+        if (verbose) {
+          printf("Reply %zu differs:\n  recorded %s\n  replayed %s\n", i,
+                 printable(want).c_str(), printable(got).c_str());
+        }
+      }
+      if (noAckRequested && ("OK" == got)) {
+        client.setNoAck();
+      }
+    }
+  }
+
+  double elapsed =
+      std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+  replayDone = true;
+  client.disconnect();
+  serverThread.join();
+  delete server;
+
+  size_t matched = 0, unmatched = 0;
+  for (int i = 0; i < nCores; i++) {
+    matched += sims[i]->matchedCalls();
+    unmatched += sims[i]->unmatchedCalls();
+    delete sims[i];
+  }
+
+  double recElapsed = log.empty() ? 0 : log.back().time / 1e6;
+  printf("Replayed %zu requests, %zu replies in %.1f ms (recorded %.1f ms)\n",
+         requests, replies, elapsed, recElapsed);
+  printf("Latency (us)      p50 %9.1f  p99 %9.1f  max %9.1f\n",
+         percentile(latency, 0.5), percentile(latency, 0.99),
+         percentile(latency, 1.0));
+  printf("Recorded (us)     p50 %9.1f  p99 %9.1f  max %9.1f\n",
+         percentile(recLatency, 0.5), percentile(recLatency, 0.99),
+         percentile(recLatency, 1.0));
+  printf("Replies differing from the recording: %zu\n", mismatches);
+  printf("Simulator calls matched: %zu, not matched: %zu\n", matched,
+         unmatched);
+
+  return (ok && (0 == mismatches)) ? 0 : 1;
+}
@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2019-2020, University of Southampton and Contributors.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+/**
+ * @brief RspClient Minimal RSP client, standing in for GDB in the benchmark
+ * tools.
+ */
+class RspClient {
+ public:
+  //! How long to wait for a reply before giving up
+  static const int REPLY_TIMEOUT_MS = 5000;
+
+  RspClient() : fd(-1), rxHead(0), rxTail(0), noAck(false) {}
+  ~RspClient() { disconnect(); }
+
+  /**
+   * @brief connectTo Connect to a server on localhost, waiting up to 5 s for
+   * it to listen.
+   * @param port server port
+   * @retval true if connected
+   */
+  bool connectTo(int port) {
+    for (int tries = 0; tries < 50000; tries++) {
+      fd = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+      struct sockaddr_in addr;
+      memset(&addr, 0, sizeof(addr));
+      addr.sin_family = AF_INET;
+      addr.sin_port = htons(port);
+      addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      if (0 == connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        rxHead = 0;
+        rxTail = 0;
+        noAck = false;
+        return true;
+      }
+      close(fd);
+      fd = -1;
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    return false;
+  }
+
+  void disconnect() {
+    if (fd >= 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+
+  /**
+   * @brief send Send a packet, escaping the payload as needed.
+   */
+  bool send(const std::string &payload) {
+    std::string out("$");
+    unsigned char csum = 0;
+    for (size_t i = 0; i < payload.size(); i++) {
+      unsigned char ch = payload[i];
+      if (('$' == ch) || ('#' == ch) || ('*' == ch) || ('}' == ch)) {
+        out += '}';
+        csum += '}';
+        ch ^= 0x20;
+      }
+      out += (char)ch;
+      csum += ch;
+    }
+    char tail[4];
+    snprintf(tail, sizeof(tail), "#%02x", csum);
+    out += tail;
+    return writeAll(out.data(), out.size());
+  }
+
+  /**
+   * @brief sendBreak Send an interrupt (Ctrl-C).
+   */
+  bool sendBreak() { return writeAll("\x03", 1); }
+
+  /**
+   * @brief recv Read the next packet or notification, acking packets unless
+   * in no-ack mode.
+   * @param payload output: the payload, unescaped
+   * @param notification output: true for a notification
+   * @retval false on timeout or if the connection closed
+   */
+  bool recv(std::string *payload, bool *notification) {
+    int ch;
+    do {
+      ch = getChar();
+    } while ((ch >= 0) && ('$' != ch) && ('%' != ch));
+    if (ch < 0) {
+      return false;
+    }
+    *notification = ('%' == ch);
+
+    payload->clear();
+    while (((ch = getChar()) >= 0) && ('#' != ch)) {
+      if ('}' == ch) {
+        ch = getChar() ^ 0x20;
+      }
+      *payload += (char)ch;
+    }
+    if ((ch < 0) || (getChar() < 0) || (getChar() < 0)) {
+      return false;
+    }
+
+    return *notification || noAck || writeAll("+", 1);
+  }
+
+  /**
+   * @brief request Send a packet and read the reply packet.
+   * @retval the reply, or "" on failure
+   */
+  std::string request(const std::string &payload) {
+    std::string reply;
+    bool notification;
+    if (!send(payload) || !recv(&reply, &notification)) {
+      return "";
+    }
+    return reply;
+  }
+
+  /**
+   * @brief setNoAck Stop acking packets, once the server has agreed to
+   * QStartNoAckMode.
+   */
+  void setNoAck() { noAck = true; }
+
+ private:
+  int fd;
+  char rxBuf[16384];
+  int rxHead;
+  int rxTail;
+  bool noAck;
+
+  int getChar() {
+    if (rxHead == rxTail) {
+      struct pollfd pfd = {fd, POLLIN, 0};
+      if (poll(&pfd, 1, REPLY_TIMEOUT_MS) <= 0) {
+        return -1;
+      }
+      ssize_t n = ::recv(fd, rxBuf, sizeof(rxBuf), 0);
+      if (n <= 0) {
+        return -1;
+      }
+      rxHead = 0;
+      rxTail = n;
+    }
+    return rxBuf[rxHead++] & 0xff;
+  }
+
+  bool writeAll(const char *data, size_t len) {
+    while (len > 0) {
+      ssize_t n = ::send(fd, data, len, 0);
+      if (n <= 0) {
+        return false;
+      }
+      data += n;
+      len -= n;
+    }
+    return true;
+  }
+};
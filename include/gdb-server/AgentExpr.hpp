@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2019-2020, University of Southampton and Contributors.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <gdb-server/SimulationControlInterface.hpp>
+#include <vector>
+
+/**
+ * @brief AgentExpr A GDB agent expression: the bytecode GDB sends for
+ * conditions evaluated by the target (see "Agent Expressions" in the GDB
+ * manual).
+ *
+ * The bytecode is checked and decoded once by compile(): operands are
+ * unpacked, jump targets are resolved to instruction indices, and the stack
+ * depth is worked out for every instruction, so evaluate() runs without
+ * bounds checks on a fixed-size stack. Only integer operations are
+ * supported.
+ *
+ * The same bytecode describes what a tracepoint collects: the trace
+ * operations name blocks of memory, which evaluate() can return.
+ */
+class AgentExpr {
+ public:
+  //! Deepest stack an expression may use
+  static const int MAX_STACK = 64;
+
+  //! Most instructions executed by one evaluation, in case of loops
+  static const int MAX_STEPS = 10000;
+
+  //! A block of memory named by a trace operation
+  struct Block {
+    uint64_t addr;
+    uint64_t len;
+  };
+
+  AgentExpr();
+
+  /**
+   * @brief compile Check and decode bytecode.
+   * @param code bytecode
+   * @param len length in bytes
+   * @retval true if the expression is valid and only uses supported
+   * operations.
+   */
+  bool compile(const uint8_t *code, std::size_t len);
+
+  /**
+   * @brief compileHex Check and decode bytecode given as hex digits, as in
+   * RSP packets.
+   * @param hex hex digits, two per byte
+   * @param len length of the bytecode in bytes
+   * @retval true if the expression is valid and only uses supported
+   * operations.
+   */
+  bool compileHex(const char *hex, std::size_t len);
+
+  /**
+   * @brief evaluate Run the expression against a stalled target.
+   * @param simCtrl simulator whose registers and memory are read
+   * @param value output: the value on top of the stack at the end (0 if the
+   * stack is empty)
+   * @param collect output: if not NULL, the blocks named by trace
+   * operations are appended
+   * @retval true on success, false if the expression failed (e.g. a memory
+   * read was rejected, or a division by zero).
+   */
+  bool evaluate(SimulationControlInterface *simCtrl, uint64_t *value,
+                std::vector<Block> *collect = NULL) const;
+
+ private:
+  //! Bytecode operations, numbered as in GDB's ax.def
+  enum Op {
+    OP_ADD = 0x02,
+    OP_SUB = 0x03,
+    OP_MUL = 0x04,
+    OP_DIV_SIGNED = 0x05,
+    OP_DIV_UNSIGNED = 0x06,
+    OP_REM_SIGNED = 0x07,
+    OP_REM_UNSIGNED = 0x08,
+    OP_LSH = 0x09,
+    OP_RSH_SIGNED = 0x0a,
+    OP_RSH_UNSIGNED = 0x0b,
+    OP_TRACE = 0x0c,
+    OP_TRACE_QUICK = 0x0d,
+    OP_LOG_NOT = 0x0e,
+    OP_BIT_AND = 0x0f,
+    OP_BIT_OR = 0x10,
+    OP_BIT_XOR = 0x11,
+    OP_BIT_NOT = 0x12,
+    OP_EQUAL = 0x13,
+    OP_LESS_SIGNED = 0x14,
+    OP_LESS_UNSIGNED = 0x15,
+    OP_EXT = 0x16,
+    OP_REF8 = 0x17,
+    OP_REF16 = 0x18,
+    OP_REF32 = 0x19,
+    OP_REF64 = 0x1a,
+    OP_IF_GOTO = 0x20,
+    OP_GOTO = 0x21,
+    OP_CONST8 = 0x22,
+    OP_CONST16 = 0x23,
+    OP_CONST32 = 0x24,
+    OP_CONST64 = 0x25,
+    OP_REG = 0x26,
+    OP_END = 0x27,
+    OP_DUP = 0x28,
+    OP_POP = 0x29,
+    OP_ZERO_EXT = 0x2a,
+    OP_SWAP = 0x2b,
+    OP_TRACEV = 0x2e,
+    OP_TRACENZ = 0x2f,
+    OP_TRACE16 = 0x30,
+    OP_PICK = 0x32,
+    OP_ROT = 0x33
+  };
+
+  //! A decoded instruction
+  struct Insn {
+    uint8_t op;
+    uint64_t arg;  //!< Operand, or instruction index for jumps
+  };
+
+  std::vector<Insn> prog;
+
+  static bool decodeOp(uint8_t op, int *argLen, int *pops, int *pushes);
+  static bool readTarget(SimulationControlInterface *simCtrl, uint64_t addr,
+                         int size, uint64_t *value);
+};
@@ -30,9 +30,19 @@
 #define GDB_SERVER_SC__H
 
 #include <cstdint>
+#include <deque>
+#include <gdb-server/AgentExpr.hpp>
+#include <gdb-server/MemoryCache.hpp>
+#include <gdb-server/Profiler.hpp>
 #include <gdb-server/RspConnection.hpp>
 #include <gdb-server/RspPacket.hpp>
+#include <gdb-server/RspStats.hpp>
+#include <gdb-server/SessionRecorder.hpp>
 #include <gdb-server/SimulationControlInterface.hpp>
+#include <gdb-server/TraceBuffer.hpp>
+#include <map>
+#include <string>
+#include <vector>
 
 //! Module implementing a GDB RSP server.
 
@@ -46,45 +56,320 @@ class GdbServer {
    * @brief Constructor
    * @param simCtrl Pointer to simulation controller
    * @param rspPort gdb server listening port
+   * @param pktSize maximum RSP packet size (payload chars) advertised to the
+   * client in qSupported. Clamped to at least RSP_PKT_MIN.
    */
-  GdbServer(SimulationControlInterface *simCtrl, int rspPort);
+  GdbServer(SimulationControlInterface *simCtrl, int rspPort,
+            int pktSize = RSP_PKT_DEFAULT);
+
+  /**
+   * @brief Constructor for a multi-core target. Each core is exposed to GDB
+   * as a thread, with thread ID 1 for cores[0], 2 for cores[1] and so on.
+   * The target is debugged all-stop: when any core stops, all are stalled.
+   * @param simCtrls Simulation controllers, one per core (at least one)
+   * @param rspPort gdb server listening port
+   * @param pktSize maximum RSP packet size (payload chars) advertised to the
+   * client in qSupported. Clamped to at least RSP_PKT_MIN.
+   */
+  GdbServer(const std::vector<SimulationControlInterface *> &simCtrls,
+            int rspPort, int pktSize = RSP_PKT_DEFAULT);
   ~GdbServer();
 
   // SystemC thread to listen for and service RSP requests
   void serverThread();
 
+  /**
+   * @brief Choose whether packet checksums are verified in no-ack mode.
+   * @param check true to verify checksums (default), false to skip them.
+   */
+  void setNoAckChecksumCheck(bool check);
+
+  /**
+   * @brief Record every packet received and sent in a session log, for
+   * replay with gdb-server-replay. To record the simulator calls too, wrap
+   * the simulators in RecordingSimulationControl.
+   * @param recorder an open log, or NULL to stop recording
+   */
+  void setRecorder(SessionRecorder *recorder);
+
+  /**
+   * @brief Mark a memory region that must never be cached, e.g. an MMIO
+   * peripheral window.
+   * @param addr start address
+   * @param len length in bytes
+   */
+  void addUncacheableRegion(uint32_t addr, uint32_t len);
+
+  /**
+   * @brief Enable or disable the target memory cache (enabled by default).
+   * The cache is only used while the target is stopped.
+   */
+  void setMemCacheEnabled(bool enabled);
+
+  /**
+   * @brief Declare a RAM region in the memory map served to GDB. Once any
+   * region is declared, GDB treats memory outside the declared regions as
+   * inaccessible.
+   * @param start start address
+   * @param len length in bytes
+   */
+  void addRamRegion(uint32_t start, uint32_t len);
+
+  /**
+   * @brief Declare a flash region in the memory map served to GDB. GDB loads
+   * flash with vFlashErase/vFlashWrite/vFlashDone, which are buffered per
+   * erase block and written to the simulator one block at a time.
+   * @param start start address (aligned to blockSize)
+   * @param len length in bytes (multiple of blockSize)
+   * @param blockSize erase block size in bytes
+   */
+  void addFlashRegion(uint32_t start, uint32_t len, uint32_t blockSize);
+
+  /**
+   * @brief Enable write combining: contiguous M/X writes (e.g. during load)
+   * are merged in a staging buffer and written to the simulator in one call.
+   * The buffer is flushed when the range breaks, when it fills, and before
+   * any other request is handled. A failed flush is reported on the next
+   * write, or only logged if another request triggered it. Disabled by
+   * default.
+   * @param size staging buffer size in bytes, 0 to disable.
+   */
+  void setWriteCombining(std::size_t size);
+
+  //! Default maximum size of a GDB RSP packet. Large enough that memory can
+  //! be moved in a few big packets rather than hundreds of small ones.
+  static const int RSP_PKT_DEFAULT = 0x4000;
+
+  //! Smallest maximum packet size we accept (qSupported pkt can be >240 byte)
+  static const int RSP_PKT_MIN = 512;
+
  private:
   //! Definition of GDB target signals.
 
   //! Data taken from the GDB 6.8 source. Only those we use defined here.
-  enum TargetSignal { TARGET_SIGNAL_NONE = 0, TARGET_SIGNAL_TRAP = 5 };
-
-  //! Maximum size of a GDB RSP packet
-  //  static const int  RSP_PKT_MAX  = NUM_REGS * 8 + 1;
-  static const int RSP_PKT_MAX = 512;  // qSupported pkt can be >240 byte
+  enum TargetSignal {
+    TARGET_SIGNAL_NONE = 0,
+    TARGET_SIGNAL_INT = 2,
+    TARGET_SIGNAL_TRAP = 5
+  };
 
   // OpenRISC exception addresses. Only the ones we need to know about
   static const uint32_t EXCEPT_NONE = 0x000;   //!< No exception
   static const uint32_t EXCEPT_RESET = 0x100;  //!< Reset
 
-  //! Simulation control interface
+  //! Per-core state. Core i is GDB thread i + 1.
+  struct Core {
+    SimulationControlInterface *simCtrl;
+    MemoryCache *memCache;          //!< Memory as seen by this core
+    std::vector<uint32_t> regCache;  //!< Register snapshot, once per stop
+    bool regCacheValid;              //!< Only while the target is stopped
+    bool running;                    //!< Resumed and not yet seen to stop
+    int stopSignal;                  //!< Signal to report when it stops
+    bool stepping;                   //!< Resumed with a step
+    bool stepOver;                   //!< Stepping off a breakpoint whose
+                                     //!< condition was false
+    bool rangeStep;                  //!< Stepping over [rangeStart, rangeEnd)
+    uint32_t rangeStart;
+    uint32_t rangeEnd;
+  };
+
+  //! All the cores of the target
+  std::vector<Core> cores;
+
+  //! Core selected by Hg for register and memory operations
+  int gCore;
+
+  //! Core selected by Hc for step and continue, -1 for all cores
+  int cCore;
+
+  //! Core whose stop was last reported to the client
+  int stopCore;
+
+  //! Signal last reported to the client
+  int lastSignal;
+
+  //! Is the client using non-stop mode (QNonStop:1)
+  bool nonStop;
+
+  //! A core stop not yet acknowledged by the client in non-stop mode
+  struct StopEvent {
+    int core;
+    int signal;
+  };
+
+  //! Stops to report in non-stop mode. The first has been sent as a %Stop
+  //! notification (or in reply to vStopped or '?') and is dropped by the
+  //! next vStopped.
+  std::deque<StopEvent> stopQueue;
+
+  //! Packet for notifications, which may be sent while pkt holds part of a
+  //! request
+  RspPacket *notifyPkt;
+
+  //! Simulation control interface of the selected (Hg) core
   SimulationControlInterface *m_simCtrl;
 
   //! Our associated RSP interface (which we create)
   RspConnection *rsp;
 
+  //! Request counters and latencies, shown by "monitor stats". Each core's
+  //! simulator is wrapped in a TimedSimulationControl adding to them.
+  RspStats *stats;
+
   //! The packet pointer. There is only ever one packet in use at one time, so
   //! there is no need to repeatedly allocate and delete it.
   RspPacket *pkt;
 
+  //! Maximum packet size (payload chars) negotiated with the client
+  int pktSize;
+
+  //! Scratch buffer for memory transfers, large enough for the biggest
+  //! memory read that fits in a packet.
+  uint8_t *memBuf;
+
+  //! A region of target memory declared in the memory map
+  struct MemoryRegion {
+    bool isFlash;
+    uint32_t start;
+    uint32_t len;
+    uint32_t blockSize;  //!< Erase block size (flash only)
+  };
+
+  //! Breakpoints inserted by the client, by address, with the conditions
+  //! evaluated here when one is hit. With no conditions the hit is always
+  //! reported.
+  std::map<uint32_t, std::vector<AgentExpr>> breakpoints;
+
+  //! Most steps taken for a range step, or to carry on past breakpoints
+  //! whose condition is false, before looking for client input, when the
+  //! simulator stalls as soon as step () returns
+  static const int STEP_BATCH = 1000;
+
+  //! A tracepoint location, defined with QTDP
+  struct Tracepoint {
+    uint32_t num;
+    uint32_t addr;
+    bool enabled;
+    uint32_t passCount;  //!< Stop tracing after this many hits, 0 for never
+    uint32_t hits;
+    bool hasCond;
+    AgentExpr cond;
+    bool collectRegs;  //!< Collect the register file
+
+    //! Memory to collect: len bytes at offset, plus the value of baseReg
+    //! unless it is -1
+    struct MemRange {
+      int baseReg;
+      uint32_t offset;
+      uint32_t len;
+    };
+    std::vector<MemRange> memRanges;
+
+    //! Expressions whose trace operations name more memory to collect
+    std::vector<AgentExpr> exprs;
+  };
+
+  //! Tracepoints defined by the client
+  std::vector<Tracepoint> tracepoints;
+
+  //! Store of trace frames. Sized when tracing starts.
+  TraceBuffer *traceBuf;
+
+  //! Size of the trace buffer to use, set by QTBuffer:size
+  std::size_t traceBufSize;
+
+  //! Is a trace experiment running
+  bool tracing;
+
+  //! Why tracing stopped, in qTStatus form, e.g. "tnotrun:0"
+  std::string traceStopReason;
+
+  //! Frame selected with QTFrame, whose registers and memory are served
+  //! instead of the target's, or -1
+  int traceFrame;
+
+  //! Read-only sections declared with QTro, served from the target while a
+  //! frame is selected
+  std::vector<std::pair<uint32_t, uint32_t>> traceReadOnly;
+
+  //! Scratch space for collecting memory
+  std::vector<uint8_t> traceScratch;
+  std::vector<AgentExpr::Block> traceBlocks;
+
+  //! Regions of the memory map served with qXfer:memory-map:read
+  std::vector<MemoryRegion> memoryRegions;
+
+  //! Flash blocks erased by vFlashErase and not yet committed by vFlashDone,
+  //! keyed by block address. Each holds the block's new contents.
+  std::map<uint32_t, std::vector<uint8_t>> flashBlocks;
+
+  //! Write-combining staging buffer (empty if write combining is disabled)
+  std::vector<uint8_t> wcBuf;
+
+  //! Start address of the data staged in wcBuf
+  uint32_t wcAddr;
+
+  //! Number of bytes staged in wcBuf
+  std::size_t wcLen;
+
+  //! Cache of target memory for the selected (Hg) core, valid while the
+  //! target is stopped
+  MemoryCache *memCache;
+
+  //! Scratch buffer for whole register file transfers (g/G packets)
+  std::vector<uint32_t> regBuf;
+
   //! Is the target stopped
   bool targetStopped;
 
+  //! eventfd signalled by the simulator's stall callback (-1 if unavailable)
+  int stallEventFd;
+
+  //! Does the simulator notify us of stalls, or must we poll isStalled()
+  bool stallNotify;
+
+  //! How long to block waiting for a stall notification before rechecking
+  //! whether the server should stop (ms)
+  static const int STALL_WAIT_TIMEOUT = 100;
+
+  //! PC samples taken while the target runs, controlled by "monitor profile"
+  Profiler *profiler;
+
+  // Wait (briefly) for the running target to stall or the client to send
+  bool waitForEvent();
+  void sampleProfile();
+
+  // Steps of serving a client, shared by serverThread () and GdbServerPool
+  friend class GdbServerPool;
+  void serverStart();
+  void serverStop();
+  void clientConnected();
+  bool pollTarget();
+  bool pollTargetNonStop();
+  void rspPollClient();
+  void rspInterrupt();
+  void rspDisconnect();
+  void rspDispatch();
+  void rspHandleRequest();
+
+  // Multi-core helpers
+  void selectCore(int core);
+  int parseThreadId(const char *str);
+  void resumeCores(bool step);
+  void resumeCore(int core, bool step);
+  int findStoppedCore();
+  bool continueRangeStep(int core);
+  bool continuePastBreakpoint(int core);
+  bool conditionTrue(int core, const std::vector<AgentExpr> &conds);
+  void stallAllCores();
+  bool shouldStopServer();
+
   // Main RSP request handler
   void rspClientRequest();
 
   // Handle the various RSP requests
   void rspReportException();
+  int packStopReply(char *buf, int core, int signal);
   void rspContinue();
   void rspContinue(uint32_t except);
   void rspContinue(uint32_t addr, uint32_t except);
@@ -96,13 +381,27 @@ class GdbServer {
   void rspWriteReg();
   void rspQuery();
   void rspCommand();
+  void rspConsoleOutput(const std::string &text);
+  void rspProfile(const std::vector<std::string> &args);
   void qSupported();
   void rspSet();
+  void rspSetThread();
   void rspRestart();
   void rspStep();
   void rspStep(uint32_t except);
   void rspStep(uint32_t addr, uint32_t except);
   void rspVpkt();
+  void rspVCont();
+  void rspStopped();
+  void rspNonStop();
+  void rspCrc();
+  void rspReadMemoryMap();
+  void rspFlashErase();
+  void rspFlashWrite();
+  void rspFlashDone();
+  std::string memoryMapXml();
+  const MemoryRegion *findFlashRegion(uint32_t addr);
+  void rspReadMemBin();
   void rspWriteMemBin();
   void rspRemoveMatchpoint();
   void rspInsertMatchpoint();
@@ -115,14 +414,48 @@ class GdbServer {
     WP_ACCESS = 4
   };
 
-  // Convenience wrappers for getting particular registers, which are really
-  // SPRs.
+  bool parseConditions(const char *str, std::vector<AgentExpr> *conds);
+  bool parseAgentExpr(const char *str, AgentExpr *expr, const char **next);
+  void rspWatchpoint(bool insert, MpType type, uint32_t addr, uint32_t len);
+
+  // Tracepoints
+  void rspTraceDefine();
+  bool parseTracepoint(const char *str);
+  bool parseTraceActions(Tracepoint *tp, const char *str);
+  void rspTraceStart();
+  void rspTraceStatus();
+  void rspTraceFrame();
+  void rspTracepointStatus();
+  void rspTraceBuffer();
+  void stopTracing(const std::string &reason);
+  void insertTracepoints(bool insert);
+  bool isTracepoint(uint32_t addr);
+  bool collectTraceFrame(int core, uint32_t pc);
+  bool readTraceMem(uint8_t *out, uint32_t addr, std::size_t len);
+  void packTraceReg(int regNum, char *buf);
+
+  // Convenience wrappers for getting particular registers, served from the
+  // register cache while the target is stopped.
   uint32_t readNpc();
   void writeNpc(uint32_t addr);
 
   uint32_t readGpr(int regNum);
   void writeGpr(int regNum, uint32_t value);
 
+  // Drop everything cached about the stopped target, before it runs again
+  void invalidateCaches();
+
+  // Read memory, through the cache unless part of the target is running
+  bool readMem(uint8_t *out, uint32_t addr, std::size_t len);
+
+  // Write memory through the selected core's cache, keeping the other cores'
+  // caches coherent
+  bool writeMem(uint8_t *src, uint32_t addr, std::size_t len);
+
+  // Write memory via the write-combining buffer
+  bool writeMemCombined(uint8_t *src, uint32_t addr, std::size_t len);
+  bool flushWriteCombine();
+
 };  // GdbServer ()
 
 #endif  // GDB_SERVER_SC__H
@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2019-2020, University of Southampton and Contributors.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <gdb-server/GdbServer.hpp>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief GdbServerPool Serves many GdbServer instances from a single thread,
+ * instead of one serverThread() per server. An epoll loop waits on every
+ * server's listening socket, client connection and stall notification, and
+ * each session is driven as a non-blocking state machine: packets are
+ * handled as they complete, and a running target is checked when it reports
+ * a stall (or, for simulators without a stall callback, every millisecond).
+ *
+ * Servers can be added and removed at any time, from any thread. To use N
+ * I/O threads, create N pools and share the servers between them. Replies
+ * are still written with blocking writes, so a client that stops reading
+ * can hold up the other sessions on its pool.
+ */
+class GdbServerPool {
+ public:
+  GdbServerPool();
+  ~GdbServerPool();
+
+  /**
+   * @brief addServer Start listening on the server's port and serve it from
+   * this pool. The server must not also be run with serverThread().
+   * @param server The server to add
+   * @retval bool true if success, false if the port could not be opened.
+   */
+  bool addServer(GdbServer *server);
+
+  /**
+   * @brief removeServer Stop serving a server, closing its listening socket
+   * and any client connection. Once this returns the server may be deleted,
+   * except when called from the thread running run() (e.g. from a simulator
+   * callback), where removal happens after the current event is handled.
+   * Servers whose simulator asks to stop the server are removed
+   * automatically.
+   * @param server The server to remove
+   */
+  void removeServer(GdbServer *server);
+
+  /**
+   * @brief run Service the servers until stop() is called.
+   */
+  void run();
+
+  /**
+   * @brief stop Make run() return. May be called from any thread.
+   */
+  void stop();
+
+ private:
+  //! What a file descriptor waited on by the loop belongs to
+  enum SourceType { SRC_WAKE, SRC_LISTEN, SRC_CLIENT, SRC_STALL };
+
+  struct Session;
+
+  //! Context attached to each file descriptor in the epoll set
+  struct Source {
+    SourceType type;
+    Session *session;  //!< NULL for SRC_WAKE
+  };
+
+  //! Per-server state of the loop
+  struct Session {
+    GdbServer *server;
+    Source listen;
+    Source client;
+    Source stall;
+    int clientFd;  //!< Client fd registered with epoll, or -1
+    bool retired;  //!< Removed, but events may still refer to it
+  };
+
+  //! Most events handled per epoll_wait()
+  static const int MAX_EVENTS = 64;
+
+  //! How often to check targets that can't notify us of stalls (ms)
+  static const int STALL_POLL_INTERVAL = 1;
+
+  int epollFd;
+  int wakeFd;  //!< eventfd used to wake the loop
+  Source wakeSource;
+
+  //! Sessions by server. Only changed by the loop thread (or by add/remove
+  //! when no loop is running), with lock held.
+  std::map<GdbServer *, Session *> sessions;
+
+  //! Servers waiting to be added to or removed from the loop
+  std::vector<GdbServer *> pendingAdd;
+  std::vector<GdbServer *> pendingRemove;
+
+  //! Sessions retired while handling the current batch of events
+  std::vector<Session *> retired;
+
+  std::mutex lock;
+  std::condition_variable changed;  //!< Signalled when sessions changes
+  bool running;
+  bool stopRequested;
+  std::thread::id loopThread;
+
+  void wake();
+  void applyPending();
+  void attach(GdbServer *server);
+  void retire(Session *session);
+  void dropClient(Session *session);
+  void handleListen(Session *session);
+  void handleClient(Session *session);
+  void handleStall(Session *session);
+  bool needsPolling();
+};
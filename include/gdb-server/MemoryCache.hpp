@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2019-2020, University of Southampton and Contributors.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <gdb-server/SimulationControlInterface.hpp>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief MemoryCache Page-granular cache of target memory, only valid while
+ * the target is stalled. Reads are served from the cache where possible,
+ * writes are written through to the simulator. The owner must call
+ * invalidate() before the target is allowed to run.
+ *
+ * Regions that must always be read from the simulator (e.g. memory mapped
+ * peripherals) can be marked uncacheable. Sequential small reads that miss
+ * trigger an increasing amount of read-ahead.
+ */
+class MemoryCache {
+ public:
+  /**
+   * @brief Constructor
+   * @param simCtrl Simulation controller to read/write memory through.
+   * @param pageSize Cache page size in bytes (power of two).
+   * @param maxPages Maximum number of cached pages. The cache is flushed
+   * when it fills.
+   */
+  MemoryCache(SimulationControlInterface *simCtrl, uint32_t pageSize = 64,
+              std::size_t maxPages = 4096);
+
+  /**
+   * @brief read Read memory, from the cache if possible.
+   * @param out output buffer
+   * @param addr start address
+   * @param len number of bytes
+   * @retval true on success, false if the simulator rejected the read.
+   */
+  bool read(uint8_t *out, uint32_t addr, std::size_t len);
+
+  /**
+   * @brief write Write memory through to the simulator, updating any cached
+   * copy.
+   * @param src source buffer
+   * @param addr start address
+   * @param len number of bytes
+   * @retval true on success, false if the simulator rejected the write.
+   */
+  bool write(uint8_t *src, uint32_t addr, std::size_t len);
+
+  /**
+   * @brief invalidate Drop all cached data. Must be called before the target
+   * runs.
+   */
+  void invalidate();
+
+  /**
+   * @brief invalidate Drop cached data overlapping a range, e.g. after the
+   * simulator changed it behind the cache's back.
+   * @param addr start address
+   * @param len number of bytes
+   */
+  void invalidate(uint32_t addr, std::size_t len);
+
+  /**
+   * @brief addUncacheable Mark a region that must always be accessed in the
+   * simulator, e.g. an MMIO peripheral window.
+   * @param addr start address
+   * @param len length in bytes
+   */
+  void addUncacheable(uint32_t addr, uint32_t len);
+
+  /**
+   * @brief setEnabled Enable or disable caching. When disabled, all accesses
+   * go straight to the simulator.
+   */
+  void setEnabled(bool enabled);
+
+  // ------ Statistics ------
+  //! Number of reads served entirely from the cache
+  uint64_t getHits() const { return hits; }
+
+  //! Number of reads which needed at least one simulator access
+  uint64_t getMisses() const { return misses; }
+
+  //! Number of reads which bypassed the cache (uncacheable or disabled)
+  uint64_t getBypasses() const { return bypasses; }
+
+  //! Reset the statistics counters
+  void resetStats();
+
+ private:
+  //! Largest read-ahead, in pages
+  static const uint32_t MAX_READ_AHEAD = 16;
+
+  //! One past the highest address. Accesses beyond it bypass the cache.
+  static const uint64_t ADDR_SPACE_END = (uint64_t)1 << 32;
+
+  bool isCacheable(uint32_t addr, std::size_t len) const;
+  uint8_t *findPage(uint32_t page);
+  bool fill(uint32_t firstPage, uint32_t nPages, uint32_t extra);
+
+  SimulationControlInterface *m_simCtrl;
+  uint32_t pageSize;
+  uint32_t pageShift;
+  std::size_t maxPages;
+  bool enabled;
+
+  //! Page data, maxPages * pageSize bytes, allocated in order of use
+  std::vector<uint8_t> pool;
+
+  //! Number of pages in use in pool
+  std::size_t usedPages;
+
+  //! Page number -> index of the page in pool
+  std::unordered_map<uint32_t, std::size_t> pageIndex;
+
+  //! Uncacheable regions as (start, end) pairs, end exclusive
+  std::vector<std::pair<uint64_t, uint64_t>> uncacheable;
+
+  //! End address of the last read, to detect sequential access
+  uint64_t lastReadEnd;
+
+  //! Current read-ahead, in pages
+  uint32_t readAhead;
+
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t bypasses;
+};
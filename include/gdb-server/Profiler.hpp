@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2019-2020, University of Southampton and Contributors.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+/**
+ * @brief Profiler Statistical PC profile of the running target. The server
+ * samples the PC of each running core at a fixed rate while it waits for the
+ * target, and counts the samples per address.
+ *
+ * The profile can be written out as a gprof gmon.out file (a flat profile
+ * histogram, read with e.g. `msp430-elf-gprof -p firmware.elf gmon.out`), or
+ * as text, one "address count" line per sampled PC, for a simple symbolizer
+ * such as addr2line.
+ */
+class Profiler {
+ public:
+  //! Default sampling rate, in samples per second
+  static const unsigned DEFAULT_RATE = 1000;
+
+  //! Highest sampling rate. The server waits in 1 ms steps.
+  static const unsigned MAX_RATE = 1000;
+
+  Profiler();
+
+  /**
+   * @brief start Drop any samples and start sampling.
+   * @param rate samples per second, 1 to MAX_RATE
+   */
+  void start(unsigned rate = DEFAULT_RATE);
+
+  /**
+   * @brief stop Stop sampling, keeping the samples.
+   */
+  void stop() { running = false; }
+
+  bool isRunning() const { return running; }
+  unsigned getRate() const { return rate; }
+  uint64_t getSamples() const { return samples; }
+  std::size_t getAddresses() const { return hist.size(); }
+
+  /**
+   * @brief msUntilSample How long until the next sample is due.
+   * @retval ms to wait, 0 if due now
+   */
+  int msUntilSample() const;
+
+  /**
+   * @brief sampleDue Is a sample due? If so, schedule the next one.
+   */
+  bool sampleDue();
+
+  /**
+   * @brief addSample Count a sample of the PC.
+   */
+  void addSample(uint32_t pc) {
+    hist[pc]++;
+    samples++;
+  }
+
+  /**
+   * @brief writeGmon Write the profile as a gprof gmon.out histogram.
+   * @param path file to write
+   * @param bigEndian write in big-endian byte order (the target's order)
+   * @retval true on success
+   */
+  bool writeGmon(const char *path, bool bigEndian) const;
+
+  /**
+   * @brief writeText Write the profile as text, one line per sampled PC in
+   * address order: "0x<pc> <samples>".
+   * @param path file to write
+   * @retval true on success
+   */
+  bool writeText(const char *path) const;
+
+  /**
+   * @brief summary Describe the profile, with the most sampled addresses.
+   * @param top number of addresses to list
+   */
+  std::string summary(std::size_t top) const;
+
+ private:
+  //! Most bins written to a gmon.out histogram. Bins are widened beyond the
+  //! usual 2 bytes to fit.
+  static const uint64_t MAX_BINS = 1 << 20;
+
+  typedef std::chrono::steady_clock Clock;
+
+  std::unordered_map<uint32_t, uint64_t> hist;  //!< Samples per PC
+  uint64_t samples;
+  unsigned rate;
+  bool running;
+  Clock::time_point nextSample;
+};
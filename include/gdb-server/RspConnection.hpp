@@ -30,6 +30,8 @@
 #define RSP_CONNECTION__H
 
 #include <gdb-server/RspPacket.hpp>
+#include <gdb-server/RspStats.hpp>
+#include <gdb-server/SessionRecorder.hpp>
 
 //! The default service to use if port number = 0 and no service specified
 #define DEFAULT_RSP_SERVICE "gdb-server123"
@@ -64,21 +66,44 @@ class RspConnection {
 
   // Public interface: manage client connections
   bool rspConnect();
+  bool rspListen();
+  bool rspAccept();
+  void rspAttach(int fd);
+  void rspUnlisten();
   void rspClose();
   bool isConnected();
+  int getListenFd();
+  int getClientFd();
+  void setAsyncAcks(bool async);
+  void setNoAckMode(bool noAck);
+  void setNoAckChecksumCheck(bool check);
+  void setRecorder(SessionRecorder *rec);
+  void setStats(RspStats *s);
 
   // Public interface: get packets from the stream and put them out
   bool getPkt(RspPacket *pkt);
+  int pollPkt(RspPacket *pkt);
+  int pollBreak();
+  bool rxPending();
   bool putPkt(RspPacket *pkt);
+  bool putNotification(RspPacket *pkt);
 
  private:
   // Generic initializer
   void rspInit(int _portNum, const char *_serviceName);
 
+  // Build a packet (or notification) in txBuf
+  int packTx(char start, RspPacket *pkt);
+
   // Internal routines to handle individual chars
   bool putRspChar(char c);
   bool putRspStr(char *const c, const size_t len);
   int getRspChar();
+  bool fillRxBuf();
+  int pollRxBuf();
+
+  //! Size of the receive buffer
+  static const int RX_BUF_SIZE = 16384;
 
   //! The port number to listen on
   int portNum;
@@ -86,9 +111,61 @@ class RspConnection {
   //! The service name to listen on
   const char *serviceName;
 
+  //! The listening socket file descriptor
+  int listenFd;
+
   //! The client file descriptor
   int clientFd;
 
+  //! Receive buffer. Filled with as many bytes as the socket has available in
+  //! a single recv (), and drained by getRspChar () and getPkt ().
+  char rxBuf[RX_BUF_SIZE];
+
+  //! Index of the next unread char in rxBuf
+  int rxHead;
+
+  //! Index one past the last valid char in rxBuf
+  int rxTail;
+
+  //! Transmit buffer, grown by putPkt () to fit the largest escaped packet
+  //! sent so far on this connection.
+  char *txBuf;
+
+  //! Size of txBuf
+  int txBufSize;
+
+  //! Length of the last packet sent (still in txBuf), for retransmission
+  int txLen;
+
+  //! Where pollPkt () has got to in the packet being received
+  enum RxState { RX_IDLE, RX_BODY, RX_CSUM_HI, RX_CSUM_LO };
+  RxState rxState;
+
+  //! Chars of the packet body received so far by pollPkt ()
+  int rxCount;
+
+  //! Checksum computed so far by pollPkt ()
+  unsigned char rxChecksum;
+
+  //! Checksum sent by the client, as parsed by pollPkt ()
+  unsigned char rxXmitCsum;
+
+  //! Don't wait for the client to ack each packet sent. Acks (and requests
+  //! to retransmit) are picked up by pollPkt () instead.
+  bool asyncAcks;
+
+  //! Don't send or wait for acks (negotiated with QStartNoAckMode)
+  bool noAckMode;
+
+  //! Verify packet checksums while in no-ack mode
+  bool checkNoAckChecksum;
+
+  //! Where to record packets sent and received, or NULL
+  SessionRecorder *recorder;
+
+  //! Where to count the bytes and time spent sending, or NULL
+  RspStats *stats;
+
 };  // RspConnection ()
 
 #endif  // RSP_CONNECTION__H
@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2019-2020, University of Southampton and Contributors.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <gdb-server/SimulationControlInterface.hpp>
+#include <string>
+#include <vector>
+
+/**
+ * @brief RspStats Counters and latency histograms for the requests a server
+ * handles, kept per command letter and per q, Q and v packet name.
+ *
+ * Each request's time is split between the simulator (time spent in
+ * simulator calls, measured by TimedSimulationControl), the socket (time
+ * spent sending replies, measured by the connection) and the server itself
+ * (the rest). The time the server spends waiting for the client's next
+ * request is kept separately.
+ *
+ * Everything is in tables allocated up front, and only the server thread
+ * updates them, so recording a request takes no locks and no allocation.
+ */
+class RspStats {
+ public:
+  //! Histogram buckets. Bucket 0 holds times under 256 ns, and each bucket
+  //! after covers twice the time of the one before, up to about 1 s.
+  static const int N_BUCKETS = 24;
+
+  //! Fixed bucket latency histogram
+  struct Histogram {
+    uint64_t count;
+    uint64_t totalNs;
+    uint64_t maxNs;
+    uint64_t buckets[N_BUCKETS];
+
+    void add(uint64_t ns);
+
+    /**
+     * @brief percentile Estimate a percentile from the buckets.
+     * @param p percentile, 0 to 100
+     * @retval the upper bound of the bucket holding it, in ns
+     */
+    uint64_t percentile(double p) const;
+  };
+
+  //! Counters for one kind of request
+  struct Entry {
+    uint64_t count;
+    uint64_t bytesIn;   //!< Payload bytes received
+    uint64_t bytesOut;  //!< Bytes sent in reply, as framed
+    Histogram total;
+    Histogram server;
+    Histogram sim;
+    Histogram socket;
+  };
+
+  //! A request being timed, from begin() to end()
+  struct Request {
+    int entry;
+    uint64_t generation;
+    uint64_t bytesIn;
+    uint64_t start;
+    uint64_t simNs;
+    uint64_t socketNs;
+    uint64_t txBytes;
+  };
+
+  RspStats();
+
+  /**
+   * @brief reset Zero every counter and histogram.
+   */
+  void reset();
+
+  //! Monotonic time in ns
+  static uint64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  /**
+   * @brief begin Start timing a request.
+   * @param data request payload
+   * @param len payload length
+   */
+  Request begin(const char *data, std::size_t len);
+
+  /**
+   * @brief end Finish timing a request, and add it to the counters.
+   */
+  void end(const Request &req);
+
+  /**
+   * @brief clientWait Record the time spent waiting for a request.
+   */
+  void clientWait(uint64_t ns) { wait.add(ns); }
+
+  /**
+   * @brief simCall Record the time spent in a simulator call.
+   */
+  void simCall(uint64_t ns) { simNs += ns; }
+
+  /**
+   * @brief sent Record a packet or notification sent.
+   * @param bytes bytes sent, as framed
+   * @param ns time taken, including waiting for the ack
+   */
+  void sent(std::size_t bytes, uint64_t ns) {
+    txBytes += bytes;
+    socketNs += ns;
+  }
+
+  /**
+   * @brief report Format the statistics as a table, busiest request first.
+   */
+  std::string report() const;
+
+ private:
+  //! Entries before this are indexed by command letter
+  static const int N_LETTERS = 128;
+
+  //! q, Q and v packets counted by name
+  static const char *const NAMES[];
+
+  std::vector<Entry> entries;
+  Histogram wait;
+  uint64_t resetTime;
+  uint64_t generation;  //!< Counts resets, so requests spanning one are dropped
+
+  // Running totals, sampled by begin () and end ()
+  uint64_t simNs;
+  uint64_t socketNs;
+  uint64_t txBytes;
+
+  int classify(const char *data, std::size_t len) const;
+  std::string entryName(int entry) const;
+};
+
+/**
+ * @brief TimedSimulationControl Simulator wrapper that adds the time taken
+ * by each call to RspStats, then returns the result. The server wraps every
+ * simulator it is given in one.
+ */
+class TimedSimulationControl : public SimulationControlInterface {
+ public:
+  TimedSimulationControl(SimulationControlInterface *simCtrl, RspStats *stats)
+      : simCtrl(simCtrl), stats(stats) {}
+
+  void kill() override;
+  void reset() override;
+  void stall() override;
+  void unstall() override;
+  bool isStalled() override;
+  bool setStallCallback(std::function<void()> cb) override {
+    return simCtrl->setStallCallback(cb);
+  }
+  void step() override;
+  void insertBreakpoint(unsigned addr) override;
+  void removeBreakpoint(unsigned addr) override;
+  bool insertWatchpoint(WatchType type, unsigned addr,
+                        std::size_t len) override;
+  bool removeWatchpoint(WatchType type, unsigned addr,
+                        std::size_t len) override;
+  bool getWatchpointHit(WatchType *type, unsigned *addr) override;
+  uint32_t readReg(std::size_t num) override;
+  void writeReg(std::size_t num, uint32_t value) override;
+  void readRegs(uint32_t *out, std::size_t first, std::size_t count) override;
+  void writeRegs(const uint32_t *src, std::size_t first,
+                 std::size_t count) override;
+  bool readMem(uint8_t *out, unsigned addr, std::size_t len) override;
+  bool writeMem(uint8_t *src, unsigned addr, std::size_t len) override;
+  uint32_t pcRegNum() override { return simCtrl->pcRegNum(); }
+  uint32_t nRegs() override { return simCtrl->nRegs(); }
+  uint32_t wordSize() override { return simCtrl->wordSize(); }
+  void stopServer() override { simCtrl->stopServer(); }
+  bool shouldStopServer() override { return simCtrl->shouldStopServer(); }
+  bool isServerRunning() override { return simCtrl->isServerRunning(); }
+  void setServerRunning(bool status) override {
+    simCtrl->setServerRunning(status);
+  }
+  uint32_t htotl(uint32_t hostVal) override { return simCtrl->htotl(hostVal); }
+  uint32_t ttohl(uint32_t targetVal) override {
+    return simCtrl->ttohl(targetVal);
+  }
+
+ private:
+  SimulationControlInterface *simCtrl;
+  RspStats *stats;
+};
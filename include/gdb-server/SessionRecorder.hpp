@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2019-2020, University of Southampton and Contributors.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <gdb-server/SimulationControlInterface.hpp>
+#include <mutex>
+#include <vector>
+
+/**
+ * @brief SessionRecorder Binary log of a debugging session: every packet
+ * received and sent, and every simulator call the server made, each with a
+ * monotonic timestamp. The log can be fed back into a server against a mock
+ * simulator with the gdb-server-replay tool.
+ *
+ * Packets are recorded by the connection, once GdbServer::setRecorder() is
+ * called. Simulator calls are recorded by wrapping each simulator in a
+ * RecordingSimulationControl before handing it to the server.
+ *
+ * Records are gathered in memory and written out in large blocks, so
+ * recording costs little more than a copy per packet or call.
+ *
+ * The file is the 8 byte MAGIC, then records in host byte order, each a
+ * 16 byte header (uint64_t time in ns since the log was opened, uint32_t
+ * data length, uint8_t kind, op and core, one pad byte), three uint32_t
+ * arguments for simulator calls only, then the data.
+ */
+class SessionRecorder {
+ public:
+  //! What a record holds
+  enum Kind : uint8_t {
+    PKT_RX = 'r',     //!< Packet from the client
+    PKT_TX = 't',     //!< Packet to the client
+    NOTIFY_TX = 'n',  //!< Notification to the client
+    BREAK_RX = 'b',   //!< Interrupt (Ctrl-C) from the client
+    SIM_INFO = 'i',   //!< Simulator description: nRegs, pcRegNum, wordSize,
+                      //!< and htotl(1) as data
+    SIM_CALL = 's'    //!< Simulator call
+  };
+
+  //! Simulator calls. For each, the arguments recorded and the data.
+  enum SimOp : uint8_t {
+    SIM_STALL,         //!< -
+    SIM_UNSTALL,       //!< -
+    SIM_STEP,          //!< -
+    SIM_IS_STALLED,    //!< result (only recorded when it changes)
+    SIM_RESET,         //!< -
+    SIM_KILL,          //!< -
+    SIM_INSERT_BP,     //!< addr
+    SIM_REMOVE_BP,     //!< addr
+    SIM_INSERT_WP,     //!< addr, len, result; data: type
+    SIM_REMOVE_WP,     //!< addr, len, result; data: type
+    SIM_WATCH_HIT,     //!< addr, type, result
+    SIM_READ_REG,      //!< num, -, value
+    SIM_WRITE_REG,     //!< num, value
+    SIM_READ_REGS,     //!< first, count; data: values
+    SIM_WRITE_REGS,    //!< first, count; data: values
+    SIM_READ_MEM,      //!< addr, len, result; data: bytes read
+    SIM_WRITE_MEM      //!< addr, len, result; data: bytes written
+  };
+
+  //! A record, as loaded from a log
+  struct Record {
+    uint64_t time;  //!< ns since the log was opened
+    Kind kind;
+    SimOp op;
+    uint8_t core;
+    uint32_t args[3];
+    std::vector<uint8_t> data;
+  };
+
+  //! Identifies a session log, and its version
+  static const char MAGIC[8];
+
+  SessionRecorder();
+  ~SessionRecorder();
+
+  /**
+   * @brief open Start a new log, replacing any existing file.
+   * @param path file to write
+   * @retval true on success
+   */
+  bool open(const char *path);
+
+  /**
+   * @brief close Write out any buffered records and close the log.
+   */
+  void close();
+
+  bool isOpen() const;
+
+  /**
+   * @brief packet Record a packet, notification or interrupt.
+   * @param kind PKT_RX, PKT_TX, NOTIFY_TX or BREAK_RX
+   * @param data packet payload, unescaped
+   * @param len payload length
+   */
+  void packet(Kind kind, const char *data, std::size_t len);
+
+  /**
+   * @brief simCall Record a simulator call.
+   * @param op the call
+   * @param core core (simulator) number
+   * @param a first argument
+   * @param b second argument
+   * @param result result, or third argument
+   * @param data data read or written, if any
+   * @param len length of data
+   */
+  void simCall(SimOp op, int core, uint32_t a, uint32_t b, uint32_t result,
+               const void *data = NULL, std::size_t len = 0);
+
+  /**
+   * @brief simInfo Record the description of a simulator.
+   */
+  void simInfo(int core, SimulationControlInterface *simCtrl);
+
+  /**
+   * @brief flush Write out the buffered records.
+   */
+  void flush();
+
+  /**
+   * @brief load Read a whole log.
+   * @param path file to read
+   * @param records output: the records, in order
+   * @retval true on success, false if the file can't be read or is not a
+   * session log. A log cut short is loaded up to its last whole record.
+   */
+  static bool load(const char *path, std::vector<Record> *records);
+
+ private:
+  //! Buffered bytes at which the buffer is written out
+  static const std::size_t FLUSH_SIZE = 1 << 16;
+
+  typedef std::chrono::steady_clock Clock;
+
+  std::FILE *file;
+  Clock::time_point start;
+  std::vector<uint8_t> buf;
+  //! Guards everything above. Servers in a pool may share a recorder.
+  mutable std::mutex lock;
+
+  void append(Kind kind, SimOp op, int core, const uint32_t *args,
+              const void *data, std::size_t len);
+  void writeOut();
+};
+
+/**
+ * @brief RecordingSimulationControl Simulator wrapper that records every call
+ * made through it in a SessionRecorder, then passes it on.
+ * The recorder should be opened first, as the simulator's description is
+ * recorded when the wrapper is made.
+ */
+class RecordingSimulationControl : public SimulationControlInterface {
+ public:
+  /**
+   * @brief Constructor
+   * @param simCtrl simulator to wrap
+   * @param recorder log to record into
+   * @param core core number to record the calls against (for a multi-core
+   * target, the index of the simulator in the vector given to GdbServer)
+   */
+  RecordingSimulationControl(SimulationControlInterface *simCtrl,
+                             SessionRecorder *recorder, int core = 0);
+
+  void kill() override;
+  void reset() override;
+  void stall() override;
+  void unstall() override;
+  bool isStalled() override;
+  bool setStallCallback(std::function<void()> cb) override {
+    return simCtrl->setStallCallback(cb);
+  }
+  void step() override;
+  void insertBreakpoint(unsigned addr) override;
+  void removeBreakpoint(unsigned addr) override;
+  bool insertWatchpoint(WatchType type, unsigned addr,
+                        std::size_t len) override;
+  bool removeWatchpoint(WatchType type, unsigned addr,
+                        std::size_t len) override;
+  bool getWatchpointHit(WatchType *type, unsigned *addr) override;
+  uint32_t readReg(std::size_t num) override;
+  void writeReg(std::size_t num, uint32_t value) override;
+  void readRegs(uint32_t *out, std::size_t first, std::size_t count) override;
+  void writeRegs(const uint32_t *src, std::size_t first,
+                 std::size_t count) override;
+  bool readMem(uint8_t *out, unsigned addr, std::size_t len) override;
+  bool writeMem(uint8_t *src, unsigned addr, std::size_t len) override;
+  uint32_t pcRegNum() override { return simCtrl->pcRegNum(); }
+  uint32_t nRegs() override { return simCtrl->nRegs(); }
+  uint32_t wordSize() override { return simCtrl->wordSize(); }
+  void stopServer() override { simCtrl->stopServer(); }
+  bool shouldStopServer() override { return simCtrl->shouldStopServer(); }
+  bool isServerRunning() override { return simCtrl->isServerRunning(); }
+  void setServerRunning(bool status) override {
+    simCtrl->setServerRunning(status);
+  }
+  uint32_t htotl(uint32_t hostVal) override { return simCtrl->htotl(hostVal); }
+  uint32_t ttohl(uint32_t targetVal) override {
+    return simCtrl->ttohl(targetVal);
+  }
+
+ private:
+  SimulationControlInterface *simCtrl;
+  SessionRecorder *recorder;
+  int core;
+  bool lastStalled;  //!< Last isStalled () result recorded
+};
@@ -7,7 +7,9 @@
 
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
+#include <functional>
 
 /**
  * @brief SimulationControlInterface Interface to control and interact with
@@ -59,6 +61,18 @@ class SimulationControlInterface {
    */
   // virtual void waitForTargetStalled() = 0;
 
+  /**
+   * @brief setStallCallback Register a function to be called whenever
+   * execution stalls (breakpoint hit, single-step done, stall() etc.), so the
+   * controller doesn't have to poll isStalled(). The callback may be called
+   * from any thread, and an empty function unregisters it. Optional: the
+   * default implementation doesn't support notification, and the controller
+   * falls back to polling isStalled().
+   * @param cb function to call on stall.
+   * @retval true if the callback will be called on stall, false otherwise.
+   */
+  virtual bool setStallCallback(std::function<void()> cb) { return false; }
+
   /**
    * @brief step execute a single instruction, then stall
    */
@@ -77,6 +91,49 @@ class SimulationControlInterface {
    */
   virtual void removeBreakpoint(unsigned addr) = 0;
 
+  // Watchpoints
+  //! Kinds of data watchpoint, numbered as in the RSP Z packets
+  enum WatchType { WATCH_WRITE = 2, WATCH_READ = 3, WATCH_ACCESS = 4 };
+
+  /**
+   * @brief insertWatchpoint Stall when the target accesses any byte of
+   * [addr, addr + len) in the given way. WatchRangeIndex can keep track of
+   * the watched ranges. The default does not support watchpoints, and GDB
+   * falls back to (slow) software watchpoints.
+   * @param type kind of access to stall on
+   * @param addr start address
+   * @param len number of bytes watched
+   * @retval true if the watchpoint was inserted
+   */
+  virtual bool insertWatchpoint(WatchType type, unsigned addr,
+                                std::size_t len) {
+    return false;
+  }
+
+  /**
+   * @brief removeWatchpoint Remove a watchpoint set by insertWatchpoint().
+   * @param type kind of access
+   * @param addr start address
+   * @param len number of bytes watched
+   * @retval true if the watchpoint was removed
+   */
+  virtual bool removeWatchpoint(WatchType type, unsigned addr,
+                                std::size_t len) {
+    return false;
+  }
+
+  /**
+   * @brief getWatchpointHit Report whether the last stall was caused by a
+   * watchpoint. Called while stalled; the hit should be forgotten when the
+   * target is next resumed.
+   * @param type output: kind of watchpoint hit
+   * @param addr output: data address accessed
+   * @retval true if a watchpoint caused the stall
+   */
+  virtual bool getWatchpointHit(WatchType *type, unsigned *addr) {
+    return false;
+  }
+
   // ------ Register access ------
   /**
    * @brief writeReg Read the contents of a general purpose register.
@@ -92,12 +149,42 @@ class SimulationControlInterface {
    */
   virtual void writeReg(std::size_t num, uint32_t value) = 0;
 
+  /**
+   * @brief readRegs Read a contiguous range of general purpose registers in a
+   * single transaction. Optional: the default implementation calls readReg()
+   * for each register. Override it if each simulator access is expensive.
+   * @param out output buffer, at least count entries
+   * @param first number of the first register to read
+   * @param count number of registers to read
+   */
+  virtual void readRegs(uint32_t *out, std::size_t first, std::size_t count) {
+    for (std::size_t i = 0; i < count; i++) {
+      out[i] = readReg(first + i);
+    }
+  }
+
+  /**
+   * @brief writeRegs Write a contiguous range of general purpose registers in
+   * a single transaction. Optional: the default implementation calls
+   * writeReg() for each register.
+   * @param src values to write, at least count entries
+   * @param first number of the first register to write
+   * @param count number of registers to write
+   */
+  virtual void writeRegs(const uint32_t *src, std::size_t first,
+                         std::size_t count) {
+    for (std::size_t i = 0; i < count; i++) {
+      writeReg(first + i, src[i]);
+    }
+  }
+
   // ------ Memory access ------
   /**
    * @brief readMem read memory from target.
    * @param out output buffer
    * @param addr start address to read from
    * @param len number of bytes to read.
+   * @retval bool true if success, false otherwise.
    */
   virtual bool readMem(uint8_t *out, unsigned addr, std::size_t len) = 0;
 
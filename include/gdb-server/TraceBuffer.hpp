@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2019-2020, University of Southampton and Contributors.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+/**
+ * @brief TraceBuffer Store of tracepoint frames, each holding the registers
+ * and memory collected at one tracepoint hit.
+ *
+ * Frames are kept back to back in a ring of bytes allocated up front, so
+ * collecting a frame never allocates. When the ring is full, either the
+ * oldest frames are dropped (circular) or new frames are refused. Frames are
+ * numbered from 0 for the oldest one still held, as GDB expects.
+ *
+ * A frame is built with startFrame(), addRegisters() and addMemory(), then
+ * stored with commitFrame().
+ */
+class TraceBuffer {
+ public:
+  //! Default size of the ring in bytes
+  static const std::size_t DEFAULT_SIZE = 1 << 20;
+
+  //! Largest size a client may ask for (QTBuffer:size) in bytes
+  static const std::size_t MAX_SIZE = 64 << 20;
+
+  /**
+   * @brief Constructor
+   * @param size Size of the ring in bytes
+   */
+  TraceBuffer(std::size_t size = DEFAULT_SIZE);
+
+  /**
+   * @brief clear Drop every frame and reset the counts.
+   */
+  void clear();
+
+  /**
+   * @brief resize Change the size of the ring, dropping every frame.
+   * @param size Size in bytes
+   * @retval true on success, false if the memory could not be allocated, in
+   * which case the ring is left empty (size 0)
+   */
+  bool resize(std::size_t size);
+
+  /**
+   * @brief setCircular Choose what happens when the ring is full.
+   * @param circular true to drop the oldest frames, false to refuse new ones
+   */
+  void setCircular(bool circular) { this->circular = circular; }
+  bool isCircular() const { return circular; }
+
+  // Building a frame
+  /**
+   * @brief startFrame Start building a frame, dropping any unfinished one.
+   * @param tpNum Number of the tracepoint that was hit
+   * @param pc Address of the tracepoint
+   */
+  void startFrame(uint32_t tpNum, uint32_t pc);
+
+  /**
+   * @brief addRegisters Add the register file to the frame being built.
+   * @param regs Register values
+   * @param count Number of registers
+   */
+  void addRegisters(const uint32_t *regs, std::size_t count);
+
+  /**
+   * @brief addMemory Add a block of memory to the frame being built.
+   * @param addr Address of the block
+   * @param data Contents of the block
+   * @param len Length in bytes
+   */
+  void addMemory(uint32_t addr, const uint8_t *data, std::size_t len);
+
+  /**
+   * @brief commitFrame Store the frame being built.
+   * @retval true if stored, false if it did not fit (the ring is full and not
+   * circular, or the frame is larger than the ring).
+   */
+  bool commitFrame();
+
+  // Browsing frames
+  /**
+   * @brief frameCount Number of frames held.
+   */
+  std::size_t frameCount() const { return frames.size(); }
+
+  /**
+   * @brief framesCreated Number of frames stored since the last clear(),
+   * including any since dropped.
+   */
+  std::size_t framesCreated() const { return created; }
+
+  /**
+   * @brief size Size of the ring in bytes.
+   */
+  std::size_t size() const { return ring.size(); }
+
+  /**
+   * @brief bytesFree Space left before frames are dropped or refused.
+   */
+  std::size_t bytesFree() const;
+
+  /**
+   * @brief frameTracepoint Tracepoint number of a frame.
+   * @param n Frame number (less than frameCount())
+   */
+  uint32_t frameTracepoint(std::size_t n) const { return frames[n].tpNum; }
+
+  /**
+   * @brief framePc Tracepoint address of a frame.
+   * @param n Frame number (less than frameCount())
+   */
+  uint32_t framePc(std::size_t n) const { return frames[n].pc; }
+
+  /**
+   * @brief readRegister Get a register collected in a frame.
+   * @param n Frame number (less than frameCount())
+   * @param regNum Register number
+   * @param value output: register value
+   * @retval true if the register was collected
+   */
+  bool readRegister(std::size_t n, std::size_t regNum, uint32_t *value) const;
+
+  /**
+   * @brief readMemory Get memory collected in a frame.
+   * @param n Frame number (less than frameCount())
+   * @param addr Start address
+   * @param out output buffer
+   * @param len Number of bytes wanted
+   * @retval Number of bytes from addr onwards that were collected (at most
+   * len). Only those bytes of out are written.
+   */
+  std::size_t readMemory(std::size_t n, uint32_t addr, uint8_t *out,
+                         std::size_t len) const;
+
+ private:
+  //! Kinds of block in a frame
+  enum BlockType : uint8_t { BLOCK_REGS = 'R', BLOCK_MEM = 'M' };
+
+  //! Where a frame is held in the ring
+  struct Frame {
+    std::size_t offset;
+    std::size_t len;
+    uint32_t tpNum;
+    uint32_t pc;
+  };
+
+  std::vector<uint8_t> ring;
+  std::deque<Frame> frames;  //!< Oldest first
+  std::size_t tail;          //!< Where the next frame goes
+  std::size_t created;
+  bool circular;
+
+  //! Frame being built. Reserved at the size of the ring, so it can hold any
+  //! frame that could be stored.
+  std::vector<uint8_t> pending;
+  uint32_t pendingTp;
+  uint32_t pendingPc;
+  bool pendingOverflow;  //!< Too big for the ring
+
+  bool reserve(std::size_t len);
+};
@@ -26,6 +26,7 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <cstddef>
 #include <cstdint>
 #include <string>
 
@@ -44,6 +45,21 @@ class Utils {
   static void hex2Ascii(char *dest, char *src);
   static int rspUnescape(char *buf, int len);
 
+  // Bulk hex conversion kernels
+  static void bytesToHex(const uint8_t *src, size_t len, char *dest);
+  static bool hexToBytes(const char *src, size_t len, uint8_t *dest);
+
+  //! Implementations of the bulk hex kernels. The best one supported by the
+  //! host CPU is chosen at runtime.
+  enum HexImpl { HEX_IMPL_SCALAR, HEX_IMPL_SSE2, HEX_IMPL_AVX2 };
+
+  static HexImpl getHexImpl();
+  static bool setHexImpl(HexImpl impl);
+
+  // CRC-32 as used by GDB's qCRC packet
+  static uint32_t crc32(const uint8_t *buf, size_t len,
+                        uint32_t crc = 0xffffffff);
+
  private:
   // Private constructor cannot be instantiated
   Utils(){};
@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2019-2020, University of Southampton and Contributors.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <gdb-server/SimulationControlInterface.hpp>
+#include <vector>
+
+/**
+ * @brief WatchRangeIndex Set of watched address ranges, for simulators that
+ * implement insertWatchpoint() and so must check every bus access against
+ * the watchpoints.
+ *
+ * check() is meant to be called on every access. With no watchpoints it is a
+ * single test, and otherwise an access to a page with nothing watched in it
+ * costs one table lookup per page touched. Only accesses that share a page
+ * with a watched range search the ranges, which are kept sorted by start
+ * address with the running maximum of their end addresses, so a search takes
+ * O(log n) plus the number of overlapping ranges.
+ */
+class WatchRangeIndex {
+ public:
+  typedef SimulationControlInterface::WatchType WatchType;
+
+  //! A watchpoint hit
+  struct Hit {
+    WatchType type;
+    uint32_t addr;  //!< First watched byte accessed
+  };
+
+  WatchRangeIndex();
+
+  /**
+   * @brief insert Watch [addr, addr + len). Inserting a watchpoint that is
+   * already there has no effect, as GDB may repeat Z packets.
+   * @param type kind of access to watch for
+   * @param addr start address
+   * @param len number of bytes (at least 1)
+   */
+  void insert(WatchType type, uint32_t addr, std::size_t len);
+
+  /**
+   * @brief remove Remove a range added by insert().
+   * @param type kind of access
+   * @param addr start address
+   * @param len number of bytes
+   * @retval true if the range was found and removed
+   */
+  bool remove(WatchType type, uint32_t addr, std::size_t len);
+
+  /**
+   * @brief clear Remove every range.
+   */
+  void clear();
+
+  /**
+   * @brief empty Check whether anything is watched.
+   */
+  bool empty() const { return ranges.empty(); }
+
+  /**
+   * @brief check Check an access against the watched ranges.
+   * @param addr start address of the access
+   * @param len number of bytes accessed
+   * @param isWrite true for a write, false for a read
+   * @param hit output: the watchpoint hit, if any (may be NULL)
+   * @retval true if the access hits a watchpoint
+   */
+  bool check(uint32_t addr, std::size_t len, bool isWrite, Hit *hit) const {
+    if (ranges.empty() || (0 == len)) {
+      return false;
+    }
+
+    uint64_t first = addr >> PAGE_BITS;
+    uint64_t last = ((uint64_t)addr + len - 1) >> PAGE_BITS;
+    if ((0 == wideRanges) && (last - first < FILTER_SIZE)) {
+      bool maybe = false;
+      for (uint64_t page = first; !maybe && (page <= last); page++) {
+        maybe = (0 != pageCount[page & (FILTER_SIZE - 1)]);
+      }
+      if (!maybe) {
+        return false;
+      }
+    }
+
+    return lookup(addr, len, isWrite, hit);
+  }
+
+ private:
+  //! Size of the pages tracked by the filter, as a power of two
+  static const int PAGE_BITS = 12;
+
+  //! Number of filter entries. Pages that are FILTER_SIZE apart share one.
+  static const uint64_t FILTER_SIZE = 1 << 16;
+
+  struct Range {
+    uint32_t start;
+    uint64_t end;  //!< One past the last byte
+    WatchType type;
+  };
+
+  //! Watched ranges, sorted by start address
+  std::vector<Range> ranges;
+
+  //! maxEnd[i] is the largest end of ranges[0] to ranges[i]
+  std::vector<uint64_t> maxEnd;
+
+  //! Number of ranges touching the pages that map to each filter entry
+  std::vector<uint16_t> pageCount;
+
+  //! Number of ranges too big to track in the filter. While there are any,
+  //! every access is searched.
+  std::size_t wideRanges;
+
+  static bool startsBefore(const Range &r, uint64_t addr);
+  bool lookup(uint32_t addr, std::size_t len, bool isWrite, Hit *hit) const;
+  void updateFilter(const Range &r, int delta);
+  void rebuildMaxEnd();
+};
@@ -0,0 +1,498 @@
+/*
+ * Copyright (c) 2019-2020, University of Southampton and Contributors.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <cstring>
+#include <gdb-server/AgentExpr.hpp>
+#include <gdb-server/Utils.hpp>
+
+const int AgentExpr::MAX_STACK;
+const int AgentExpr::MAX_STEPS;
+
+AgentExpr::AgentExpr() {}
+
+bool AgentExpr::compile(const uint8_t *code, std::size_t len) {
+  std::vector<Insn> out;
+  std::vector<int> index(len, -1);  // Instruction starting at each byte
+  int argLen, pops, pushes;
+
+  prog.clear();
+
+  // Decode, with the (big-endian) operands unpacked
+  for (std::size_t pos = 0; pos < len; pos += 1 + argLen) {
+    if (!decodeOp(code[pos], &argLen, &pops, &pushes) ||
+        (pos + 1 + argLen > len)) {
+      return false;
+    }
+
+    Insn insn;
+    insn.op = code[pos];
+    insn.arg = 0;
+    for (int i = 0; i < argLen; i++) {
+      insn.arg = (insn.arg << 8) | code[pos + 1 + i];
+    }
+    index[pos] = out.size();
+    out.push_back(insn);
+  }
+
+  if (out.empty()) {
+    return false;
+  }
+
+  // Jumps go to an instruction index rather than a byte offset
+  for (std::size_t i = 0; i < out.size(); i++) {
+    if ((OP_GOTO == out[i].op) || (OP_IF_GOTO == out[i].op)) {
+      if ((out[i].arg >= len) || (index[out[i].arg] < 0)) {
+        return false;
+      }
+      out[i].arg = index[out[i].arg];
+    }
+  }
+
+  // Work out the stack depth before each instruction, following every path.
+  // It must be the same whichever way an instruction is reached, never
+  // underflow or exceed MAX_STACK, and every path must finish with end.
+  // Conditions leave their value on the stack, but collections need not.
+  std::vector<int> depth(out.size(), -1);
+  std::vector<std::size_t> work(1, 0);
+  depth[0] = 0;
+
+  while (!work.empty()) {
+    std::size_t i = work.back();
+    const Insn &insn = out[i];
+    int d = depth[i];
+    work.pop_back();
+
+    decodeOp(insn.op, &argLen, &pops, &pushes);
+    if ((d < pops) || ((OP_PICK == insn.op) && ((int)insn.arg >= d))) {
+      return false;
+    }
+    if (((OP_EXT == insn.op) || (OP_ZERO_EXT == insn.op)) &&
+        ((0 == insn.arg) || (insn.arg > 64))) {
+      return false;
+    }
+    if (OP_END == insn.op) {
+      continue;
+    }
+
+    d += pushes - pops;
+    if (d > MAX_STACK) {
+      return false;
+    }
+
+    std::size_t next[2];
+    int nNext = 0;
+    if (OP_GOTO != insn.op) {
+      next[nNext++] = i + 1;
+    }
+    if ((OP_GOTO == insn.op) || (OP_IF_GOTO == insn.op)) {
+      next[nNext++] = insn.arg;
+    }
+
+    for (int n = 0; n < nNext; n++) {
+      if (next[n] >= out.size()) {
+        return false;  // Ran off the end
+      }
+      if (depth[next[n]] < 0) {
+        depth[next[n]] = d;
+        work.push_back(next[n]);
+      } else if (depth[next[n]] != d) {
+        return false;
+      }
+    }
+  }
+
+  prog.swap(out);
+  return true;
+}
+
+bool AgentExpr::compileHex(const char *hex, std::size_t len) {
+  std::vector<uint8_t> code(len);
+
+  for (std::size_t i = 0; i < len; i++) {
+    uint8_t hi = Utils::char2Hex(hex[2 * i]);
+    uint8_t lo = (hi > 0xf) ? 0xff : Utils::char2Hex(hex[2 * i + 1]);
+    if (lo > 0xf) {
+      prog.clear();
+      return false;
+    }
+    code[i] = (hi << 4) | lo;
+  }
+
+  return compile(code.data(), len);
+}
+
+bool AgentExpr::evaluate(SimulationControlInterface *simCtrl, uint64_t *value,
+                         std::vector<Block> *collect) const {
+  uint64_t stack[MAX_STACK];
+  int sp = 0;  // Number of entries: stack[sp - 1] is the top
+  std::size_t pc = 0;
+  uint64_t a, b;
+
+  if (prog.empty()) {
+    return false;
+  }
+
+  for (int steps = 0; steps < MAX_STEPS; steps++) {
+    const Insn &insn = prog[pc++];
+
+    switch (insn.op) {
+      case OP_ADD:
+        b = stack[--sp];
+        stack[sp - 1] += b;
+        break;
+
+      case OP_SUB:
+        b = stack[--sp];
+        stack[sp - 1] -= b;
+        break;
+
+      case OP_MUL:
+        b = stack[--sp];
+        stack[sp - 1] *= b;
+        break;
+
+      case OP_DIV_SIGNED:
+      case OP_REM_SIGNED:
+        b = stack[--sp];
+        a = stack[sp - 1];
+        if (0 == b) {
+          return false;
+        }
+        if ((int64_t)b == -1) {
+          // Avoid overflow dividing the most negative value
+          stack[sp - 1] = (OP_DIV_SIGNED == insn.op) ? 0 - a : 0;
+        } else if (OP_DIV_SIGNED == insn.op) {
+          stack[sp - 1] = (int64_t)a / (int64_t)b;
+        } else {
+          stack[sp - 1] = (int64_t)a % (int64_t)b;
+        }
+        break;
+
+      case OP_DIV_UNSIGNED:
+      case OP_REM_UNSIGNED:
+        b = stack[--sp];
+        if (0 == b) {
+          return false;
+        }
+        if (OP_DIV_UNSIGNED == insn.op) {
+          stack[sp - 1] /= b;
+        } else {
+          stack[sp - 1] %= b;
+        }
+        break;
+
+      case OP_LSH:
+        b = stack[--sp];
+        stack[sp - 1] = (b < 64) ? stack[sp - 1] << b : 0;
+        break;
+
+      case OP_RSH_SIGNED:
+        b = stack[--sp];
+        a = stack[sp - 1];
+        if (b > 63) {
+          b = 63;
+        }
+        stack[sp - 1] = ((int64_t)a < 0) ? ~(~a >> b) : a >> b;
+        break;
+
+      case OP_RSH_UNSIGNED:
+        b = stack[--sp];
+        stack[sp - 1] = (b < 64) ? stack[sp - 1] >> b : 0;
+        break;
+
+      case OP_TRACE:
+      case OP_TRACENZ:
+        // addr size => (tracenz collects the whole size, not up to a zero)
+        sp -= 2;
+        if (NULL != collect) {
+          Block blk = {stack[sp], stack[sp + 1]};
+          collect->push_back(blk);
+        }
+        break;
+
+      case OP_TRACE_QUICK:
+      case OP_TRACE16:
+        // addr => addr
+        if (NULL != collect) {
+          Block blk = {stack[sp - 1], insn.arg};
+          collect->push_back(blk);
+        }
+        break;
+
+      case OP_TRACEV:
+        break;  // No trace state variables
+
+      case OP_LOG_NOT:
+        stack[sp - 1] = (0 == stack[sp - 1]);
+        break;
+
+      case OP_BIT_AND:
+        b = stack[--sp];
+        stack[sp - 1] &= b;
+        break;
+
+      case OP_BIT_OR:
+        b = stack[--sp];
+        stack[sp - 1] |= b;
+        break;
+
+      case OP_BIT_XOR:
+        b = stack[--sp];
+        stack[sp - 1] ^= b;
+        break;
+
+      case OP_BIT_NOT:
+        stack[sp - 1] = ~stack[sp - 1];
+        break;
+
+      case OP_EQUAL:
+        b = stack[--sp];
+        stack[sp - 1] = (stack[sp - 1] == b);
+        break;
+
+      case OP_LESS_SIGNED:
+        b = stack[--sp];
+        stack[sp - 1] = ((int64_t)stack[sp - 1] < (int64_t)b);
+        break;
+
+      case OP_LESS_UNSIGNED:
+        b = stack[--sp];
+        stack[sp - 1] = (stack[sp - 1] < b);
+        break;
+
+      case OP_EXT:
+        if (insn.arg < 64) {
+          int shift = 64 - insn.arg;
+          a = stack[sp - 1] << shift;
+          stack[sp - 1] = (uint64_t)((int64_t)a >> shift);
+        }
+        break;
+
+      case OP_ZERO_EXT:
+        if (insn.arg < 64) {
+          stack[sp - 1] &= ((uint64_t)1 << insn.arg) - 1;
+        }
+        break;
+
+      case OP_REF8:
+      case OP_REF16:
+      case OP_REF32:
+      case OP_REF64:
+        if (!readTarget(simCtrl, stack[sp - 1], 1 << (insn.op - OP_REF8),
+                        &stack[sp - 1])) {
+          return false;
+        }
+        break;
+
+      case OP_IF_GOTO:
+        if (0 != stack[--sp]) {
+          pc = insn.arg;
+        }
+        break;
+
+      case OP_GOTO:
+        pc = insn.arg;
+        break;
+
+      case OP_CONST8:
+      case OP_CONST16:
+      case OP_CONST32:
+      case OP_CONST64:
+        stack[sp++] = insn.arg;
+        break;
+
+      case OP_REG:
+        if (insn.arg >= simCtrl->nRegs()) {
+          return false;
+        }
+        stack[sp++] = simCtrl->readReg(insn.arg);
+        break;
+
+      case OP_END:
+        *value = (sp > 0) ? stack[sp - 1] : 0;
+        return true;
+
+      case OP_DUP:
+        stack[sp] = stack[sp - 1];
+        sp++;
+        break;
+
+      case OP_POP:
+        sp--;
+        break;
+
+      case OP_SWAP:
+        b = stack[sp - 1];
+        stack[sp - 1] = stack[sp - 2];
+        stack[sp - 2] = b;
+        break;
+
+      case OP_PICK:
+        stack[sp] = stack[sp - 1 - insn.arg];
+        sp++;
+        break;
+
+      case OP_ROT:
+        // a b c => c a b
+        b = stack[sp - 1];
+        stack[sp - 1] = stack[sp - 2];
+        stack[sp - 2] = stack[sp - 3];
+        stack[sp - 3] = b;
+        break;
+
+      default:
+        return false;  // Rejected by compile ()
+    }
+  }
+
+  return false;  // Probably looping
+}
+
+//! Stack effect and operand size of each supported operation
+bool AgentExpr::decodeOp(uint8_t op, int *argLen, int *pops, int *pushes) {
+  *argLen = 0;
+  *pops = 0;
+  *pushes = 0;
+
+  switch (op) {
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV_SIGNED:
+    case OP_DIV_UNSIGNED:
+    case OP_REM_SIGNED:
+    case OP_REM_UNSIGNED:
+    case OP_LSH:
+    case OP_RSH_SIGNED:
+    case OP_RSH_UNSIGNED:
+    case OP_BIT_AND:
+    case OP_BIT_OR:
+    case OP_BIT_XOR:
+    case OP_EQUAL:
+    case OP_LESS_SIGNED:
+    case OP_LESS_UNSIGNED:
+      *pops = 2;
+      *pushes = 1;
+      return true;
+
+    case OP_LOG_NOT:
+    case OP_BIT_NOT:
+    case OP_REF8:
+    case OP_REF16:
+    case OP_REF32:
+    case OP_REF64:
+      *pops = 1;
+      *pushes = 1;
+      return true;
+
+    case OP_EXT:
+    case OP_ZERO_EXT:
+    case OP_TRACE_QUICK:
+      *argLen = 1;
+      *pops = 1;
+      *pushes = 1;
+      return true;
+
+    case OP_TRACE16:
+      *argLen = 2;
+      *pops = 1;
+      *pushes = 1;
+      return true;
+
+    case OP_TRACE:
+    case OP_TRACENZ:
+      *pops = 2;
+      return true;
+
+    case OP_TRACEV:
+    case OP_GOTO:
+      *argLen = 2;
+      return true;
+
+    case OP_IF_GOTO:
+      *argLen = 2;
+      *pops = 1;
+      return true;
+
+    case OP_CONST8:
+      *argLen = 1;
+      *pushes = 1;
+      return true;
+
+    case OP_CONST16:
+    case OP_REG:
+      *argLen = 2;
+      *pushes = 1;
+      return true;
+
+    case OP_CONST32:
+      *argLen = 4;
+      *pushes = 1;
+      return true;
+
+    case OP_CONST64:
+      *argLen = 8;
+      *pushes = 1;
+      return true;
+
+    case OP_END:
+      return true;
+
+    case OP_DUP:
+      *pops = 1;
+      *pushes = 2;
+      return true;
+
+    case OP_POP:
+      *pops = 1;
+      return true;
+
+    case OP_SWAP:
+      *pops = 2;
+      *pushes = 2;
+      return true;
+
+    case OP_PICK:
+      *argLen = 1;
+      *pushes = 1;
+      return true;
+
+    case OP_ROT:
+      *pops = 3;
+      *pushes = 3;
+      return true;
+
+    default:
+      return false;  // Floating point, trace state variables, printf
+  }
+}
+
+//! Read a value of 1, 2, 4 or 8 bytes from target memory, in target byte order
+bool AgentExpr::readTarget(SimulationControlInterface *simCtrl,
+                           uint64_t addr, int size, uint64_t *value) {
+  uint8_t buf[8];
+
+  if (addr + size - 1 > UINT32_MAX) {
+    return false;
+  }
+  if (!simCtrl->readMem(buf, addr, size)) {
+    return false;
+  }
+
+  // ttohl () is the identity when the target's byte order is the host's
+  uint32_t probe;
+  const uint8_t first[4] = {1, 0, 0, 0};
+  memcpy(&probe, first, sizeof(probe));
+  bool hostLittle = (1 == probe);
+  bool targetLittle = (hostLittle == (simCtrl->ttohl(probe) == probe));
+
+  *value = 0;
+  for (int i = 0; i < size; i++) {
+    *value = (*value << 8) | buf[targetLittle ? size - 1 - i : i];
+  }
+  return true;
+}
@@ -23,13 +23,17 @@
 
 // $Id: GdbServerSC.cpp 331 2009-03-12 17:01:48Z jeremy $
 
+#include <poll.h>
 #include <spdlog/spdlog.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 #include <chrono>
 #include <gdb-server/GdbServer.hpp>
 #include <gdb-server/SimulationControlInterface.hpp>
 #include <gdb-server/Utils.hpp>
 #include <iomanip>
 #include <iostream>
+#include <sstream>
 #include <thread>
 
 using std::cerr;
@@ -37,27 +41,180 @@ using std::dec;
 using std::endl;
 using std::hex;
 
-GdbServer::GdbServer(SimulationControlInterface *simCtrl, int rspPort)
-    : m_simCtrl(simCtrl) {
-  pkt = new RspPacket(RSP_PKT_MAX);
+const int GdbServer::RSP_PKT_DEFAULT;
+const int GdbServer::RSP_PKT_MIN;
+
+GdbServer::GdbServer(SimulationControlInterface *simCtrl, int rspPort,
+                     int pktSize)
+    : GdbServer(std::vector<SimulationControlInterface *>(1, simCtrl),
+                rspPort, pktSize) {}  // GdbServer ()
+
+GdbServer::GdbServer(const std::vector<SimulationControlInterface *> &simCtrls,
+                     int rspPort, int pktSize)
+    : pktSize(pktSize) {
+  if (simCtrls.empty()) {
+    cerr << "*** GdbServer needs at least one core: ABORTING" << endl;
+    exit(1);
+  }
+
+  if (this->pktSize < RSP_PKT_MIN) {
+    spdlog::warn("GdbServer: packet size {:d} too small, using {:d}.",
+                 this->pktSize, RSP_PKT_MIN);
+    this->pktSize = RSP_PKT_MIN;
+  }
+
+  // Allow for an EOS after the payload, so the buffer is a well formed string
+  pkt = new RspPacket(this->pktSize + 1);
+  notifyPkt = new RspPacket(64);
+  memBuf = new uint8_t[this->pktSize / 2];
   rsp = new RspConnection(rspPort);
+  stats = new RspStats();
+  rsp->setStats(stats);
+  for (size_t i = 0; i < simCtrls.size(); i++) {
+    Core core;
+    core.simCtrl = new TimedSimulationControl(simCtrls[i], stats);
+    core.memCache = new MemoryCache(core.simCtrl);
+    core.regCacheValid = false;
+    core.running = false;
+    core.stopSignal = TARGET_SIGNAL_TRAP;
+    core.stepping = false;
+    core.stepOver = false;
+    core.rangeStep = false;
+    core.rangeStart = 0;
+    core.rangeEnd = 0;
+    cores.push_back(core);
+  }
+  cCore = -1;
+  stopCore = 0;
+  lastSignal = TARGET_SIGNAL_TRAP;
+  nonStop = false;
+  selectCore(0);
+  wcAddr = 0;
+  wcLen = 0;
+  stallEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  stallNotify = false;
+  targetStopped = true;
+  traceBuf = new TraceBuffer(0);
+  traceBufSize = TraceBuffer::DEFAULT_SIZE;
+  tracing = false;
+  traceStopReason = "tnotrun:0";
+  traceFrame = -1;
+  profiler = new Profiler();
 }  // GdbServer ()
 
 GdbServer::~GdbServer() {
   delete rsp;
   delete pkt;
+  delete notifyPkt;
+  delete traceBuf;
+  delete profiler;
+  for (size_t i = 0; i < cores.size(); i++) {
+    delete cores[i].memCache;
+    delete cores[i].simCtrl;
+  }
+  delete stats;
+  delete[] memBuf;
+  if (stallEventFd >= 0) {
+    close(stallEventFd);
+  }
 
 }  // ~GdbServer
 
+//-----------------------------------------------------------------------------
+//! Choose whether packet checksums are verified once the client has switched
+//! to no-ack mode (QStartNoAckMode).
+
+//! @param[in] check  TRUE to verify checksums (the default)
+//-----------------------------------------------------------------------------
+void GdbServer::setNoAckChecksumCheck(bool check) {
+  rsp->setNoAckChecksumCheck(check);
+}  // setNoAckChecksumCheck ()
+
+//-----------------------------------------------------------------------------
+//! Record the packets of every session in a log
+
+//! To record the simulator calls too, wrap the simulators in
+//! RecordingSimulationControl.
+
+//! @param[in] recorder  An open log, or NULL to stop recording
+//-----------------------------------------------------------------------------
+void GdbServer::setRecorder(SessionRecorder *recorder) {
+  rsp->setRecorder(recorder);
+}  // setRecorder ()
+
+//-----------------------------------------------------------------------------
+//! Mark a memory region that must never be cached
+
+//! @param[in] addr  Start address of the region
+//! @param[in] len   Length of the region in bytes
+//-----------------------------------------------------------------------------
+void GdbServer::addUncacheableRegion(uint32_t addr, uint32_t len) {
+  for (size_t i = 0; i < cores.size(); i++) {
+    cores[i].memCache->addUncacheable(addr, len);
+  }
+}  // addUncacheableRegion ()
+
+//-----------------------------------------------------------------------------
+//! Enable or disable the target memory cache
+
+//! @param[in] enabled  TRUE to cache memory while the target is stopped
+//-----------------------------------------------------------------------------
+void GdbServer::setMemCacheEnabled(bool enabled) {
+  for (size_t i = 0; i < cores.size(); i++) {
+    cores[i].memCache->setEnabled(enabled);
+  }
+}  // setMemCacheEnabled ()
+
+//-----------------------------------------------------------------------------
+//! Declare a RAM region in the memory map
+
+//! @param[in] start  Start address of the region
+//! @param[in] len    Length of the region in bytes
+//-----------------------------------------------------------------------------
+void GdbServer::addRamRegion(uint32_t start, uint32_t len) {
+  MemoryRegion r = {false, start, len, 0};
+  memoryRegions.push_back(r);
+}  // addRamRegion ()
+
+//-----------------------------------------------------------------------------
+//! Declare a flash region in the memory map
+
+//! @param[in] start      Start address of the region
+//! @param[in] len        Length of the region in bytes
+//! @param[in] blockSize  Erase block size in bytes
+//-----------------------------------------------------------------------------
+void GdbServer::addFlashRegion(uint32_t start, uint32_t len,
+                               uint32_t blockSize) {
+  if (0 == blockSize) {
+    spdlog::warn("GdbServer: flash region at 0x{:08x} has no block size, "
+                 "using its length.",
+                 start);
+    blockSize = len;
+  }
+  MemoryRegion r = {true, start, len, blockSize};
+  memoryRegions.push_back(r);
+}  // addFlashRegion ()
+
+//-----------------------------------------------------------------------------
+//! Enable or disable write combining
+
+//! @param[in] size  Staging buffer size in bytes, 0 to disable
+//-----------------------------------------------------------------------------
+void GdbServer::setWriteCombining(std::size_t size) {
+  flushWriteCombine();
+  wcBuf.resize(size);
+}  // setWriteCombining ()
+
 //-----------------------------------------------------------------------------
 //! Thread to listen for RSP requests and control target
 //-----------------------------------------------------------------------------
 void GdbServer::serverThread() {
-  m_simCtrl->setServerRunning(true);
+  serverStart();
+
   // Loop processing commands forever
-  while (!m_simCtrl->shouldStopServer()) {
+  while (!shouldStopServer()) {
     // Make sure we are still connected.
-    while (!rsp->isConnected() && !m_simCtrl->shouldStopServer()) {
+    while (!rsp->isConnected() && !shouldStopServer()) {
       // Reconnect and stall the processor on a new connection
       if (!rsp->rspConnect()) {
         // Serious failure. Must abort execution.
@@ -65,33 +222,536 @@ void GdbServer::serverThread() {
         exit(1);
       }
 
-      // Stall the processor until we get a command to handle.
-      if (!m_simCtrl->isStalled()) {
-        m_simCtrl->stall();
+      if (rsp->isConnected()) {
+        clientConnected();
       }
-
-      targetStopped = true;  // Processor now not running
     }
 
-    while (!targetStopped && !m_simCtrl->shouldStopServer()) {
-      if (m_simCtrl->isStalled()) {
-        targetStopped = true;
-
-        // Tell the client we've stopped.
-        rspReportException();
+    // While the target runs, watch both it and the client
+    while (!targetStopped && rsp->isConnected() && !shouldStopServer()) {
+      if (!pollTarget() && waitForEvent()) {
+        rspPollClient();
       }
-      // Wait while target is running
-      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      sampleProfile();
     }
 
     // Get a RSP client request
-    if (!m_simCtrl->shouldStopServer()) {
+    if (rsp->isConnected() && !shouldStopServer()) {
       rspClientRequest();
     }
   }
-  m_simCtrl->setServerRunning(false);
+
+  serverStop();
 }  // rspServer ()
 
+//-----------------------------------------------------------------------------
+//! Get the simulators ready to be served
+
+//! Shared by serverThread () and GdbServerPool.
+//-----------------------------------------------------------------------------
+void GdbServer::serverStart() {
+  for (size_t i = 0; i < cores.size(); i++) {
+    cores[i].simCtrl->setServerRunning(true);
+  }
+
+  // Ask to be told when the target stalls, rather than polling for it. We
+  // can only block on the eventfd if every core will signal it.
+  stallNotify = false;
+  if (stallEventFd >= 0) {
+    int fd = stallEventFd;
+    std::function<void()> cb = [fd]() {
+      uint64_t one = 1;
+      if (write(fd, &one, sizeof(one)) < 0) {
+        // Counter saturated: a wakeup is pending anyway
+      }
+    };
+    stallNotify = true;
+    for (size_t i = 0; i < cores.size(); i++) {
+      stallNotify = cores[i].simCtrl->setStallCallback(cb) && stallNotify;
+    }
+  }
+
+  targetStopped = true;
+
+}  // serverStart ()
+
+//-----------------------------------------------------------------------------
+//! Stop serving the simulators, dropping any client
+//-----------------------------------------------------------------------------
+void GdbServer::serverStop() {
+  for (size_t i = 0; i < cores.size(); i++) {
+    cores[i].simCtrl->setStallCallback(std::function<void()>());
+  }
+  stallNotify = false;
+  flushWriteCombine();
+  rsp->rspClose();
+  rsp->rspUnlisten();
+  for (size_t i = 0; i < cores.size(); i++) {
+    cores[i].simCtrl->setServerRunning(false);
+  }
+
+}  // serverStop ()
+
+//-----------------------------------------------------------------------------
+//! Set up for a newly connected client
+
+//! Stall the processor until we get a command to handle.
+//-----------------------------------------------------------------------------
+void GdbServer::clientConnected() {
+  stallAllCores();
+  nonStop = false;
+  stopQueue.clear();
+  traceFrame = -1;
+
+  targetStopped = true;  // Processor now not running
+  invalidateCaches();
+  for (size_t i = 0; i < cores.size(); i++) {
+    cores[i].memCache->resetStats();
+  }
+
+}  // clientConnected ()
+
+//-----------------------------------------------------------------------------
+//! Check whether the running target has stopped, and if so tell the client
+
+//! @return  TRUE if the target (in non-stop mode, any core) stopped and the
+//!          stop was reported
+//-----------------------------------------------------------------------------
+bool GdbServer::pollTarget() {
+  if (nonStop) {
+    return pollTargetNonStop();
+  }
+
+  int core = findStoppedCore();
+  if (core < 0) {
+    return false;
+  }
+
+  // All-stop: when one core stops, they all do. The stopping core becomes
+  // the current thread.
+  stallAllCores();
+  stopCore = core;
+  lastSignal = cores[core].stopSignal;
+  selectCore(core);
+  targetStopped = true;
+
+  // Tell the client we've stopped.
+  rspReportException();
+  return true;
+
+}  // pollTarget ()
+
+//-----------------------------------------------------------------------------
+//! Check for cores that have stopped, in non-stop mode
+
+//! Each core that stops is queued to be reported. If the client is not
+//! already working through the queue, it is told with a %Stop notification.
+
+//! @return  TRUE if any core stopped
+//-----------------------------------------------------------------------------
+bool GdbServer::pollTargetNonStop() {
+  bool stopped = false;
+  bool anyRunning = false;
+
+  for (size_t i = 0; i < cores.size(); i++) {
+    if (!cores[i].running) {
+      continue;
+    }
+    if (!cores[i].simCtrl->isStalled() || continueRangeStep(i) ||
+        continuePastBreakpoint(i)) {
+      anyRunning = true;
+      continue;
+    }
+
+    cores[i].running = false;
+    stopped = true;
+
+    StopEvent ev = {(int)i, cores[i].stopSignal};
+    stopQueue.push_back(ev);
+    if (1 == stopQueue.size()) {
+      int len = sprintf(notifyPkt->data, "Stop:");
+      len += packStopReply(&(notifyPkt->data[len]), ev.core, ev.signal);
+      notifyPkt->setLen(len);
+      rsp->putNotification(notifyPkt);
+    }
+  }
+
+  targetStopped = !anyRunning;
+  return stopped;
+
+}  // pollTargetNonStop ()
+
+//-----------------------------------------------------------------------------
+//! Deal with input from the client while the target is running
+
+//! In all-stop mode the only thing GDB sends is an interrupt. In non-stop
+//! mode requests are handled as usual.
+//-----------------------------------------------------------------------------
+void GdbServer::rspPollClient() {
+  int res = rsp->pollBreak();
+
+  if (res < 0) {
+    rspDisconnect();  // Comms failure
+    return;
+  }
+  if (res > 0) {
+    rspInterrupt();
+  }
+  if (nonStop && rsp->rxPending()) {
+    rspClientRequest();
+  }
+
+}  // rspPollClient ()
+
+//-----------------------------------------------------------------------------
+//! Handle an interrupt (Ctrl-C) from the client
+
+//! Stall every running core. The stop is reported (with SIGINT) once the
+//! cores are seen to have stalled.
+//-----------------------------------------------------------------------------
+void GdbServer::rspInterrupt() {
+  for (size_t i = 0; i < cores.size(); i++) {
+    if (cores[i].running) {
+      cores[i].stopSignal = TARGET_SIGNAL_INT;
+      cores[i].simCtrl->stall();
+    }
+  }
+
+}  // rspInterrupt ()
+
+//-----------------------------------------------------------------------------
+//! Make a core the current (Hg) thread
+
+//! Register and memory requests are routed to this core.
+
+//! @param[in] core  Index of the core
+//-----------------------------------------------------------------------------
+void GdbServer::selectCore(int core) {
+  gCore = core;
+  m_simCtrl = cores[core].simCtrl;
+  memCache = cores[core].memCache;
+
+}  // selectCore ()
+
+//-----------------------------------------------------------------------------
+//! Parse a GDB thread ID
+
+//! Thread IDs are hex, with core i as thread i + 1. 0 ("any thread") and -1
+//! ("all threads") are both returned as -1.
+
+//! @param[in] str  The thread ID, terminated by EOS
+//! @return  The index of the core, -1 for any/all, or -2 if not valid
+//-----------------------------------------------------------------------------
+int GdbServer::parseThreadId(const char *str) {
+  if (0 == strcmp("-1", str)) {
+    return -1;
+  }
+
+  char *end;
+  unsigned long tid = strtoul(str, &end, 16);
+  if ((end == str) || ('\0' != *end) || (tid > cores.size())) {
+    return -2;
+  }
+
+  return (0 == tid) ? -1 : (int)tid - 1;
+
+}  // parseThreadId ()
+
+//-----------------------------------------------------------------------------
+//! Let the target run
+
+//! Step runs just the Hc thread (or the Hg thread if Hc selects all threads).
+//! Continue runs the Hc thread, or every core.
+
+//! @param[in] step  TRUE to single step, FALSE to continue
+//-----------------------------------------------------------------------------
+void GdbServer::resumeCores(bool step) {
+  if (step) {
+    resumeCore((cCore >= 0) ? cCore : gCore, true);
+  } else {
+    for (size_t i = 0; i < cores.size(); i++) {
+      if ((cCore < 0) || (cCore == (int)i)) {
+        resumeCore(i, false);
+      }
+    }
+  }
+
+  targetStopped = false;
+
+}  // resumeCores ()
+
+//-----------------------------------------------------------------------------
+//! Let one core run, unless it is already running
+
+//! Cached memory may be changed by the core, so is dropped for all cores.
+
+//! @param[in] core  Index of the core
+//! @param[in] step  TRUE to single step, FALSE to continue
+//-----------------------------------------------------------------------------
+void GdbServer::resumeCore(int core, bool step) {
+  if (cores[core].running) {
+    return;
+  }
+
+  invalidateCaches();
+  cores[core].running = true;
+  cores[core].stopSignal = TARGET_SIGNAL_TRAP;
+  cores[core].stepping = step;
+  cores[core].stepOver = false;
+  cores[core].rangeStep = false;
+  if (step) {
+    cores[core].simCtrl->step();
+  } else {
+    cores[core].simCtrl->unstall();
+  }
+
+}  // resumeCore ()
+
+//-----------------------------------------------------------------------------
+//! Find a core that has stopped since it was resumed
+
+//! @return  The index of the core, or -1 if all resumed cores are still
+//!          running. If no core was resumed, the last stop is reported again.
+//-----------------------------------------------------------------------------
+int GdbServer::findStoppedCore() {
+  bool anyRunning = false;
+
+  for (size_t i = 0; i < cores.size(); i++) {
+    if (cores[i].running) {
+      if (cores[i].simCtrl->isStalled() && !continueRangeStep(i) &&
+          !continuePastBreakpoint(i)) {
+        return i;
+      }
+      anyRunning = true;
+    }
+  }
+
+  return anyRunning ? -1 : stopCore;
+
+}  // findStoppedCore ()
+
+//-----------------------------------------------------------------------------
+//! Carry on range stepping a core that has stalled after a step
+
+//! The core is stepped again for as long as it stays in its range, without
+//! a round trip to the client for each instruction. It stops stepping at a
+//! breakpoint or watchpoint hit, or if it was stalled for another reason
+//! (e.g. an interrupt).
+//! If the simulator stalls as soon as step () returns, up to STEP_BATCH steps
+//! are taken before returning, so the client is
+//! still heard from in a tight loop.
+
+//! @param[in] core  The stalled core
+//! @return  TRUE if the core is still stepping, FALSE if its stop should be
+//!          reported
+//-----------------------------------------------------------------------------
+bool GdbServer::continueRangeStep(int core) {
+  Core &c = cores[core];
+
+  if (!c.rangeStep || (TARGET_SIGNAL_TRAP != c.stopSignal)) {
+    c.rangeStep = false;
+    return false;
+  }
+
+  SimulationControlInterface *simCtrl = c.simCtrl;
+  SimulationControlInterface::WatchType type;
+  unsigned addr;
+  for (int n = 0; n < STEP_BATCH; n++) {
+    uint32_t pc = simCtrl->readReg(simCtrl->pcRegNum());
+    if ((pc < c.rangeStart) || (pc >= c.rangeEnd) ||
+        (breakpoints.count(pc) > 0) ||
+        simCtrl->getWatchpointHit(&type, &addr)) {
+      c.rangeStep = false;
+      return false;
+    }
+
+    simCtrl->step();
+    if (!simCtrl->isStalled()) {
+      return true;  // Seen again when it stalls
+    }
+  }
+
+  return true;
+
+}  // continueRangeStep ()
+
+//-----------------------------------------------------------------------------
+//! Carry on past a breakpoint whose condition is false, or a tracepoint
+
+//! A core that was continued and has stalled at a breakpoint with conditions
+//! is resumed without telling the client, unless one of the conditions holds.
+//! At a tracepoint, a trace frame is collected, and the core is resumed
+//! unless there is also a breakpoint to report there. To get off the
+//! breakpoint, the core is first stepped and then continued.
+//! As with range stepping, if the simulator stalls as soon as it is resumed,
+//! up to STEP_BATCH breakpoints are passed before returning.
+
+//! @param[in] core  The stalled core
+//! @return  TRUE if the core has been resumed, FALSE if its stop should be
+//!          reported
+//-----------------------------------------------------------------------------
+bool GdbServer::continuePastBreakpoint(int core) {
+  Core &c = cores[core];
+
+  if (c.stepping || (TARGET_SIGNAL_TRAP != c.stopSignal)) {
+    c.stepOver = false;
+    return false;
+  }
+
+  SimulationControlInterface *simCtrl = c.simCtrl;
+  SimulationControlInterface::WatchType type;
+  unsigned addr;
+  for (int n = 0; n < STEP_BATCH; n++) {
+    if (simCtrl->getWatchpointHit(&type, &addr)) {
+      c.stepOver = false;
+      return false;
+    }
+
+    if (c.stepOver) {
+      // Off the breakpoint, so carry on as the client asked
+      c.stepOver = false;
+      simCtrl->unstall();
+    } else {
+      uint32_t pc = simCtrl->readReg(simCtrl->pcRegNum());
+      bool traced = tracing && collectTraceFrame(core, pc);
+      std::map<uint32_t, std::vector<AgentExpr>>::iterator it =
+          breakpoints.find(pc);
+      if ((breakpoints.end() == it) ? !traced
+                                    : conditionTrue(core, it->second)) {
+        return false;
+      }
+
+      c.stepOver = true;
+      simCtrl->step();
+    }
+
+    if (!simCtrl->isStalled()) {
+      return true;  // Seen again when it stalls
+    }
+  }
+
+  return true;
+
+}  // continuePastBreakpoint ()
+
+//-----------------------------------------------------------------------------
+//! Evaluate the conditions of a breakpoint
+
+//! @param[in] core   The core at the breakpoint
+//! @param[in] conds  The breakpoint's conditions
+//! @return  TRUE if the hit should be reported: there are no conditions, any
+//!          condition is non-zero, or a condition could not be evaluated
+//-----------------------------------------------------------------------------
+bool GdbServer::conditionTrue(int core,
+                              const std::vector<AgentExpr> &conds) {
+  if (conds.empty()) {
+    return true;
+  }
+
+  for (size_t i = 0; i < conds.size(); i++) {
+    uint64_t value;
+    if (!conds[i].evaluate(cores[core].simCtrl, &value) || (0 != value)) {
+      return true;
+    }
+  }
+
+  return false;
+
+}  // conditionTrue ()
+
+//-----------------------------------------------------------------------------
+//! Stall every core that is not already stalled
+//-----------------------------------------------------------------------------
+void GdbServer::stallAllCores() {
+  for (size_t i = 0; i < cores.size(); i++) {
+    if (!cores[i].simCtrl->isStalled()) {
+      cores[i].simCtrl->stall();
+    }
+    cores[i].running = false;
+  }
+
+}  // stallAllCores ()
+
+//-----------------------------------------------------------------------------
+//! Should the server stop? It should if any core says so.
+//-----------------------------------------------------------------------------
+bool GdbServer::shouldStopServer() {
+  for (size_t i = 0; i < cores.size(); i++) {
+    if (cores[i].simCtrl->shouldStopServer()) {
+      return true;
+    }
+  }
+  return false;
+
+}  // shouldStopServer ()
+
+//-----------------------------------------------------------------------------
+//! Wait for the running target to stall, or for the client to send something
+
+//! Blocks on the client socket and, if the simulator notifies us of stalls,
+//! the eventfd its callback signals (with a timeout, so we notice a request
+//! to stop the server). Otherwise only waits 1 ms before the caller polls
+//! isStalled () again. May return before either has happened.
+
+//! @return  TRUE if there is input from the client to deal with
+//-----------------------------------------------------------------------------
+bool GdbServer::waitForEvent() {
+  if (rsp->rxPending()) {
+    return true;
+  }
+
+  struct pollfd pfd[2];
+  int nfds = 0;
+
+  pfd[nfds].fd = rsp->getClientFd();
+  pfd[nfds].events = POLLIN;
+  pfd[nfds].revents = 0;
+  nfds++;
+
+  if (stallNotify) {
+    pfd[nfds].fd = stallEventFd;
+    pfd[nfds].events = POLLIN;
+    pfd[nfds].revents = 0;
+    nfds++;
+  }
+
+  int timeout = stallNotify ? STALL_WAIT_TIMEOUT : 1;
+  if (profiler->isRunning()) {
+    timeout = std::min(timeout, profiler->msUntilSample());
+  }
+
+  if (poll(pfd, nfds, timeout) <= 0) {
+    return false;
+  }
+
+  if (stallNotify && (0 != pfd[1].revents)) {
+    uint64_t count;
+    if (read(stallEventFd, &count, sizeof(count)) < 0) {
+      // Nothing pending (EAGAIN): just recheck isStalled ()
+    }
+  }
+
+  return 0 != pfd[0].revents;
+
+}  // waitForEvent ()
+
+//-----------------------------------------------------------------------------
+//! Sample the PC of each running core, if the profiler is due a sample
+//-----------------------------------------------------------------------------
+void GdbServer::sampleProfile() {
+  if (!profiler->sampleDue()) {
+    return;
+  }
+
+  for (size_t i = 0; i < cores.size(); i++) {
+    if (cores[i].running) {
+      SimulationControlInterface *simCtrl = cores[i].simCtrl;
+      profiler->addSample(simCtrl->readReg(simCtrl->pcRegNum()));
+    }
+  }
+
+}  // sampleProfile ()
+
 //-----------------------------------------------------------------------------
 //! Deal with a request from the GDB client session
 
@@ -109,10 +769,51 @@ void GdbServer::serverThread() {
 //! @param[in] pkt  The received RSP packet
 //-----------------------------------------------------------------------------
 void GdbServer::rspClientRequest() {
+  uint64_t start = RspStats::now();
   if (!rsp->getPkt(pkt)) {
-    rsp->rspClose();  // Comms failure
+    rspDisconnect();  // Comms failure
     return;
   }
+  stats->clientWait(RspStats::now() - start);
+
+  rspDispatch();
+
+}  // rspClientRequest ()
+
+//-----------------------------------------------------------------------------
+//! Drop the client after a communications failure
+//-----------------------------------------------------------------------------
+void GdbServer::rspDisconnect() {
+  flushWriteCombine();
+  rsp->rspClose();
+  for (size_t i = 0; i < cores.size(); i++) {
+    spdlog::info("GdbServer: core {:d} memory cache hits {:d}, misses {:d}, "
+                 "bypassed {:d}.",
+                 i, cores[i].memCache->getHits(),
+                 cores[i].memCache->getMisses(),
+                 cores[i].memCache->getBypasses());
+  }
+
+}  // rspDisconnect ()
+
+//-----------------------------------------------------------------------------
+//! Handle the request just received in pkt, counting it in the statistics
+//-----------------------------------------------------------------------------
+void GdbServer::rspDispatch() {
+  RspStats::Request req = stats->begin(pkt->data, pkt->getLen());
+  rspHandleRequest();
+  stats->end(req);
+
+}  // rspDispatch ()
+
+//-----------------------------------------------------------------------------
+//! Handle the request in pkt
+//-----------------------------------------------------------------------------
+void GdbServer::rspHandleRequest() {
+  // Only memory writes may be combined. Everything else must see them done.
+  if (('M' != pkt->data[0]) && ('X' != pkt->data[0])) {
+    flushWriteCombine();
+  }
 
   switch (pkt->data[0]) {
     case '!':
@@ -122,8 +823,20 @@ void GdbServer::rspClientRequest() {
       return;
 
     case '?':
-      // Return last signal ID
-      rspReportException();
+      // Return last signal ID. In non-stop mode, start reporting every
+      // stopped core.
+      if (nonStop) {
+        stopQueue.clear();
+        for (size_t i = 0; i < cores.size(); i++) {
+          if (!cores[i].running) {
+            StopEvent ev = {(int)i, cores[i].stopSignal};
+            stopQueue.push_back(ev);
+          }
+        }
+        rspStopped();
+      } else {
+        rspReportException();
+      }
       return;
 
     case 'A':
@@ -166,8 +879,8 @@ void GdbServer::rspClientRequest() {
       // execution should continue, so unstall the processor.
       pkt->packStr("OK");
       rsp->putPkt(pkt);
-      m_simCtrl->unstall();
-      targetStopped = false;
+      cCore = -1;
+      resumeCores(false);
       return;
 
     case 'F':
@@ -186,9 +899,7 @@ void GdbServer::rspClientRequest() {
 
     case 'H':
       // Set the thread number of subsequent operations.
-      // silently and just reply "OK"
-      pkt->packStr("OK");
-      rsp->putPkt(pkt);
+      rspSetThread();
       return;
 
     case 'i':
@@ -204,8 +915,10 @@ void GdbServer::rspClientRequest() {
     case 'k':
       // Kill request. Stop simulation
       spdlog::info("Simulation stopped by gdb client.");
-      m_simCtrl->stopServer();
-      m_simCtrl->kill();
+      for (size_t i = 0; i < cores.size(); i++) {
+        cores[i].simCtrl->stopServer();
+        cores[i].simCtrl->kill();
+      }
       return;
 
     case 'm':
@@ -266,9 +979,9 @@ void GdbServer::rspClientRequest() {
       return;
 
     case 'T':
-      // Is the thread alive. We are bare metal, so don't have a thread
-      // context. The answer is always "OK".
-      pkt->packStr("OK");
+      // Is the thread alive. Each core is a thread, and they are always
+      // alive.
+      pkt->packStr((parseThreadId(pkt->data + 1) >= 0) ? "OK" : "E01");
       rsp->putPkt(pkt);
       return;
 
@@ -277,6 +990,11 @@ void GdbServer::rspClientRequest() {
       rspVpkt();
       return;
 
+    case 'x':
+      // Read memory (binary)
+      rspReadMemBin();
+      return;
+
     case 'X':
       // Write memory (binary)
       rspWriteMemBin();
@@ -297,25 +1015,58 @@ void GdbServer::rspClientRequest() {
       cerr << "Warning: Unknown RSP request" << pkt->data << endl;
       return;
   }
-}  // rspClientRequest ()
+}  // rspHandleRequest ()
 
 //-----------------------------------------------------------------------------
 //! Send a packet acknowledging an exception has occurred
 
-//! The only signal we ever see in this implementation is TRAP.
+//! The signal is TRAP, or INT if the client interrupted the target.
 //-----------------------------------------------------------------------------
 void GdbServer::rspReportException() {
-  // Construct a signal received packet
-  pkt->data[0] = 'S';
-  pkt->data[1] = Utils::hex2Char(TARGET_SIGNAL_TRAP >> 4);
-  pkt->data[2] = Utils::hex2Char(TARGET_SIGNAL_TRAP % 16);
-  pkt->data[3] = '\0';
-  pkt->setLen(strlen(pkt->data));
-
+  pkt->setLen(packStopReply(pkt->data, stopCore, lastSignal));
   rsp->putPkt(pkt);
 
 }  // rspReportException ()
 
+//-----------------------------------------------------------------------------
+//! Construct a stop reply
+
+//! With more than one core, or in non-stop mode, the reply names the core
+//! (thread) that stopped. If the core stopped at a watchpoint, the reply
+//! gives the data address that was accessed.
+
+//! @param[out] buf     Where to put the reply (with an EOS)
+//! @param[in]  core    Index of the core that stopped
+//! @param[in]  signal  The signal to report
+
+//! @return  The length of the reply
+//-----------------------------------------------------------------------------
+int GdbServer::packStopReply(char *buf, int core, int signal) {
+  SimulationControlInterface::WatchType type;
+  unsigned addr;
+  bool watch = (TARGET_SIGNAL_TRAP == signal) &&
+               cores[core].simCtrl->getWatchpointHit(&type, &addr);
+
+  buf[0] = ((cores.size() > 1) || nonStop || watch) ? 'T' : 'S';
+  buf[1] = Utils::hex2Char(signal >> 4);
+  buf[2] = Utils::hex2Char(signal % 16);
+  buf[3] = '\0';
+  if ((cores.size() > 1) || nonStop) {
+    sprintf(&(buf[3]), "thread:%x;", core + 1);
+  }
+  if (watch) {
+    const char *name = "watch";
+    if (SimulationControlInterface::WATCH_READ == type) {
+      name = "rwatch";
+    } else if (SimulationControlInterface::WATCH_ACCESS == type) {
+      name = "awatch";
+    }
+    sprintf(&(buf[strlen(buf)]), "%s:%x;", name, addr);
+  }
+  return strlen(buf);
+
+}  // packStopReply ()
+
 //-----------------------------------------------------------------------------
 //! Handle a RSP continue request
 
@@ -343,7 +1094,7 @@ void GdbServer::rspContinue(uint32_t except) {
     cerr << "Warning: RSP continue address " << pkt->data
          << " not recognized: ignored" << endl;
   }
-  addr = m_simCtrl->readReg(m_simCtrl->pcRegNum());  // Default uses current PC
+  addr = readNpc();  // Default uses current PC
 
   rspContinue(addr, EXCEPT_NONE);
 
@@ -373,8 +1124,13 @@ void GdbServer::rspContinue() {
 //! @param[in] except  The exception to use (if any)
 //-----------------------------------------------------------------------------
 void GdbServer::rspContinue(uint32_t addr, uint32_t except) {
-  m_simCtrl->unstall();
-  targetStopped = false;
+  resumeCores(false);
+
+  // In non-stop mode the stop is reported later, by notification
+  if (nonStop) {
+    pkt->packStr("OK");
+    rsp->putPkt(pkt);
+  }
 }  // rspContinue ()
 
 //-----------------------------------------------------------------------------
@@ -385,12 +1141,26 @@ void GdbServer::rspContinue(uint32_t addr, uint32_t except) {
 //! Each byte is packed as a pair of hex digits.
 //-----------------------------------------------------------------------------
 void GdbServer::rspReadAllRegs() {
-  for (int r = 0; r < m_simCtrl->nRegs(); r++) {
-    Utils::reg2Hex(m_simCtrl->htotl(m_simCtrl->readReg(r)),
-                   &(pkt->data[r * 8]));
+  // Make sure we won't overflow the buffer (8 chars per register)
+  if ((m_simCtrl->nRegs() * 8) >= pkt->getBufSize()) {
+    spdlog::warn("GdbServer: {:d} registers too large for RSP packet.",
+                 m_simCtrl->nRegs());
+    pkt->packStr("E01");
+    rsp->putPkt(pkt);
+    return;
+  }
+
+  // Served from the register snapshot (fetched in one simulator transaction)
+  uint32_t nRegs = m_simCtrl->nRegs();
+  for (int r = 0; r < nRegs; r++) {
+    if (traceFrame >= 0) {
+      packTraceReg(r, &(pkt->data[r * 8]));
+    } else {
+      Utils::reg2Hex(m_simCtrl->htotl(readGpr(r)), &(pkt->data[r * 8]));
+    }
   }
-  pkt->data[m_simCtrl->nRegs() * 8] = 0;
-  pkt->setLen(m_simCtrl->nRegs() * 8);
+  pkt->data[nRegs * 8] = 0;
+  pkt->setLen(nRegs * 8);
   rsp->putPkt(pkt);
 
 }  // rspReadAllRegs ()
@@ -404,11 +1174,28 @@ void GdbServer::rspReadAllRegs() {
 //!       of data is present. The result is always "OK".
 //-----------------------------------------------------------------------------
 void GdbServer::rspWriteAllRegs() {
-  for (int r = 0; r < m_simCtrl->nRegs(); r++) {
-    m_simCtrl->writeReg(
-        r, Utils::hex2Reg(&(pkt->data[r * 8]), m_simCtrl->wordSize()));
+  uint32_t nRegs = m_simCtrl->nRegs();
+  uint32_t wordSize = m_simCtrl->wordSize();
+
+  // Sanity check that every register is present
+  if (pkt->getLen() < 1 + nRegs * 8) {
+    spdlog::warn("GdbServer: RSP write all registers packet too short.");
+    pkt->packStr("E01");
+    rsp->putPkt(pkt);
+    return;
+  }
+
+  regBuf.resize(nRegs);
+  for (int r = 0; r < nRegs; r++) {
+    regBuf[r] = Utils::hex2Reg(&(pkt->data[1 + r * 8]), wordSize);
   }
 
+  // Write the whole register file in one simulator transaction, and through
+  // to the snapshot
+  m_simCtrl->writeRegs(regBuf.data(), 0, nRegs);
+  cores[gCore].regCache = regBuf;
+  cores[gCore].regCacheValid = true;
+
   // Acknowledge (always OK for now).
   pkt->packStr("OK");
   rsp->putPkt(pkt);
@@ -429,8 +1216,7 @@ void GdbServer::rspWriteAllRegs() {
 //-----------------------------------------------------------------------------
 void GdbServer::rspReadMem() {
   unsigned int addr;  // Where to read the memory
-  int len;            // Number of bytes to read
-  int off;            // Offset into the memory
+  unsigned int len;   // Number of bytes to read
 
   if (2 != sscanf(pkt->data, "m%x,%x:", &addr, &len)) {
     cerr << "Warning: Failed to recognize RSP read memory command: "
@@ -441,22 +1227,23 @@ void GdbServer::rspReadMem() {
   }
 
   // Make sure we won't overflow the buffer (2 chars per byte)
-  if ((len * 2) >= pkt->getBufSize()) {
+  if (len > (pkt->getBufSize() - 1) / 2) {
     cerr << "Warning: Memory read " << pkt->data
          << " too large for RSP packet: truncated" << endl;
     len = (pkt->getBufSize() - 1) / 2;
   }
 
   // Read memory from device
-  uint8_t rawMem[len];
-  m_simCtrl->readMem(rawMem, addr, len);
+  if (!readMem(memBuf, addr, len)) {
+    spdlog::warn("GdbServer: Failed to read {:d} bytes at 0x{:08x}.", len,
+                 addr);
+    pkt->packStr("E01");
+    rsp->putPkt(pkt);
+    return;
+  }
 
   // Convert to hex string
-  for (int i = 0; i < len; i++) {
-    unsigned char ch = rawMem[i];
-    pkt->data[i * 2] = Utils::hex2Char(ch >> 4);
-    pkt->data[i * 2 + 1] = Utils::hex2Char(ch & 0xf);
-  }
+  Utils::bytesToHex(memBuf, len, pkt->data);
 
   pkt->data[len * 2] = '\0';  // End of string
   pkt->setLen(strlen(pkt->data));
@@ -478,7 +1265,7 @@ void GdbServer::rspReadMem() {
 //-----------------------------------------------------------------------------
 void GdbServer::rspWriteMem() {
   uint32_t addr;  // Where to write the memory
-  int len;        // Number of bytes to write
+  uint32_t len;   // Number of bytes to write
 
   if (2 != sscanf(pkt->data, "M%x,%x:", &addr, &len)) {
     cerr << "Warning: Failed to recognize RSP write memory " << pkt->data
@@ -493,20 +1280,39 @@ void GdbServer::rspWriteMem() {
   int datLen = pkt->getLen() - (symDat - pkt->data);
 
   // Sanity check
-  if (len * 2 != datLen) {
-    cerr << "Warning: Write of " << len * 2 << "digits requested, but "
-         << datLen << " digits supplied: packet ignored" << endl;
+  if (2 * (uint64_t)len != (uint64_t)datLen) {
+    cerr << "Warning: Write of " << 2 * (uint64_t)len
+         << " digits requested, but " << datLen
+         << " digits supplied: packet ignored" << endl;
+    pkt->packStr("E01");
+    rsp->putPkt(pkt);
+    return;
+  }
+
+  if (len > (uint32_t)pktSize / 2) {
+    cerr << "Warning: Write of " << len << " bytes exceeds the buffer: "
+         << "packet ignored" << endl;
+    pkt->packStr("E01");
+    rsp->putPkt(pkt);
+    return;
+  }
+
+  // Decode into a contiguous buffer
+  if (!Utils::hexToBytes(symDat, len, memBuf)) {
+    cerr << "Warning: Malformed hex digits in RSP write memory: packet "
+         << "ignored" << endl;
     pkt->packStr("E01");
     rsp->putPkt(pkt);
     return;
   }
 
-  // Write the bytes to memory (no check the address is OK here)
-  for (int off = 0; off < len; off++) {
-    uint8_t nyb1 = Utils::char2Hex(symDat[off * 2]);
-    uint8_t nyb2 = Utils::char2Hex(symDat[off * 2 + 1]);
-    unsigned char c = (nyb1 << 4) | nyb2;
-    m_simCtrl->writeMem(&c, addr + off, 1);
+  // Write the bytes to memory in one go
+  if (!writeMemCombined(memBuf, addr, len)) {
+    spdlog::warn("GdbServer: Failed to write {:d} bytes at 0x{:08x}.", len,
+                 addr);
+    pkt->packStr("E01");
+    rsp->putPkt(pkt);
+    return;
   }
 
   pkt->packStr("OK");
@@ -531,7 +1337,12 @@ void GdbServer::rspReadReg() {
     return;
   }
 
-  Utils::reg2Hex(m_simCtrl->htotl(m_simCtrl->readReg(regNum)), pkt->data);
+  if (traceFrame >= 0) {
+    packTraceReg(regNum, pkt->data);
+    pkt->data[8] = '\0';
+  } else {
+    Utils::reg2Hex(m_simCtrl->htotl(readGpr(regNum)), pkt->data);
+  }
   pkt->setLen(strlen(pkt->data));
   rsp->putPkt(pkt);
 
@@ -555,7 +1366,7 @@ void GdbServer::rspWriteReg() {
     return;
   }
 
-  m_simCtrl->writeReg(regNum, Utils::hex2Reg(valstr, m_simCtrl->wordSize()));
+  writeGpr(regNum, Utils::hex2Reg(valstr, m_simCtrl->wordSize()));
   pkt->packStr("OK");
   rsp->putPkt(pkt);
 
@@ -568,18 +1379,22 @@ void GdbServer::rspQuery() {
   if (0 == strcmp("qC", pkt->data)) {
     // Return the current thread ID (unsigned hex). A null response
     // indicates to use the previously selected thread.
-    sprintf(pkt->data, "QC%x", 0);
+    sprintf(pkt->data, "QC%x", gCore + 1);
     pkt->setLen(strlen(pkt->data));
     rsp->putPkt(pkt);
-  } else if (0 == strncmp("qCRC", pkt->data, strlen("qCRC"))) {
+  } else if (0 == strncmp("qCRC:", pkt->data, strlen("qCRC:"))) {
     // Return CRC of memory area
-    cerr << "Warning: RSP CRC query not supported" << endl;
-    pkt->packStr("E01");
-    rsp->putPkt(pkt);
+    rspCrc();
   } else if (0 == strcmp("qfThreadInfo", pkt->data)) {
-    // Return info about active threads. We return just the constant
-    sprintf(pkt->data, "m%x", 0);
-    pkt->setLen(strlen(pkt->data));
+    // Return info about active threads: one per core, all in one reply
+    int len = sprintf(pkt->data, "m1");
+    for (size_t i = 1; i < cores.size(); i++) {
+      if (len + 10 >= pkt->getBufSize()) {
+        break;
+      }
+      len += sprintf(&(pkt->data[len]), ",%x", (unsigned int)i + 1);
+    }
+    pkt->setLen(len);
     rsp->putPkt(pkt);
   } else if (0 == strcmp("qsThreadInfo", pkt->data)) {
     // Return info about more active threads. We have no more, so return the
@@ -607,17 +1422,21 @@ void GdbServer::rspQuery() {
     rsp->putPkt(pkt);
   } else if (0 == strncmp("qRcmd,", pkt->data, strlen("qRcmd,"))) {
     // "Passed to the local interpreter for execution"
-    cerr << "Warning: RSP qRcmd not supported." << endl;
-    pkt->packStr("");
-    rsp->putPkt(pkt);
+    rspCommand();
   } else if (0 == strncmp("qSupported", pkt->data, strlen("qSupported"))) {
     // Report a list of the features we support. For now we just ignore any
     // supplied specific feature queries, but in the future these may be
     // supported as well. Note that the packet size allows for 'G' + all the
     // registers sent to us, or a reply to 'g' with all the registers and an
     // EOS so the buffer is a well formed string.
-    sprintf(pkt->data, "PacketSize=%x", pkt->getBufSize());
-    pkt->setLen(strlen(pkt->data));
+    int len = sprintf(pkt->data,
+                      "PacketSize=%x;QStartNoAckMode+;binary-upload+;"
+                      "QNonStop+;ConditionalBreakpoints+;ConditionalTracepoints+",
+                      pktSize);
+    if (!memoryRegions.empty()) {
+      len += sprintf(&(pkt->data[len]), ";qXfer:memory-map:read+");
+    }
+    pkt->setLen(len);
     rsp->putPkt(pkt);
   } else if (0 == strncmp("qSymbol:", pkt->data, strlen("qSymbol:"))) {
     // Offer to look up symbols. Nothing we want (for now). TODO. This just
@@ -633,8 +1452,11 @@ void GdbServer::rspQuery() {
             'n', 'a', 'b', 'l', 'e', 0);
     pkt->setLen(strlen(pkt->data));
     rsp->putPkt(pkt);
+  } else if (0 == strncmp("qXfer:memory-map:read::", pkt->data,
+                          strlen("qXfer:memory-map:read::"))) {
+    rspReadMemoryMap();
   } else if (0 == strncmp("qXfer:", pkt->data, strlen("qXfer:"))) {
-    // For now we support no 'qXfer' requests, but these should not be
+    // We support no other 'qXfer' requests, but these should not be
     // expected, since they were not reported by 'qSupported'
     cerr << "Warning: RSP 'qXfer' not supported: ignored" << endl;
     pkt->packStr("");
@@ -644,25 +1466,149 @@ void GdbServer::rspQuery() {
     // existing one.
     pkt->packStr("1");  // existing process
     rsp->putPkt(pkt);
-  } else if (0 == strncmp("qTfV", pkt->data, strlen("qTfV"))) {
-    pkt->packStr("");
-    rsp->putPkt(pkt);
-  } else if (0 == strncmp("qTfP", pkt->data, strlen("qTfP"))) {
-    pkt->packStr("");
+  } else if ((0 == strcmp("qTfV", pkt->data)) ||
+             (0 == strcmp("qTsV", pkt->data)) ||
+             (0 == strcmp("qTfP", pkt->data)) ||
+             (0 == strcmp("qTsP", pkt->data))) {
+    // Uploading trace state variables and tracepoints: we have none to
+    // offer (the client's own definitions are the ones that count).
+    pkt->packStr("l");
     rsp->putPkt(pkt);
-  } else if (0 == strncmp("qTStatus", pkt->data, strlen("qTStatus"))) {
+  } else if (0 == strcmp("qTStatus", pkt->data)) {
     // Client asks if there is a trace experiment running right now.
-    // Reply that this packet is unsupported.
-    //        pkt->packStr("Ttnotrun:0");
-    //        pkt->packStr("tunknown:0");
-
-    pkt->packStr("");
-    rsp->putPkt(pkt);
+    rspTraceStatus();
+  } else if (0 == strncmp("qTP:", pkt->data, strlen("qTP:"))) {
+    rspTracepointStatus();
   } else {
     cerr << "Unrecognized RSP query: ignored" << endl;
   }
 }  // rspQuery ()
 
+//-----------------------------------------------------------------------------
+//! Handle a RSP qRcmd request (a GDB "monitor" command)
+
+//! The command is hex encoded after the comma. Its output is sent as console
+//! output ('O') packets, followed by "OK".
+
+//! Supported commands are:
+//! - "stats": show the request counters and latencies.
+//! - "stats reset": zero them.
+//-----------------------------------------------------------------------------
+void GdbServer::rspCommand() {
+  const char *hexCmd = pkt->data + strlen("qRcmd,");
+  std::size_t len = (pkt->getLen() - strlen("qRcmd,")) / 2;
+  std::string cmd(len, '\0');
+  if (!Utils::hexToBytes(hexCmd, len, (uint8_t *)&cmd[0])) {
+    pkt->packStr("E01");
+    rsp->putPkt(pkt);
+    return;
+  }
+
+  std::vector<std::string> args;
+  std::istringstream words(cmd);
+  std::string word;
+  while (words >> word) {
+    args.push_back(word);
+  }
+
+  if ((1 == args.size()) && ("stats" == args[0])) {
+    rspConsoleOutput(stats->report());
+  } else if ((2 == args.size()) && ("stats" == args[0]) &&
+             ("reset" == args[1])) {
+    stats->reset();
+    rspConsoleOutput("Statistics reset.\n");
+  } else if (!args.empty() && ("profile" == args[0])) {
+    rspProfile(args);
+  } else {
+    rspConsoleOutput(
+        "Unknown monitor command \"" + cmd +
+        "\". Commands are:\n"
+        "  stats                     show request counts and latencies\n"
+        "  stats reset               zero them\n"
+        "  profile start [rate]      sample the PC while the target runs\n"
+        "  profile stop              stop sampling\n"
+        "  profile                   show the most sampled addresses\n"
+        "  profile dump file [text]  write a gmon.out (or text) profile\n");
+  }
+
+  pkt->packStr("OK");
+  rsp->putPkt(pkt);
+
+}  // rspCommand ()
+
+//-----------------------------------------------------------------------------
+//! Handle a "monitor profile" command
+
+//! @param[in] args  The words of the command, "profile" first
+//-----------------------------------------------------------------------------
+void GdbServer::rspProfile(const std::vector<std::string> &args) {
+  char msg[64];
+
+  if (1 == args.size()) {
+    rspConsoleOutput(profiler->summary(10));
+  } else if (("start" == args[1]) && (args.size() <= 3)) {
+    unsigned long rate = Profiler::DEFAULT_RATE;
+    if (3 == args.size()) {
+      char *end;
+      rate = strtoul(args[2].c_str(), &end, 0);
+      if (('\0' != *end) || (0 == rate) || (rate > Profiler::MAX_RATE)) {
+        snprintf(msg, sizeof(msg), "Rate must be 1 to %u Hz.\n",
+                 Profiler::MAX_RATE);
+        rspConsoleOutput(msg);
+        return;
+      }
+    }
+    profiler->start(rate);
+    snprintf(msg, sizeof(msg), "Profiling at %u Hz.\n", profiler->getRate());
+    rspConsoleOutput(msg);
+  } else if (("stop" == args[1]) && (2 == args.size())) {
+    profiler->stop();
+    rspConsoleOutput(profiler->summary(10));
+  } else if (("dump" == args[1]) && (3 == args.size())) {
+    // Write in the target's byte order
+    uint32_t probe = m_simCtrl->htotl(0x01020304);
+    bool bigEndian = (0x01 == *(uint8_t *)&probe);
+    if (profiler->writeGmon(args[2].c_str(), bigEndian)) {
+      snprintf(msg, sizeof(msg), "Wrote %llu samples to ",
+               (unsigned long long)profiler->getSamples());
+      rspConsoleOutput(msg + args[2] + ".\n");
+    } else {
+      rspConsoleOutput("Cannot write " + args[2] + ".\n");
+    }
+  } else if (("dump" == args[1]) && (4 == args.size()) &&
+             ("text" == args[3])) {
+    if (profiler->writeText(args[2].c_str())) {
+      snprintf(msg, sizeof(msg), "Wrote %zu addresses to ",
+               profiler->getAddresses());
+      rspConsoleOutput(msg + args[2] + ".\n");
+    } else {
+      rspConsoleOutput("Cannot write " + args[2] + ".\n");
+    }
+  } else {
+    rspConsoleOutput(
+        "Usage: monitor profile [start [rate] | stop | dump file [text]]\n");
+  }
+
+}  // rspProfile ()
+
+//-----------------------------------------------------------------------------
+//! Send text to the client's console, in as few 'O' packets as fit it
+
+//! @param[in] text  The text to send
+//-----------------------------------------------------------------------------
+void GdbServer::rspConsoleOutput(const std::string &text) {
+  std::size_t maxChunk = (pktSize - 1) / 2;
+  for (std::size_t off = 0; off < text.size(); off += maxChunk) {
+    std::size_t chunk = std::min(maxChunk, text.size() - off);
+    pkt->data[0] = 'O';
+    Utils::bytesToHex((const uint8_t *)text.data() + off, chunk,
+                      &pkt->data[1]);
+    pkt->setLen(1 + 2 * chunk);
+    rsp->putPkt(pkt);
+  }
+
+}  // rspConsoleOutput ()
+
 //-----------------------------------------------------------------------------
 //! Handle a qSupported? feature query
 //-----------------------------------------------------------------------------
@@ -768,33 +1714,301 @@ void GdbServer::qSupported() {
 //! Handle a RSP set request
 //-----------------------------------------------------------------------------
 void GdbServer::rspSet() {
-  if (0 == strncmp("QPassSignals:", pkt->data, strlen("QPassSignals:"))) {
+  if (0 == strcmp("QStartNoAckMode", pkt->data)) {
+    // The OK is still acknowledged by the client, after which neither side
+    // sends acks.
+    pkt->packStr("OK");
+    rsp->putPkt(pkt);
+    rsp->setNoAckMode(true);
+  } else if (0 == strncmp("QNonStop:", pkt->data, strlen("QNonStop:"))) {
+    rspNonStop();
+  } else if (0 ==
+             strncmp("QPassSignals:", pkt->data, strlen("QPassSignals:"))) {
     // Passing signals not supported
     pkt->packStr("");
     rsp->putPkt(pkt);
-  } else if ((0 == strncmp("QTDP", pkt->data, strlen("QTDP"))) ||
-             (0 == strncmp("QFrame", pkt->data, strlen("QFrame"))) ||
-             (0 == strcmp("QTStart", pkt->data)) ||
-             (0 == strcmp("QTStop", pkt->data)) ||
-             (0 == strcmp("QTinit", pkt->data)) ||
-             (0 == strncmp("QTro", pkt->data, strlen("QTro")))) {
-    // All tracepoint features are not supported. This reply is really only
-    // needed to 'QTDP', since with that the others should not be
-    // generated.
-    pkt->packStr("");
+  } else if (0 == strcmp("QTinit", pkt->data)) {
+    // Forget any previous trace experiment
+    if (tracing) {
+      stopTracing("tstop::0");
+    }
+    tracepoints.clear();
+    traceReadOnly.clear();
+    traceBuf->clear();
+    traceStopReason = "tnotrun:0";
+    traceFrame = -1;
+    pkt->packStr("OK");
+    rsp->putPkt(pkt);
+  } else if (0 == strncmp("QTDPsrc:", pkt->data, strlen("QTDPsrc:"))) {
+    pkt->packStr("OK");  // Source strings are only for uploading: ignored
+    rsp->putPkt(pkt);
+  } else if (0 == strncmp("QTDP:", pkt->data, strlen("QTDP:"))) {
+    rspTraceDefine();
+  } else if (0 == strncmp("QTro", pkt->data, strlen("QTro"))) {
+    // Read-only sections, as QTro:start,end[:start,end]...
+    char *p = pkt->data + strlen("QTro");
+    traceReadOnly.clear();
+    while (':' == *p) {
+      uint32_t start = strtoul(p + 1, &p, 16);
+      uint32_t end = (',' == *p) ? strtoul(p + 1, &p, 16) : start;
+      traceReadOnly.push_back(std::make_pair(start, end));
+    }
+    pkt->packStr("OK");
+    rsp->putPkt(pkt);
+  } else if (0 == strcmp("QTStart", pkt->data)) {
+    rspTraceStart();
+  } else if (0 == strcmp("QTStop", pkt->data)) {
+    if (tracing) {
+      stopTracing("tstop::0");
+    }
+    pkt->packStr("OK");
+    rsp->putPkt(pkt);
+  } else if (0 == strncmp("QTFrame:", pkt->data, strlen("QTFrame:"))) {
+    rspTraceFrame();
+  } else if (0 == strncmp("QTBuffer:", pkt->data, strlen("QTBuffer:"))) {
+    rspTraceBuffer();
+  } else if ((0 == strncmp("QTNotes:", pkt->data, strlen("QTNotes:"))) ||
+             (0 == strncmp("QTDisconnected:", pkt->data,
+                           strlen("QTDisconnected:")))) {
+    pkt->packStr("OK");  // Accepted, but of no consequence here
     rsp->putPkt(pkt);
   } else {
     cerr << "Unrecognized RSP set request: ignored" << endl;
-    delete pkt;
+    pkt->packStr("");
+    rsp->putPkt(pkt);
   }
 }  // rspSet ()
 
+//-----------------------------------------------------------------------------
+//! Handle a RSP set thread request
+
+//! Syntax is:
+
+//!   H<op><thread-id>
+
+//! Hg selects the core for register and memory operations, Hc the core for
+//! step and continue. Thread 0 (any) or -1 (all) leaves Hg unchanged, and
+//! lets continue resume every core.
+//-----------------------------------------------------------------------------
+void GdbServer::rspSetThread() {
+  char op = pkt->data[1];
+  int core = ('\0' == op) ? -2 : parseThreadId(pkt->data + 2);
+
+  if ((core < -1) || (('g' != op) && ('c' != op))) {
+    cerr << "Warning: RSP set thread request " << pkt->data
+         << " not recognized" << endl;
+    pkt->packStr("E01");
+    rsp->putPkt(pkt);
+    return;
+  }
+
+  if ('g' == op) {
+    selectCore((core < 0) ? gCore : core);
+  } else {
+    cCore = core;
+  }
+
+  pkt->packStr("OK");
+  rsp->putPkt(pkt);
+
+}  // rspSetThread ()
+
+//-----------------------------------------------------------------------------
+//! Handle a RSP non-stop mode request
+
+//! Syntax is:
+
+//!   QNonStop:<0|1>
+
+//! Leaving non-stop mode stalls every core, as all-stop mode requires.
+//-----------------------------------------------------------------------------
+void GdbServer::rspNonStop() {
+  if (0 == strcmp("QNonStop:1", pkt->data)) {
+    nonStop = true;
+  } else if (0 == strcmp("QNonStop:0", pkt->data)) {
+    nonStop = false;
+    stopQueue.clear();
+    stallAllCores();
+    targetStopped = true;
+  } else {
+    pkt->packStr("E01");
+    rsp->putPkt(pkt);
+    return;
+  }
+
+  pkt->packStr("OK");
+  rsp->putPkt(pkt);
+
+}  // rspNonStop ()
+
+//-----------------------------------------------------------------------------
+//! Reply with the first stop still to be reported in non-stop mode
+
+//! Used for vStopped and '?'. The reply is "OK" once every stop has been
+//! reported.
+//-----------------------------------------------------------------------------
+void GdbServer::rspStopped() {
+  if (stopQueue.empty()) {
+    pkt->packStr("OK");
+  } else {
+    pkt->setLen(packStopReply(pkt->data, stopQueue.front().core,
+                              stopQueue.front().signal));
+  }
+  rsp->putPkt(pkt);
+
+}  // rspStopped ()
+
+//-----------------------------------------------------------------------------
+//! Handle a RSP vCont request
+
+//! Syntax is:
+
+//!   vCont[;action[:thread-id]]...
+
+//! Each core takes the first action that applies to it, where an action
+//! without a thread ID applies to every core. The actions are:
+
+//!   c          continue
+//!   C sig      continue with signal
+//!   s          step
+//!   S sig      step with signal
+//!   t          stop (non-stop mode only)
+//!   r start,end  step until the PC leaves [start, end)
+
+//! We can't deliver signals to the target, so C and S are treated as c and
+//! s. Range stepping is done here, one step at a time, with a single stop
+//! reported at the end. Cores with no action stay stopped.
+
+//! In all-stop mode the reply is the stop reply, once the target stops. In
+//! non-stop mode the reply is OK, and stops are notified as they happen.
+//-----------------------------------------------------------------------------
+void GdbServer::rspVCont() {
+  struct Action {
+    char act;  //!< 0 if none
+    uint32_t start;
+    uint32_t end;
+  };
+
+  Action none = {0, 0, 0};
+  std::vector<Action> actions(cores.size(), none);
+  char *p = pkt->data + strlen("vCont");
+  bool valid = true;
+
+  while (valid && (';' == p[0]) && ('\0' != p[1])) {
+    Action a = {p[1], 0, 0};
+    int core = -1;  // All cores
+    char *end;
+    p += 2;
+
+    switch (a.act) {
+      case 'C':
+      case 'S':
+        // Signal number, which we ignore
+        strtoul(p, &end, 16);
+        valid = (end != p);
+        p = end;
+        a.act = ('C' == a.act) ? 'c' : 's';
+        break;
+
+      case 'r':
+        a.start = strtoul(p, &end, 16);
+        valid = (end != p) && (',' == *end);
+        p = end + 1;
+        if (valid) {
+          a.end = strtoul(p, &end, 16);
+          valid = (end != p);
+          p = end;
+        }
+        break;
+
+      case 'c':
+      case 's':
+      case 't':
+        break;
+
+      default:
+        valid = false;
+        break;
+    }
+
+    if (valid && (':' == *p)) {
+      end = strchr(p + 1, ';');
+      std::string tid(p + 1, (NULL == end) ? strlen(p + 1) : end - p - 1);
+      core = parseThreadId(tid.c_str());
+      p += 1 + tid.size();
+    }
+
+    if (!valid || (core < -1)) {
+      spdlog::warn("GdbServer: RSP vCont action not recognized: {:s}",
+                   pkt->data);
+      pkt->packStr("E01");
+      rsp->putPkt(pkt);
+      return;
+    }
+
+    for (size_t i = 0; i < cores.size(); i++) {
+      if ((0 == actions[i].act) && ((core < 0) || (core == (int)i))) {
+        actions[i] = a;
+      }
+    }
+  }
+
+  if ('\0' != *p) {
+    spdlog::warn("GdbServer: RSP vCont request not recognized: {:s}",
+                 pkt->data);
+    pkt->packStr("E01");
+    rsp->putPkt(pkt);
+    return;
+  }
+
+  for (size_t i = 0; i < cores.size(); i++) {
+    switch (actions[i].act) {
+      case 'c':
+        resumeCore(i, false);
+        break;
+
+      case 's':
+        resumeCore(i, true);
+        break;
+
+      case 'r':
+        // Always step once, then carry on while in the range
+        if (!cores[i].running) {
+          resumeCore(i, true);
+          cores[i].rangeStep = true;
+          cores[i].rangeStart = actions[i].start;
+          cores[i].rangeEnd = actions[i].end;
+        }
+        break;
+
+      case 't':
+        // Reported with signal 0 once it has stalled
+        if (cores[i].running) {
+          cores[i].stopSignal = TARGET_SIGNAL_NONE;
+          cores[i].simCtrl->stall();
+        }
+        break;
+
+      default:
+        break;
+    }
+  }
+
+  targetStopped = false;
+  if (nonStop) {
+    pkt->packStr("OK");
+    rsp->putPkt(pkt);
+  }
+
+}  // rspVCont ()
+
 //-----------------------------------------------------------------------------
 //! Handle a RSP restart request
 
 //! not implemented
 //-----------------------------------------------------------------------------
 void GdbServer::rspRestart() {
+  invalidateCaches();
   spdlog::error("GdbServer.cpp: RSP restart request not implemented.");
 }  // rspRestart ()
 
@@ -823,7 +2037,7 @@ void GdbServer::rspStep(uint32_t except) {
     cerr << "Warning: RSP step address " << pkt->data << " not ignored" << endl;
     // Still just use PC
   }
-  addr = m_simCtrl->readReg(m_simCtrl->pcRegNum());
+  addr = readNpc();
 
   rspStep(addr, EXCEPT_NONE);
 
@@ -842,15 +2056,19 @@ void GdbServer::rspStep() {
 //! Generic processing of a step request
 
 //! The signal may be EXCEPT_NONE if there is no exception to be
-//! handled. Currently the exception is ignored.
+//! handled. Currently the exception is ignored. The step always starts from
+//! the current PC of the stepping core.
 //! @param[in] addr    Address from which to step
 //! @param[in] except  The exception to use (if any)
 //-----------------------------------------------------------------------------
 void GdbServer::rspStep(uint32_t addr, uint32_t except) {
-  // Set the address as the value of the next program counter
-  m_simCtrl->writeReg(m_simCtrl->pcRegNum(), addr);
-  m_simCtrl->step();
-  targetStopped = false;
+  resumeCores(true);
+
+  // In non-stop mode the stop is reported later, by notification
+  if (nonStop) {
+    pkt->packStr("OK");
+    rsp->putPkt(pkt);
+  }
 }  // rspStep ()
 
 //-----------------------------------------------------------------------------
@@ -862,18 +2080,22 @@ void GdbServer::rspVpkt() {
   if (0 == strncmp("vAttach;", pkt->data, strlen("vAttach;"))) {
     // Attaching is a null action, since we have no other process. We just
     // return a stop packet (using TRAP) to indicate we are stopped.
-    pkt->packStr("S05");
-    rsp->putPkt(pkt);
+    rspReportException();
     return;
   } else if (0 == strcmp("vCont?", pkt->data)) {
-    // For now we don't support this.
-    pkt->packStr("vCont;s;c");
+    // Report the vCont actions we support
+    pkt->packStr("vCont;c;C;s;S;t;r");
     rsp->putPkt(pkt);
     return;
-  } else if (0 == strncmp("vCont", pkt->data, strlen("vCont"))) {
-    // This shouldn't happen, because we've reported non-support via vCont?
-    // above
-    cerr << "Warning: RSP vCont not supported: ignored" << endl;
+  } else if (0 == strncmp("vCont;", pkt->data, strlen("vCont;"))) {
+    rspVCont();
+    return;
+  } else if (0 == strcmp("vStopped", pkt->data)) {
+    // The client has dealt with the first queued stop
+    if (!stopQueue.empty()) {
+      stopQueue.pop_front();
+    }
+    rspStopped();
     return;
   } else if (0 == strncmp("vFile:", pkt->data, strlen("vFile:"))) {
     // For now we don't support this.
@@ -882,23 +2104,13 @@ void GdbServer::rspVpkt() {
     rsp->putPkt(pkt);
     return;
   } else if (0 == strncmp("vFlashErase:", pkt->data, strlen("vFlashErase:"))) {
-    // For now we don't support this.
-    cerr << "Warning: RSP vFlashErase not supported: ignored" << endl;
-    pkt->packStr("E01");
-    rsp->putPkt(pkt);
+    rspFlashErase();
     return;
   } else if (0 == strncmp("vFlashWrite:", pkt->data, strlen("vFlashWrite:"))) {
-    // For now we don't support this.
-    cerr << "Warning: RSP vFlashWrite not supported: ignored" << endl;
-    pkt->packStr("E01");
-    rsp->putPkt(pkt);
+    rspFlashWrite();
     return;
   } else if (0 == strcmp("vFlashDone", pkt->data)) {
-    // For now we don't support this.
-    cerr << "Warning: RSP vFlashDone not supported: ignored" << endl;
-    ;
-    pkt->packStr("E01");
-    rsp->putPkt(pkt);
+    rspFlashDone();
     return;
   } else if (0 == strncmp("vRun;", pkt->data, strlen("vRun;"))) {
     // We shouldn't be given any args, but check for this
@@ -911,15 +2123,16 @@ void GdbServer::rspVpkt() {
     // Restart the current program. However unlike a "R" packet, "vRun"
     // should behave as though it has just stopped. We use signal 5 (TRAP).
     rspRestart();
-    pkt->packStr("S05");
-    rsp->putPkt(pkt);
+    rspReportException();
   } else if (0 == strncmp("vKill", pkt->data, strlen("vKill"))) {
     // Kill request - stop simulation
     pkt->packStr("OK");
     rsp->putPkt(pkt);
     spdlog::info("Simulation stopped by gdb client");
-    m_simCtrl->kill();
-    m_simCtrl->stopServer();
+    for (size_t i = 0; i < cores.size(); i++) {
+      cores[i].simCtrl->kill();
+      cores[i].simCtrl->stopServer();
+    }
   } else if (0 ==
              strncmp("vMustReplyEmpty", pkt->data, strlen("vMustReplyEmpty"))) {
     // Reply empty packet
@@ -935,47 +2148,371 @@ void GdbServer::rspVpkt() {
 }  // rspVpkt ()
 
 //-----------------------------------------------------------------------------
-//! Handle a RSP write memory (binary) request
+//! Handle a RSP CRC query
 
 //! Syntax is:
 
-//!   X<addr>,<length>:
-
-//! Followed by the specified number of bytes as raw binary. Response should be
-//! "OK" if all copied OK, E<nn> if error <nn> has occurred.
-
-//! The length given is the number of bytes to be written. The data buffer has
-//! already been unescaped, so will hold this number of bytes.
+//!   qCRC:<addr>,<length>
 
-//! The data is in model-endian format, so no transformation is needed.
+//! The response is C<crc32>, the CRC-32 of the memory region computed the
+//! way GDB does, so compare-sections doesn't have to read the region back.
+//! Memory is read from the simulator in packet sized chunks.
 //-----------------------------------------------------------------------------
-void GdbServer::rspWriteMemBin() {
-  uint32_t addr;  // Where to write the memory
-  int len;        // Number of bytes to write
+void GdbServer::rspCrc() {
+  uint32_t addr;  // Start of the region
+  uint32_t len;   // Length of the region
 
-  if (2 != sscanf(pkt->data, "X%x,%x:", &addr, &len)) {
-    spdlog::warn(
-        "GdbServer: Failed to recognize RSP write memory command: {:s}",
-        std::string(pkt->data));
+  if (2 != sscanf(pkt->data, "qCRC:%x,%x", &addr, &len)) {
+    cerr << "Warning: Failed to recognize RSP CRC query: " << pkt->data
+         << endl;
     pkt->packStr("E01");
     rsp->putPkt(pkt);
     return;
   }
 
-  // Find the start of the data and "unescape" it. Bindat must be unsigned, or
-  // all sorts of horrible sign extensions will happen when val is computed
-  // below!
-  uint8_t *bindat = (uint8_t *)(memchr(pkt->data, ':', pkt->getBufSize())) + 1;
-  int off = (char *)bindat - pkt->data;
-  int newLen = Utils::rspUnescape((char *)bindat, pkt->getLen() - off);
-
-  // Sanity check
-  if (newLen != len) {
-    int minLen = len < newLen ? len : newLen;
+  const uint32_t chunkSize = pktSize / 2;  // Size of memBuf
+  uint32_t crc = 0xffffffff;
+  for (uint32_t done = 0; done < len;) {
+    uint32_t n = (len - done < chunkSize) ? len - done : chunkSize;
+    if (!m_simCtrl->readMem(memBuf, addr + done, n)) {
+      spdlog::warn("GdbServer: Failed to read {:d} bytes at 0x{:08x} for CRC.",
+                   n, addr + done);
+      pkt->packStr("E01");
+      rsp->putPkt(pkt);
+      return;
+    }
+    crc = Utils::crc32(memBuf, n, crc);
+    done += n;
+  }
 
+  sprintf(pkt->data, "C%x", crc);
+  pkt->setLen(strlen(pkt->data));
+  rsp->putPkt(pkt);
+
+}  // rspCrc ()
+
+//-----------------------------------------------------------------------------
+//! Handle a RSP qXfer:memory-map:read request
+
+//! Syntax is:
+
+//!   qXfer:memory-map:read::<offset>,<length>
+
+//! The response is 'm' followed by part of the memory map XML document if
+//! there is more to come, or 'l' followed by the final part.
+//-----------------------------------------------------------------------------
+void GdbServer::rspReadMemoryMap() {
+  unsigned int offset;  // Offset into the document
+  unsigned int len;     // Max number of chars to return
+
+  if (2 != sscanf(pkt->data, "qXfer:memory-map:read::%x,%x", &offset, &len)) {
+    cerr << "Warning: Failed to recognize RSP memory map request: "
+         << pkt->data << endl;
+    pkt->packStr("E01");
+    rsp->putPkt(pkt);
+    return;
+  }
+
+  if (memoryRegions.empty()) {
+    pkt->packStr("");  // Not supported, since no memory map was declared
+    rsp->putPkt(pkt);
+    return;
+  }
+
+  std::string xml = memoryMapXml();
+  if (offset > xml.size()) {
+    offset = xml.size();
+  }
+
+  // Leave room for the 'm'/'l' and an EOS
+  if (len > pkt->getBufSize() - 2) {
+    len = pkt->getBufSize() - 2;
+  }
+  if (len > xml.size() - offset) {
+    len = xml.size() - offset;
+  }
+
+  pkt->data[0] = (offset + len < xml.size()) ? 'm' : 'l';
+  memcpy(&(pkt->data[1]), xml.data() + offset, len);
+  pkt->data[len + 1] = '\0';
+  pkt->setLen(len + 1);
+  rsp->putPkt(pkt);
+
+}  // rspReadMemoryMap ()
+
+//-----------------------------------------------------------------------------
+//! Handle a RSP flash erase request
+
+//! Syntax is:
+
+//!   vFlashErase:<addr>,<length>
+
+//! The range must cover whole erase blocks of a declared flash region. Each
+//! block is buffered in its erased state (all ones) until vFlashDone.
+//-----------------------------------------------------------------------------
+void GdbServer::rspFlashErase() {
+  uint32_t addr;  // Start of the range to erase
+  uint32_t len;   // Number of bytes to erase
+
+  if (2 != sscanf(pkt->data, "vFlashErase:%x,%x", &addr, &len)) {
+    cerr << "Warning: Failed to recognize RSP flash erase request: "
+         << pkt->data << endl;
+    pkt->packStr("E01");
+    rsp->putPkt(pkt);
+    return;
+  }
+
+  uint64_t end = (uint64_t)addr + len;
+  for (uint64_t blockAddr = addr; blockAddr < end;) {
+    const MemoryRegion *region = findFlashRegion(blockAddr);
+    if ((NULL == region) ||
+        (0 != (blockAddr - region->start) % region->blockSize)) {
+      spdlog::warn("GdbServer: vFlashErase of 0x{:08x} not aligned to a flash "
+                   "block.",
+                   (uint32_t)blockAddr);
+      pkt->packStr("E01");
+      rsp->putPkt(pkt);
+      return;
+    }
+
+    flashBlocks[blockAddr].assign(region->blockSize, 0xff);
+    blockAddr += region->blockSize;
+  }
+
+  pkt->packStr("OK");
+  rsp->putPkt(pkt);
+
+}  // rspFlashErase ()
+
+//-----------------------------------------------------------------------------
+//! Handle a RSP flash write request
+
+//! Syntax is:
+
+//!   vFlashWrite:<addr>:<data>
+
+//! The data is escaped binary. It must lie within blocks erased by a
+//! previous vFlashErase, and is buffered there until vFlashDone.
+//-----------------------------------------------------------------------------
+void GdbServer::rspFlashWrite() {
+  uint32_t addr;  // Where to write
+
+  if (1 != sscanf(pkt->data, "vFlashWrite:%x:", &addr)) {
+    cerr << "Warning: Failed to recognize RSP flash write request: "
+         << pkt->data << endl;
+    pkt->packStr("E01");
+    rsp->putPkt(pkt);
+    return;
+  }
+
+  // Find the start of the data (after the second ':') and "unescape" it
+  char *start = pkt->data + strlen("vFlashWrite:");
+  char *colon =
+      (char *)memchr(start, ':', pkt->getLen() - strlen("vFlashWrite:"));
+  if (NULL == colon) {
+    pkt->packStr("E01");
+    rsp->putPkt(pkt);
+    return;
+  }
+  uint8_t *bindat = (uint8_t *)colon + 1;
+  int off = (char *)bindat - pkt->data;
+  int len = Utils::rspUnescape((char *)bindat, pkt->getLen() - off);
+
+  // Copy into the buffered blocks
+  for (int done = 0; done < len;) {
+    uint32_t a = addr + done;
+    const MemoryRegion *region = findFlashRegion(a);
+    uint32_t blockAddr =
+        (NULL == region) ? 0 : a - (a - region->start) % region->blockSize;
+    std::map<uint32_t, std::vector<uint8_t>>::iterator block =
+        flashBlocks.find(blockAddr);
+
+    if ((NULL == region) || (flashBlocks.end() == block)) {
+      spdlog::warn("GdbServer: vFlashWrite to 0x{:08x}, which was not erased.",
+                   a);
+      pkt->packStr("E01");
+      rsp->putPkt(pkt);
+      return;
+    }
+
+    uint32_t blockOff = a - blockAddr;
+    uint32_t n = region->blockSize - blockOff;
+    if (n > (uint32_t)(len - done)) {
+      n = len - done;
+    }
+    memcpy(&(block->second[blockOff]), &bindat[done], n);
+    done += n;
+  }
+
+  pkt->packStr("OK");
+  rsp->putPkt(pkt);
+
+}  // rspFlashWrite ()
+
+//-----------------------------------------------------------------------------
+//! Handle a RSP flash done request
+
+//! Commit every buffered flash block to the simulator, with one write per
+//! block.
+//-----------------------------------------------------------------------------
+void GdbServer::rspFlashDone() {
+  bool ok = true;
+
+  for (std::map<uint32_t, std::vector<uint8_t>>::iterator it =
+           flashBlocks.begin();
+       it != flashBlocks.end(); ++it) {
+    if (!writeMem(it->second.data(), it->first, it->second.size())) {
+      spdlog::warn("GdbServer: Failed to program flash block at 0x{:08x}.",
+                   it->first);
+      ok = false;
+    }
+  }
+  flashBlocks.clear();
+
+  pkt->packStr(ok ? "OK" : "E01");
+  rsp->putPkt(pkt);
+
+}  // rspFlashDone ()
+
+//-----------------------------------------------------------------------------
+//! Generate the memory map XML document from the declared regions
+
+//! @return  The memory map document
+//-----------------------------------------------------------------------------
+std::string GdbServer::memoryMapXml() {
+  std::string xml =
+      "<?xml version=\"1.0\"?>\n"
+      "<!DOCTYPE memory-map PUBLIC \"+//IDN gnu.org//DTD GDB Memory Map "
+      "V1.0//EN\" \"http://sourceware.org/gdb/gdb-memory-map.dtd\">\n"
+      "<memory-map>\n";
+  char line[160];
+
+  for (size_t i = 0; i < memoryRegions.size(); i++) {
+    const MemoryRegion &r = memoryRegions[i];
+    if (r.isFlash) {
+      snprintf(line, sizeof(line),
+               "  <memory type=\"flash\" start=\"0x%x\" length=\"0x%x\">\n"
+               "    <property name=\"blocksize\">0x%x</property>\n"
+               "  </memory>\n",
+               r.start, r.len, r.blockSize);
+    } else {
+      snprintf(line, sizeof(line),
+               "  <memory type=\"ram\" start=\"0x%x\" length=\"0x%x\"/>\n",
+               r.start, r.len);
+    }
+    xml += line;
+  }
+
+  xml += "</memory-map>\n";
+  return xml;
+
+}  // memoryMapXml ()
+
+//-----------------------------------------------------------------------------
+//! Find the declared flash region holding an address
+
+//! @param[in] addr  The address to look up
+//! @return  The flash region, or NULL if addr is not in flash
+//-----------------------------------------------------------------------------
+const GdbServer::MemoryRegion *GdbServer::findFlashRegion(uint32_t addr) {
+  for (size_t i = 0; i < memoryRegions.size(); i++) {
+    const MemoryRegion &r = memoryRegions[i];
+    if (r.isFlash && (addr >= r.start) && (addr - r.start < r.len)) {
+      return &r;
+    }
+  }
+  return NULL;
+
+}  // findFlashRegion ()
+
+//-----------------------------------------------------------------------------
+//! Handle a RSP read memory (binary) request
+
+//! Syntax is:
+
+//!   x<addr>,<length>
+
+//! The response is 'b' followed by the bytes, lowest address first, as raw
+//! binary. Escaping is done by RspConnection::putPkt (). Response is E<nn> if
+//! error <nn> has occurred.
+
+//! The length given is the number of bytes to be read. Replies may hold fewer
+//! bytes than requested, so large reads are truncated to fit the packet.
+//-----------------------------------------------------------------------------
+void GdbServer::rspReadMemBin() {
+  uint32_t addr;     // Where to read the memory
+  unsigned int len;  // Number of bytes to read
+
+  if (2 != sscanf(pkt->data, "x%x,%x", &addr, &len)) {
+    spdlog::warn("GdbServer: Failed to recognize RSP read memory command: {:s}",
+                 std::string(pkt->data));
+    pkt->packStr("E01");
+    rsp->putPkt(pkt);
+    return;
+  }
+
+  // Make sure we won't overflow the buffer ('b' + data + EOS)
+  if (len > pkt->getBufSize() - 2) {
+    len = pkt->getBufSize() - 2;
+  }
+
+  // Read straight into the packet, after the 'b'
+  pkt->data[0] = 'b';
+  if ((len > 0) &&
+      !readMem((uint8_t *)&(pkt->data[1]), addr, len)) {
+    spdlog::warn("GdbServer: Failed to read {:d} bytes at 0x{:08x}.", len,
+                 addr);
+    pkt->packStr("E01");
+    rsp->putPkt(pkt);
+    return;
+  }
+
+  pkt->data[len + 1] = '\0';  // Not a string, but convenient for tracing
+  pkt->setLen(len + 1);
+  rsp->putPkt(pkt);
+
+}  // rspReadMemBin ()
+
+//-----------------------------------------------------------------------------
+//! Handle a RSP write memory (binary) request
+
+//! Syntax is:
+
+//!   X<addr>,<length>:
+
+//! Followed by the specified number of bytes as raw binary. Response should be
+//! "OK" if all copied OK, E<nn> if error <nn> has occurred.
+
+//! The length given is the number of bytes to be written. The data buffer has
+//! already been unescaped, so will hold this number of bytes.
+
+//! The data is in model-endian format, so no transformation is needed.
+//-----------------------------------------------------------------------------
+void GdbServer::rspWriteMemBin() {
+  uint32_t addr;  // Where to write the memory
+  uint32_t len;   // Number of bytes to write
+
+  if (2 != sscanf(pkt->data, "X%x,%x:", &addr, &len)) {
+    spdlog::warn(
+        "GdbServer: Failed to recognize RSP write memory command: {:s}",
+        std::string(pkt->data));
+    pkt->packStr("E01");
+    rsp->putPkt(pkt);
+    return;
+  }
+
+  // Find the start of the data and "unescape" it. Bindat must be unsigned, or
+  // all sorts of horrible sign extensions will happen when val is computed
+  // below!
+  uint8_t *bindat = (uint8_t *)(memchr(pkt->data, ':', pkt->getBufSize())) + 1;
+  int off = (char *)bindat - pkt->data;
+  int newLen = Utils::rspUnescape((char *)bindat, pkt->getLen() - off);
+
+  // Sanity check
+  std::size_t minLen = std::min((std::size_t)len, (std::size_t)newLen);
+  if (newLen != (int64_t)len) {
     cerr << "Warning: Write of " << len << " bytes requested, but " << newLen
          << " bytes supplied. " << minLen << " will be written" << endl;
-    len = minLen;
   } else if (len == 0) {
     spdlog::warn("Client requested 0-byte write to memory, ignoring.");
     pkt->packStr("OK");
@@ -984,7 +2521,13 @@ void GdbServer::rspWriteMemBin() {
   }
 
   // Write bytes to memory
-  m_simCtrl->writeMem(bindat, addr, len);
+  if (!writeMemCombined(bindat, addr, minLen)) {
+    spdlog::warn("GdbServer: Failed to write {:d} bytes at 0x{:08x}.", minLen,
+                 addr);
+    pkt->packStr("E01");
+    rsp->putPkt(pkt);
+    return;
+  }
 
   pkt->packStr("OK");
   rsp->putPkt(pkt);
@@ -998,10 +2541,10 @@ void GdbServer::rspRemoveMatchpoint() {
   MpType type;     // What sort of matchpoint
   uint32_t addr;   // Address specified
   uint32_t instr;  // Instruction value found
-  int len;         // Matchpoint length (not used)
+  uint32_t len;    // Matchpoint length
 
   // Break out the instruction
-  if (3 != sscanf(pkt->data, "z%1d,%x,%1d", (int *)&type, &addr, &len)) {
+  if (3 != sscanf(pkt->data, "z%1d,%x,%x", (int *)&type, &addr, &len)) {
     cerr << "Warning: RSP matchpoint deletion request not "
          << "recognized: ignored" << endl;
     pkt->packStr("E01");
@@ -1009,8 +2552,9 @@ void GdbServer::rspRemoveMatchpoint() {
     return;
   }
 
-  // Sanity check that the length is 2
-  if (2 != len) {
+  // Sanity check that a breakpoint's length is 2. Watchpoints can be any
+  // length.
+  if ((type < WP_WRITE) && (2 != len)) {
     cerr << "Warning: RSP matchpoint deletion length " << len
          << "not valid: 2 assumed" << endl;
     len = 2;
@@ -1020,30 +2564,31 @@ void GdbServer::rspRemoveMatchpoint() {
   switch (type) {
     case BP_MEMORY:
       //        pkt->packStr ("");		// Not supported
-      m_simCtrl->removeBreakpoint(addr);
+      breakpoints.erase(addr);
+      if (!isTracepoint(addr)) {  // Otherwise the tracepoint still needs it
+        for (size_t i = 0; i < cores.size(); i++) {
+          cores[i].simCtrl->removeBreakpoint(addr);
+        }
+      }
       pkt->packStr("OK");
       rsp->putPkt(pkt);
       return;
 
     case BP_HARDWARE:
-      m_simCtrl->removeBreakpoint(addr);
+      breakpoints.erase(addr);
+      if (!isTracepoint(addr)) {  // Otherwise the tracepoint still needs it
+        for (size_t i = 0; i < cores.size(); i++) {
+          cores[i].simCtrl->removeBreakpoint(addr);
+        }
+      }
       pkt->packStr("OK");
       rsp->putPkt(pkt);
       return;
 
     case WP_WRITE:
-      pkt->packStr("");  // Not supported
-      rsp->putPkt(pkt);
-      return;
-
     case WP_READ:
-      pkt->packStr("");  // Not supported
-      rsp->putPkt(pkt);
-      return;
-
     case WP_ACCESS:
-      pkt->packStr("");  // Not supported
-      rsp->putPkt(pkt);
+      rspWatchpoint(false, type, addr, len);
       return;
 
     default:
@@ -1058,17 +2603,18 @@ void GdbServer::rspRemoveMatchpoint() {
 //---------------------------------------------------------------------------*/
 //! Handle a RSP insert breakpoint or matchpoint request
 
-//! For now only memory breakpoints are implemented, which are implemented by
-//! substituting a breakpoint at the specified address. The implementation must
-//! cope with the possibility of duplicate packets.
+//! Breakpoints are implemented by substituting a breakpoint at the specified
+//! address, and watchpoints are passed on to the simulator. The
+//! implementation must cope with the possibility of duplicate packets: GDB
+//! also repeats a breakpoint's Z packet when its conditions change.
 //---------------------------------------------------------------------------*/
 void GdbServer::rspInsertMatchpoint() {
   MpType type;    // What sort of matchpoint
   uint32_t addr;  // Address specified
-  int len;        // Matchpoint length (not used)
+  uint32_t len;   // Matchpoint length
 
   // Break out the instruction
-  if (3 != sscanf(pkt->data, "Z%1d,%x,%1d", (int *)&type, &addr, &len)) {
+  if (3 != sscanf(pkt->data, "Z%1d,%x,%x", (int *)&type, &addr, &len)) {
     cerr << "Warning: RSP matchpoint insertion request not "
          << "recognized: ignored" << endl;
     pkt->packStr("E01");
@@ -1076,40 +2622,48 @@ void GdbServer::rspInsertMatchpoint() {
     return;
   }
 
-  // Sanity check that the length is 2
-  if (2 != len) {
+  // Sanity check that a breakpoint's length is 2. Watchpoints can be any
+  // length.
+  if ((type < WP_WRITE) && (2 != len)) {
     cerr << "Warning: RSP matchpoint insertion length " << len
          << "not valid: 2 assumed" << endl;
     len = 2;
   }
 
+  // Any conditions for a breakpoint. GDB also evaluates the condition itself
+  // when told of a hit, so conditions we can't handle are dropped and every
+  // hit is reported.
+  std::vector<AgentExpr> conds;
+  if ((type < WP_WRITE) && !parseConditions(strchr(pkt->data, ';'), &conds)) {
+    spdlog::warn("GdbServer: breakpoint condition not supported: {:s}",
+                 pkt->data);
+    conds.clear();
+  }
+
   // Sort out the type of matchpoint
   switch (type) {
     case BP_MEMORY:
-      m_simCtrl->insertBreakpoint(addr);
+      breakpoints[addr] = conds;
+      for (size_t i = 0; i < cores.size(); i++) {
+        cores[i].simCtrl->insertBreakpoint(addr);
+      }
       pkt->packStr("OK");
       rsp->putPkt(pkt);
       return;
 
     case BP_HARDWARE:
-      m_simCtrl->insertBreakpoint(addr);
+      breakpoints[addr] = conds;
+      for (size_t i = 0; i < cores.size(); i++) {
+        cores[i].simCtrl->insertBreakpoint(addr);
+      }
       pkt->packStr("OK");
       rsp->putPkt(pkt);
       return;
 
     case WP_WRITE:
-      pkt->packStr("");  // Not supported
-      rsp->putPkt(pkt);
-      return;
-
     case WP_READ:
-      pkt->packStr("");  // Not supported
-      rsp->putPkt(pkt);
-      return;
-
     case WP_ACCESS:
-      pkt->packStr("");  // Not supported
-      rsp->putPkt(pkt);
+      rspWatchpoint(true, type, addr, len);
       return;
 
     default:
@@ -1120,3 +2674,861 @@ void GdbServer::rspInsertMatchpoint() {
       return;
   }
 }  // rspInsertMatchpoint ()
+
+//-----------------------------------------------------------------------------
+//! Parse the conditions of a breakpoint
+
+//! Syntax, following the address and kind of a Z0 or Z1 packet, is:
+
+//!   ;Xlen,expr[Xlen,expr]...[;cmds:...]
+
+//! where each expr is agent expression bytecode of len bytes, in hex. Target
+//! side commands are not supported (and not asked for), so are ignored.
+
+//! @param[in]  str    The rest of the packet from the first ';', or NULL
+//! @param[out] conds  The compiled conditions
+//! @return  TRUE if the conditions were all understood
+//-----------------------------------------------------------------------------
+bool GdbServer::parseConditions(const char *str,
+                                std::vector<AgentExpr> *conds) {
+  conds->clear();
+  if (NULL == str) {
+    return true;
+  }
+
+  str++;  // Skip the ';'
+  while ('X' == *str) {
+    AgentExpr expr;
+    if (!parseAgentExpr(str, &expr, &str)) {
+      return false;
+    }
+    conds->push_back(expr);
+  }
+
+  return ('\0' == *str) || (0 == strncmp(str, ";cmds:", strlen(";cmds:"))) ||
+         (0 == strncmp(str, "cmds:", strlen("cmds:")));
+
+}  // parseConditions ()
+
+//-----------------------------------------------------------------------------
+//! Parse and compile one agent expression
+
+//! Syntax is:
+
+//!   Xlen,expr
+
+//! where expr is len bytes of bytecode, in hex. The length is checked
+//! against the digits actually present, and against the packet size, before
+//! anything is allocated for it.
+
+//! @param[in]  str   The expression, from the 'X'
+//! @param[out] expr  The compiled expression
+//! @param[out] next  The first character after the expression
+//! @return  TRUE if the expression was understood
+//-----------------------------------------------------------------------------
+bool GdbServer::parseAgentExpr(const char *str, AgentExpr *expr,
+                               const char **next) {
+  char *end;
+  unsigned long len = strtoul(str + 1, &end, 16);
+  if ((',' != *end) || (len > (unsigned long)pktSize) ||
+      (len > strlen(end + 1) / 2)) {
+    return false;
+  }
+
+  if (!expr->compileHex(end + 1, len)) {
+    return false;
+  }
+  *next = end + 1 + 2 * len;
+  return true;
+
+}  // parseAgentExpr ()
+
+//-----------------------------------------------------------------------------
+//! Insert or remove a watchpoint on every core
+
+//! If no core will insert the watchpoint, the empty reply tells GDB to use
+//! software watchpoints instead. If only some cores accept the change, it is
+//! undone on the others.
+
+//! @param[in] insert  TRUE to insert, FALSE to remove
+//! @param[in] type    WP_WRITE, WP_READ or WP_ACCESS
+//! @param[in] addr    Start address
+//! @param[in] len     Number of bytes watched
+//-----------------------------------------------------------------------------
+void GdbServer::rspWatchpoint(bool insert, MpType type, uint32_t addr,
+                              uint32_t len) {
+  SimulationControlInterface::WatchType wt =
+      (SimulationControlInterface::WatchType)type;
+  size_t done;
+
+  for (done = 0; done < cores.size(); done++) {
+    SimulationControlInterface *simCtrl = cores[done].simCtrl;
+    bool ok = insert ? simCtrl->insertWatchpoint(wt, addr, len)
+                     : simCtrl->removeWatchpoint(wt, addr, len);
+    if (!ok) {
+      break;
+    }
+  }
+
+  if (cores.size() == done) {
+    pkt->packStr("OK");
+  } else if (insert && (0 == done)) {
+    pkt->packStr("");  // Not supported
+  } else {
+    spdlog::warn("GdbServer: watchpoint at {:#x} not accepted by core {:d}.",
+                 addr, done);
+    for (size_t i = 0; i < done; i++) {
+      SimulationControlInterface *simCtrl = cores[i].simCtrl;
+      if (insert) {
+        simCtrl->removeWatchpoint(wt, addr, len);
+      } else {
+        simCtrl->insertWatchpoint(wt, addr, len);
+      }
+    }
+    pkt->packStr("E01");
+  }
+  rsp->putPkt(pkt);
+
+}  // rspWatchpoint ()
+
+//-----------------------------------------------------------------------------
+//! Read the program counter
+
+//! @return  The value of the PC
+//-----------------------------------------------------------------------------
+uint32_t GdbServer::readNpc() {
+  return readGpr(m_simCtrl->pcRegNum());
+
+}  // readNpc ()
+
+//-----------------------------------------------------------------------------
+//! Write the program counter
+
+//! @param[in] addr  The new value of the PC
+//-----------------------------------------------------------------------------
+void GdbServer::writeNpc(uint32_t addr) {
+  writeGpr(m_simCtrl->pcRegNum(), addr);
+
+}  // writeNpc ()
+
+//-----------------------------------------------------------------------------
+//! Read a general purpose register
+
+//! The first read after the target stops snapshots the whole register file
+//! with a single simulator transaction. Later reads are served from the
+//! snapshot until the target runs again. Registers beyond nRegs () are always
+//! read from the simulator.
+
+//! @param[in] regNum  The register to read
+//! @return  The value of the register
+//-----------------------------------------------------------------------------
+uint32_t GdbServer::readGpr(int regNum) {
+  uint32_t nRegs = m_simCtrl->nRegs();
+  Core &core = cores[gCore];
+
+  if ((regNum < 0) || (regNum >= nRegs)) {
+    return m_simCtrl->readReg(regNum);
+  }
+
+  if (!core.regCacheValid) {
+    core.regCache.resize(nRegs);
+    m_simCtrl->readRegs(core.regCache.data(), 0, nRegs);
+    core.regCacheValid = true;
+  }
+
+  return core.regCache[regNum];
+
+}  // readGpr ()
+
+//-----------------------------------------------------------------------------
+//! Write a general purpose register
+
+//! Written through to the simulator and to the register snapshot.
+
+//! @param[in] regNum  The register to write
+//! @param[in] value   The value to write
+//-----------------------------------------------------------------------------
+void GdbServer::writeGpr(int regNum, uint32_t value) {
+  Core &core = cores[gCore];
+
+  m_simCtrl->writeReg(regNum, value);
+
+  if (core.regCacheValid && (regNum >= 0) &&
+      (regNum < core.regCache.size())) {
+    core.regCache[regNum] = value;
+  }
+
+}  // writeGpr ()
+
+//-----------------------------------------------------------------------------
+//! Drop the register snapshots and memory caches of every core
+
+//! Must be called before the target is allowed to run (continue, step,
+//! detach, restart), since anything cached may then change.
+//-----------------------------------------------------------------------------
+void GdbServer::invalidateCaches() {
+  for (size_t i = 0; i < cores.size(); i++) {
+    cores[i].regCacheValid = false;
+    cores[i].memCache->invalidate();
+  }
+
+}  // invalidateCaches ()
+
+//-----------------------------------------------------------------------------
+//! Read memory for the selected core
+
+//! Memory is only cached while the whole target is stopped. In non-stop mode
+//! running cores may change it at any time. While a trace frame is selected,
+//! memory is read from the frame.
+
+//! @param[out] out   Where to put the data
+//! @param[in]  addr  Address to read from
+//! @param[in]  len   Number of bytes to read
+
+//! @return  TRUE on success, FALSE if the simulator rejected the read
+//-----------------------------------------------------------------------------
+bool GdbServer::readMem(uint8_t *out, uint32_t addr, std::size_t len) {
+  if (traceFrame >= 0) {
+    return readTraceMem(out, addr, len);
+  }
+  if (!targetStopped) {
+    return m_simCtrl->readMem(out, addr, len);
+  }
+  return memCache->read(out, addr, len);
+
+}  // readMem ()
+
+//-----------------------------------------------------------------------------
+//! Write memory through the selected core's cache
+
+//! The cores may share memory, so the range is dropped from every other
+//! core's cache.
+
+//! @param[in] src   The data to write
+//! @param[in] addr  Address to write to
+//! @param[in] len   Number of bytes to write
+
+//! @return  TRUE on success, FALSE if the simulator rejected the write
+//-----------------------------------------------------------------------------
+bool GdbServer::writeMem(uint8_t *src, uint32_t addr, std::size_t len) {
+  bool ok = memCache->write(src, addr, len);
+
+  for (size_t i = 0; i < cores.size(); i++) {
+    if ((int)i != gCore) {
+      cores[i].memCache->invalidate(addr, len);
+    }
+  }
+  return ok;
+
+}  // writeMem ()
+
+//-----------------------------------------------------------------------------
+//! Write memory via the write-combining buffer
+
+//! If write combining is enabled, a write continuing the staged range is
+//! appended to it. Anything else flushes the staged range first. Writes
+//! larger than the buffer go straight through.
+
+//! @param[in] src   The data to write
+//! @param[in] addr  Address to write to
+//! @param[in] len   Number of bytes to write
+
+//! @return  TRUE on success, FALSE if this write or the flush it triggered
+//!          was rejected by the simulator
+//-----------------------------------------------------------------------------
+bool GdbServer::writeMemCombined(uint8_t *src, uint32_t addr,
+                                 std::size_t len) {
+  if (wcBuf.empty()) {
+    return writeMem(src, addr, len);
+  }
+
+  // Flush if the range breaks or the write won't fit
+  if ((wcLen > 0) &&
+      ((addr != wcAddr + wcLen) || (wcLen + len > wcBuf.size()))) {
+    if (!flushWriteCombine()) {
+      return false;
+    }
+  }
+
+  if (len > wcBuf.size()) {
+    return writeMem(src, addr, len);
+  }
+
+  if (0 == wcLen) {
+    wcAddr = addr;
+  }
+  memcpy(&wcBuf[wcLen], src, len);
+  wcLen += len;
+
+  return (wcLen < wcBuf.size()) ? true : flushWriteCombine();
+
+}  // writeMemCombined ()
+
+//-----------------------------------------------------------------------------
+//! Write anything staged in the write-combining buffer to the simulator
+
+//! @return  TRUE on success (or nothing to do), FALSE if the simulator
+//!          rejected the write
+//-----------------------------------------------------------------------------
+bool GdbServer::flushWriteCombine() {
+  if (0 == wcLen) {
+    return true;
+  }
+
+  std::size_t len = wcLen;
+  wcLen = 0;
+  if (!writeMem(wcBuf.data(), wcAddr, len)) {
+    spdlog::warn("GdbServer: Failed to write {:d} combined bytes at 0x{:08x}.",
+                 len, wcAddr);
+    return false;
+  }
+  return true;
+
+}  // flushWriteCombine ()
+
+//-----------------------------------------------------------------------------
+//! Handle a RSP define tracepoint request
+
+//! Syntax is one of:
+
+//!   QTDP:n:addr:ena:step:pass[:Xlen,cond][-]
+//!   QTDP:-n:addr:actions[-]
+
+//! The first defines tracepoint n at addr, enabled if ena is 'E', which
+//! stops tracing after pass hits (0 for never). The second adds collection
+//! actions to it. A trailing '-' means more actions follow.
+//-----------------------------------------------------------------------------
+void GdbServer::rspTraceDefine() {
+  if (tracing) {
+    spdlog::warn("GdbServer: tracepoint defined while tracing: ignored.");
+    pkt->packStr("E01");
+  } else if (parseTracepoint(pkt->data + strlen("QTDP:"))) {
+    pkt->packStr("OK");
+  } else {
+    spdlog::warn("GdbServer: RSP tracepoint definition not recognized: {:s}",
+                 pkt->data);
+    pkt->packStr("E01");
+  }
+  rsp->putPkt(pkt);
+
+}  // rspTraceDefine ()
+
+//-----------------------------------------------------------------------------
+//! Parse a tracepoint definition, or more actions for one
+
+//! @param[in] str  The QTDP packet after "QTDP:"
+//! @return  TRUE if the definition was understood and stored
+//-----------------------------------------------------------------------------
+bool GdbServer::parseTracepoint(const char *str) {
+  bool more = ('-' == *str);
+  char *end;
+
+  Tracepoint tp;
+  tp.num = strtoul(more ? str + 1 : str, &end, 16);
+  if (':' != *end) {
+    return false;
+  }
+  tp.addr = strtoull(end + 1, &end, 16);
+  if (':' != *end) {
+    return false;
+  }
+  str = end + 1;
+
+  // Actions for a tracepoint we already have
+  if (more) {
+    for (size_t i = 0; i < tracepoints.size(); i++) {
+      if ((tracepoints[i].num == tp.num) && (tracepoints[i].addr == tp.addr)) {
+        return parseTraceActions(&tracepoints[i], str);
+      }
+    }
+    return false;
+  }
+
+  if ((('E' != str[0]) && ('D' != str[0])) || (':' != str[1])) {
+    return false;
+  }
+  tp.enabled = ('E' == str[0]);
+  strtoul(str + 2, &end, 16);  // Step count: while-stepping is not supported
+  if (':' != *end) {
+    return false;
+  }
+  tp.passCount = strtoul(end + 1, &end, 16);
+  tp.hits = 0;
+  tp.hasCond = false;
+  tp.collectRegs = false;
+
+  str = end;
+  while (':' == *str) {
+    str++;
+    if ('X' == *str) {
+      if (!parseAgentExpr(str, &tp.cond, &str)) {
+        return false;
+      }
+      tp.hasCond = true;
+    } else if ('F' == *str) {
+      // Fast tracepoint: all of ours are as fast as they get
+      strtoul(str + 1, &end, 16);
+      str = end;
+    } else if ('S' == *str) {
+      str++;  // Static tracepoint: treated as a normal one
+    } else {
+      return false;
+    }
+  }
+
+  if ('-' == *str) {
+    str++;  // Actions follow
+  }
+  if ('\0' != *str) {
+    return false;
+  }
+
+  // A new definition replaces any old one
+  for (size_t i = 0; i < tracepoints.size(); i++) {
+    if ((tracepoints[i].num == tp.num) && (tracepoints[i].addr == tp.addr)) {
+      tracepoints[i] = tp;
+      return true;
+    }
+  }
+  tracepoints.push_back(tp);
+  return true;
+
+}  // parseTracepoint ()
+
+//-----------------------------------------------------------------------------
+//! Parse the collection actions of a tracepoint
+
+//! Each action is one of:
+
+//!   Rmask                  registers (any register collects them all)
+//!   Mbasereg,offset,len    memory, relative to a register unless basereg is
+//!                          -1 (sent as ffffffff)
+//!   Xlen,expr              memory named by an agent expression
+
+//! Actions starting with 'S' are done while stepping from the tracepoint,
+//! which is not supported, so they are ignored.
+
+//! @param[in] tp   The tracepoint
+//! @param[in] str  The actions
+//! @return  TRUE if the actions were understood
+//-----------------------------------------------------------------------------
+bool GdbServer::parseTraceActions(Tracepoint *tp, const char *str) {
+  if ('S' == *str) {
+    spdlog::warn("GdbServer: while-stepping actions not supported: ignored.");
+    return true;
+  }
+
+  while (('\0' != *str) && ('-' != *str)) {
+    char *end;
+
+    if ('R' == *str) {
+      for (str++; Utils::char2Hex(*str) <= 0xf; str++) {
+        if ('0' != *str) {
+          tp->collectRegs = true;
+        }
+      }
+    } else if ('M' == *str) {
+      Tracepoint::MemRange range;
+      range.baseReg = (int)strtoul(str + 1, &end, 16);
+      if (',' != *end) {
+        return false;
+      }
+      range.offset = strtoull(end + 1, &end, 16);
+      if (',' != *end) {
+        return false;
+      }
+      range.len = strtoul(end + 1, &end, 16);
+      tp->memRanges.push_back(range);
+      str = end;
+    } else if ('X' == *str) {
+      AgentExpr expr;
+      if (!parseAgentExpr(str, &expr, &str)) {
+        return false;
+      }
+      tp->exprs.push_back(expr);
+    } else {
+      return false;
+    }
+  }
+
+  return ('\0' == *str) || (0 == strcmp("-", str));
+
+}  // parseTraceActions ()
+
+//-----------------------------------------------------------------------------
+//! Handle a RSP start tracing request
+
+//! The trace buffer is emptied (and resized if the client asked for a new
+//! size), and a breakpoint is inserted at every enabled tracepoint.
+//-----------------------------------------------------------------------------
+void GdbServer::rspTraceStart() {
+  if (tracing) {
+    stopTracing("tstop::0");
+  }
+
+  if (traceBuf->size() != traceBufSize) {
+    if (!traceBuf->resize(traceBufSize)) {
+      spdlog::warn("GdbServer: Cannot allocate a {:d} byte trace buffer.",
+                   traceBufSize);
+      pkt->packStr("E01");
+      rsp->putPkt(pkt);
+      return;
+    }
+  } else {
+    traceBuf->clear();
+  }
+  for (size_t i = 0; i < tracepoints.size(); i++) {
+    tracepoints[i].hits = 0;
+  }
+
+  traceFrame = -1;
+  tracing = true;
+  traceStopReason = "tunknown:0";
+  insertTracepoints(true);
+
+  pkt->packStr("OK");
+  rsp->putPkt(pkt);
+
+}  // rspTraceStart ()
+
+//-----------------------------------------------------------------------------
+//! Stop tracing
+
+//! @param[in] reason  Why, as reported by qTStatus
+//-----------------------------------------------------------------------------
+void GdbServer::stopTracing(const std::string &reason) {
+  insertTracepoints(false);
+  tracing = false;
+  traceStopReason = reason;
+
+}  // stopTracing ()
+
+//-----------------------------------------------------------------------------
+//! Insert or remove the breakpoints that trigger the enabled tracepoints
+
+//! Addresses where the client also has a breakpoint are left alone.
+
+//! @param[in] insert  TRUE to insert, FALSE to remove
+//-----------------------------------------------------------------------------
+void GdbServer::insertTracepoints(bool insert) {
+  for (size_t t = 0; t < tracepoints.size(); t++) {
+    uint32_t addr = tracepoints[t].addr;
+    if (!tracepoints[t].enabled || (breakpoints.count(addr) > 0)) {
+      continue;
+    }
+
+    for (size_t i = 0; i < cores.size(); i++) {
+      if (insert) {
+        cores[i].simCtrl->insertBreakpoint(addr);
+      } else {
+        cores[i].simCtrl->removeBreakpoint(addr);
+      }
+    }
+  }
+
+}  // insertTracepoints ()
+
+//-----------------------------------------------------------------------------
+//! Is there an enabled tracepoint at an address, while tracing
+//-----------------------------------------------------------------------------
+bool GdbServer::isTracepoint(uint32_t addr) {
+  for (size_t t = 0; tracing && (t < tracepoints.size()); t++) {
+    if (tracepoints[t].enabled && (tracepoints[t].addr == addr)) {
+      return true;
+    }
+  }
+  return false;
+
+}  // isTracepoint ()
+
+//-----------------------------------------------------------------------------
+//! Collect a trace frame for each tracepoint at a core's PC
+
+//! Each enabled tracepoint at the PC whose condition holds collects a frame.
+//! Tracing stops when the trace buffer is full or a tracepoint's pass count
+//! is reached.
+
+//! @param[in] core  The core, stalled at the PC
+//! @param[in] pc    The core's PC
+//! @return  TRUE if there is a tracepoint at the PC (whether or not it
+//!          collected anything)
+//-----------------------------------------------------------------------------
+bool GdbServer::collectTraceFrame(int core, uint32_t pc) {
+  SimulationControlInterface *simCtrl = cores[core].simCtrl;
+  bool found = false;
+
+  for (size_t t = 0; tracing && (t < tracepoints.size()); t++) {
+    Tracepoint &tp = tracepoints[t];
+    uint64_t value;
+
+    if (!tp.enabled || (tp.addr != pc)) {
+      continue;
+    }
+    found = true;
+    if (tp.hasCond && (!tp.cond.evaluate(simCtrl, &value) || (0 == value))) {
+      continue;
+    }
+    tp.hits++;
+
+    traceBuf->startFrame(tp.num, pc);
+    if (tp.collectRegs) {
+      regBuf.resize(simCtrl->nRegs());
+      simCtrl->readRegs(regBuf.data(), 0, regBuf.size());
+      traceBuf->addRegisters(regBuf.data(), regBuf.size());
+    }
+
+    // Work out all the memory to collect, then collect it
+    traceBlocks.clear();
+    for (size_t i = 0; i < tp.memRanges.size(); i++) {
+      const Tracepoint::MemRange &range = tp.memRanges[i];
+      uint32_t base = 0;
+      if (range.baseReg >= 0) {
+        if ((uint32_t)range.baseReg >= simCtrl->nRegs()) {
+          continue;
+        }
+        base = simCtrl->readReg(range.baseReg);
+      }
+      AgentExpr::Block blk = {(uint32_t)(base + range.offset), range.len};
+      traceBlocks.push_back(blk);
+    }
+    for (size_t i = 0; i < tp.exprs.size(); i++) {
+      tp.exprs[i].evaluate(simCtrl, &value, &traceBlocks);
+    }
+
+    for (size_t i = 0; i < traceBlocks.size(); i++) {
+      const AgentExpr::Block &blk = traceBlocks[i];
+      if ((0 == blk.len) || (blk.len > traceBuf->size()) ||
+          (blk.addr + blk.len - 1 > UINT32_MAX)) {
+        continue;
+      }
+      traceScratch.resize(blk.len);
+      if (simCtrl->readMem(traceScratch.data(), blk.addr, blk.len)) {
+        traceBuf->addMemory(blk.addr, traceScratch.data(), blk.len);
+      }
+    }
+
+    if (!traceBuf->commitFrame()) {
+      stopTracing("tfull:0");
+    } else if ((0 != tp.passCount) && (tp.hits >= tp.passCount)) {
+      char reason[32];
+      sprintf(reason, "tpasscount:%x", tp.num);
+      stopTracing(reason);
+    }
+  }
+
+  return found;
+
+}  // collectTraceFrame ()
+
+//-----------------------------------------------------------------------------
+//! Handle a RSP trace status query
+
+//! The reply is:
+
+//!   T<running>;<stop reason>;tframes:<n>;tcreated:<n>;tfree:<n>;tsize:<n>;
+//!   circular:<0|1>;disconn:0
+//-----------------------------------------------------------------------------
+void GdbServer::rspTraceStatus() {
+  // Until tracing first starts, report the size the buffer will be
+  std::size_t size = traceBuf->size();
+  std::size_t bytesFree = traceBuf->bytesFree();
+  if (0 == size) {
+    size = traceBufSize;
+    bytesFree = traceBufSize;
+  }
+
+  int len = snprintf(pkt->data, pkt->getBufSize(),
+                     "T%d;%s;tframes:%x;tcreated:%x;tfree:%x;tsize:%x;"
+                     "circular:%d;disconn:0",
+                     tracing ? 1 : 0, traceStopReason.c_str(),
+                     (unsigned int)traceBuf->frameCount(),
+                     (unsigned int)traceBuf->framesCreated(),
+                     (unsigned int)bytesFree, (unsigned int)size,
+                     traceBuf->isCircular() ? 1 : 0);
+  pkt->setLen(len);
+  rsp->putPkt(pkt);
+
+}  // rspTraceStatus ()
+
+//-----------------------------------------------------------------------------
+//! Handle a RSP select trace frame request
+
+//! Syntax is one of:
+
+//!   QTFrame:n                 frame n (ffffffff for none: the live target)
+//!   QTFrame:pc:addr           next frame at addr
+//!   QTFrame:tdp:t             next frame of tracepoint t
+//!   QTFrame:range:start:end   next frame in [start, end]
+//!   QTFrame:outside:start:end next frame outside [start, end]
+
+//! "Next" means after the selected frame. The reply is F<frame>T<tracepoint>
+//! or, if there is no such frame, F-1, and the live target is selected.
+//-----------------------------------------------------------------------------
+void GdbServer::rspTraceFrame() {
+  const char *arg = pkt->data + strlen("QTFrame:");
+  int nFrames = traceBuf->frameCount();
+  int found = -1;
+  char *end;
+
+  if (0 == strncmp("pc:", arg, strlen("pc:"))) {
+    uint32_t addr = strtoul(arg + strlen("pc:"), NULL, 16);
+    for (int i = traceFrame + 1; (found < 0) && (i < nFrames); i++) {
+      found = (traceBuf->framePc(i) == addr) ? i : -1;
+    }
+  } else if (0 == strncmp("tdp:", arg, strlen("tdp:"))) {
+    uint32_t num = strtoul(arg + strlen("tdp:"), NULL, 16);
+    for (int i = traceFrame + 1; (found < 0) && (i < nFrames); i++) {
+      found = (traceBuf->frameTracepoint(i) == num) ? i : -1;
+    }
+  } else if ((0 == strncmp("range:", arg, strlen("range:"))) ||
+             (0 == strncmp("outside:", arg, strlen("outside:")))) {
+    bool inside = ('r' == arg[0]);
+    uint32_t start = strtoul(strchr(arg, ':') + 1, &end, 16);
+    uint32_t last = (':' == *end) ? strtoul(end + 1, NULL, 16) : start;
+    for (int i = traceFrame + 1; (found < 0) && (i < nFrames); i++) {
+      uint32_t pc = traceBuf->framePc(i);
+      found = (((pc >= start) && (pc <= last)) == inside) ? i : -1;
+    }
+  } else {
+    unsigned long n = strtoul(arg, NULL, 16);
+    found = (n < (unsigned long)nFrames) ? n : -1;
+  }
+
+  traceFrame = found;
+  if (found < 0) {
+    pkt->packStr("F-1");
+  } else {
+    sprintf(pkt->data, "F%xT%x", found, traceBuf->frameTracepoint(found));
+    pkt->setLen(strlen(pkt->data));
+  }
+  rsp->putPkt(pkt);
+
+}  // rspTraceFrame ()
+
+//-----------------------------------------------------------------------------
+//! Handle a RSP tracepoint status query
+
+//! Syntax is qTP:n:addr, and the reply is V<hits>:<bytes used>. We don't
+//! keep track of the bytes used, so report 0.
+//-----------------------------------------------------------------------------
+void GdbServer::rspTracepointStatus() {
+  char *end;
+  uint32_t num = strtoul(pkt->data + strlen("qTP:"), &end, 16);
+  uint32_t addr = (':' == *end) ? strtoull(end + 1, NULL, 16) : 0;
+
+  pkt->packStr("");  // Not one of ours
+  for (size_t i = 0; i < tracepoints.size(); i++) {
+    if ((tracepoints[i].num == num) && (tracepoints[i].addr == addr)) {
+      sprintf(pkt->data, "V%x:0", tracepoints[i].hits);
+      pkt->setLen(strlen(pkt->data));
+      break;
+    }
+  }
+  rsp->putPkt(pkt);
+
+}  // rspTracepointStatus ()
+
+//-----------------------------------------------------------------------------
+//! Handle a RSP trace buffer request
+
+//! Syntax is QTBuffer:circular:<0|1> or QTBuffer:size:<n>, where a size of
+//! -1 asks for the default. A new size takes effect when tracing next starts.
+//-----------------------------------------------------------------------------
+void GdbServer::rspTraceBuffer() {
+  const char *arg = pkt->data + strlen("QTBuffer:");
+
+  if (0 == strncmp("circular:", arg, strlen("circular:"))) {
+    traceBuf->setCircular(0 != strtoul(arg + strlen("circular:"), NULL, 16));
+    pkt->packStr("OK");
+  } else if (0 == strncmp("size:", arg, strlen("size:"))) {
+    arg += strlen("size:");
+    unsigned long size = ('-' == *arg) ? TraceBuffer::DEFAULT_SIZE
+                                       : strtoul(arg, NULL, 16);
+    if (size > TraceBuffer::MAX_SIZE) {
+      spdlog::warn("GdbServer: Trace buffer size {:d} over the limit of {:d}.",
+                   size, TraceBuffer::MAX_SIZE);
+      pkt->packStr("E01");
+    } else {
+      traceBufSize = size;
+      pkt->packStr("OK");
+    }
+  } else {
+    pkt->packStr("");
+  }
+  rsp->putPkt(pkt);
+
+}  // rspTraceBuffer ()
+
+//-----------------------------------------------------------------------------
+//! Read memory from the selected trace frame
+
+//! Memory that was not collected is unavailable, except in the read-only
+//! sections, which are read from the target.
+
+//! @param[out] out   Where to put the data
+//! @param[in]  addr  Address to read from
+//! @param[in]  len   Number of bytes to read
+
+//! @return  TRUE if every byte was available
+//-----------------------------------------------------------------------------
+bool GdbServer::readTraceMem(uint8_t *out, uint32_t addr, std::size_t len) {
+  std::size_t done = 0;
+
+  if (traceFrame >= (int)traceBuf->frameCount()) {
+    return false;  // Dropped from a circular buffer since it was selected
+  }
+
+  while (done < len) {
+    uint64_t next = (uint64_t)addr + done;
+    std::size_t n =
+        traceBuf->readMemory(traceFrame, next, out + done, len - done);
+    if (0 == n) {
+      for (size_t i = 0; i < traceReadOnly.size(); i++) {
+        if ((next >= traceReadOnly[i].first) &&
+            (next < traceReadOnly[i].second)) {
+          n = std::min((std::size_t)(traceReadOnly[i].second - next),
+                       len - done);
+          if (!m_simCtrl->readMem(out + done, next, n)) {
+            return false;
+          }
+          break;
+        }
+      }
+    }
+    if (0 == n) {
+      return false;
+    }
+    done += n;
+  }
+
+  return true;
+
+}  // readTraceMem ()
+
+//-----------------------------------------------------------------------------
+//! Pack a register from the selected trace frame as hex
+
+//! Registers that were not collected are packed as "xxxxxxxx", meaning
+//! unavailable, except for the PC, which is the tracepoint address.
+
+//! @param[in]  regNum  The register
+//! @param[out] buf     Where to put the 8 hex digits
+//-----------------------------------------------------------------------------
+void GdbServer::packTraceReg(int regNum, char *buf) {
+  uint32_t value;
+  bool valid = (traceFrame < (int)traceBuf->frameCount()) &&
+               traceBuf->readRegister(traceFrame, regNum, &value);
+
+  if (!valid && (traceFrame < (int)traceBuf->frameCount()) &&
+      ((uint32_t)regNum == m_simCtrl->pcRegNum())) {
+    value = traceBuf->framePc(traceFrame);
+    valid = true;
+  }
+
+  if (valid) {
+    Utils::reg2Hex(m_simCtrl->htotl(value), buf);
+  } else {
+    memset(buf, 'x', 8);
+  }
+
+}  // packTraceReg ()
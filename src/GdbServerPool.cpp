@@ -0,0 +1,411 @@
+/*
+ * Copyright (c) 2019-2020, University of Southampton and Contributors.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <spdlog/spdlog.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <gdb-server/GdbServerPool.hpp>
+
+const int GdbServerPool::MAX_EVENTS;
+const int GdbServerPool::STALL_POLL_INTERVAL;
+
+GdbServerPool::GdbServerPool() : running(false), stopRequested(false) {
+  epollFd = epoll_create1(EPOLL_CLOEXEC);
+  wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if ((epollFd < 0) || (wakeFd < 0)) {
+    spdlog::error("GdbServerPool: Cannot create event loop: {:s}",
+                  strerror(errno));
+    return;
+  }
+
+  wakeSource.type = SRC_WAKE;
+  wakeSource.session = NULL;
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.ptr = &wakeSource;
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &ev);
+}
+
+GdbServerPool::~GdbServerPool() {
+  applyPending();
+  while (!sessions.empty()) {
+    retire(sessions.begin()->second);
+  }
+  for (size_t i = 0; i < retired.size(); i++) {
+    delete retired[i];
+  }
+
+  if (wakeFd >= 0) {
+    close(wakeFd);
+  }
+  if (epollFd >= 0) {
+    close(epollFd);
+  }
+}
+
+bool GdbServerPool::addServer(GdbServer *server) {
+  if (!server->rsp->rspListen()) {
+    return false;
+  }
+  server->serverStart();
+
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    pendingAdd.push_back(server);
+  }
+  wake();
+  return true;
+}
+
+void GdbServerPool::removeServer(GdbServer *server) {
+  std::unique_lock<std::mutex> guard(lock);
+  pendingRemove.push_back(server);
+
+  if (!running) {
+    // Nobody else will do it
+    guard.unlock();
+    applyPending();
+    for (size_t i = 0; i < retired.size(); i++) {
+      delete retired[i];
+    }
+    retired.clear();
+    return;
+  }
+
+  if (std::this_thread::get_id() == loopThread) {
+    return;  // Done once the current event has been handled
+  }
+
+  wake();
+  changed.wait(guard, [this, server]() {
+    return !running ||
+           ((0 == sessions.count(server)) &&
+            (pendingRemove.end() == std::find(pendingRemove.begin(),
+                                              pendingRemove.end(), server)));
+  });
+}
+
+void GdbServerPool::run() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    running = true;
+    loopThread = std::this_thread::get_id();
+  }
+
+  struct epoll_event events[MAX_EVENTS];
+  while (true) {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      if (stopRequested) {
+        break;
+      }
+    }
+    applyPending();
+
+    // Wake up now and again to check targets that can't tell us they have
+    // stalled, and servers whose simulator wants them stopped.
+    int timeout = needsPolling() ? STALL_POLL_INTERVAL
+                                 : GdbServer::STALL_WAIT_TIMEOUT;
+    int n = epoll_wait(epollFd, events, MAX_EVENTS, timeout);
+    if (n < 0) {
+      if (EINTR == errno) {
+        continue;
+      }
+      spdlog::error("GdbServerPool: epoll_wait failed: {:s}", strerror(errno));
+      break;
+    }
+
+    for (int i = 0; i < n; i++) {
+      Source *src = (Source *)events[i].data.ptr;
+      if (SRC_WAKE == src->type) {
+        uint64_t count;
+        if (read(wakeFd, &count, sizeof(count)) < 0) {
+          // Nothing pending (EAGAIN)
+        }
+        continue;
+      }
+
+      Session *session = src->session;
+      if (session->retired) {
+        continue;  // Removed by an earlier event in this batch
+      }
+
+      switch (src->type) {
+        case SRC_LISTEN:
+          handleListen(session);
+          break;
+
+        case SRC_CLIENT:
+          if (0 != (events[i].events & (EPOLLHUP | EPOLLERR))) {
+            dropClient(session);
+          } else {
+            handleClient(session);
+          }
+          break;
+
+        case SRC_STALL:
+          handleStall(session);
+          break;
+
+        default:
+          break;
+      }
+    }
+
+    // Check running targets without stall notification (and, now and again,
+    // those with it), and retire servers whose simulator has asked for them
+    // to be stopped.
+    std::vector<Session *> all;
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      for (std::map<GdbServer *, Session *>::iterator it = sessions.begin();
+           it != sessions.end(); ++it) {
+        all.push_back(it->second);
+      }
+    }
+    for (size_t i = 0; i < all.size(); i++) {
+      GdbServer *server = all[i]->server;
+      if (server->shouldStopServer()) {
+        retire(all[i]);
+      } else if (!server->targetStopped &&
+                 (!server->stallNotify || (0 == n))) {
+        handleStall(all[i]);
+      }
+    }
+
+    for (size_t i = 0; i < retired.size(); i++) {
+      delete retired[i];
+    }
+    retired.clear();
+  }
+
+  std::lock_guard<std::mutex> guard(lock);
+  running = false;
+  stopRequested = false;
+  changed.notify_all();
+}
+
+void GdbServerPool::stop() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stopRequested = true;
+  }
+  wake();
+}
+
+void GdbServerPool::wake() {
+  uint64_t one = 1;
+  if (write(wakeFd, &one, sizeof(one)) < 0) {
+    // Counter saturated: a wakeup is pending anyway
+  }
+}
+
+void GdbServerPool::applyPending() {
+  std::vector<GdbServer *> toAdd;
+  std::vector<GdbServer *> toRemove;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    toAdd.swap(pendingAdd);
+    toRemove = pendingRemove;
+  }
+
+  for (size_t i = 0; i < toAdd.size(); i++) {
+    attach(toAdd[i]);
+  }
+
+  for (size_t i = 0; i < toRemove.size(); i++) {
+    Session *session = NULL;
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      std::map<GdbServer *, Session *>::iterator it =
+          sessions.find(toRemove[i]);
+      if (sessions.end() != it) {
+        session = it->second;
+      }
+    }
+    if (NULL != session) {
+      retire(session);
+    }
+  }
+
+  // Only now are the removals visible to removeServer ()
+  std::lock_guard<std::mutex> guard(lock);
+  pendingRemove.erase(pendingRemove.begin(),
+                      pendingRemove.begin() + toRemove.size());
+  changed.notify_all();
+}
+
+void GdbServerPool::attach(GdbServer *server) {
+  std::lock_guard<std::mutex> guard(lock);
+  if (0 != sessions.count(server)) {
+    spdlog::warn("GdbServerPool: Server added twice, ignored.");
+    return;
+  }
+
+  Session *session = new Session;
+  session->server = server;
+  session->listen.type = SRC_LISTEN;
+  session->listen.session = session;
+  session->client.type = SRC_CLIENT;
+  session->client.session = session;
+  session->stall.type = SRC_STALL;
+  session->stall.session = session;
+  session->clientFd = -1;
+  session->retired = false;
+
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.ptr = &(session->listen);
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, server->rsp->getListenFd(), &ev);
+
+  if (server->stallNotify) {
+    ev.events = EPOLLIN;
+    ev.data.ptr = &(session->stall);
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, server->stallEventFd, &ev);
+  }
+
+  sessions[server] = session;
+  changed.notify_all();
+}
+
+void GdbServerPool::retire(Session *session) {
+  if (session->retired) {
+    return;
+  }
+  session->retired = true;
+
+  // Stop waiting on the server's fds before they are closed
+  GdbServer *server = session->server;
+  epoll_ctl(epollFd, EPOLL_CTL_DEL, server->rsp->getListenFd(), NULL);
+  if (-1 != session->clientFd) {
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, session->clientFd, NULL);
+    session->clientFd = -1;
+  }
+  if (server->stallNotify) {
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, server->stallEventFd, NULL);
+  }
+  server->serverStop();
+
+  std::lock_guard<std::mutex> guard(lock);
+  sessions.erase(server);
+  retired.push_back(session);
+  changed.notify_all();
+}
+
+void GdbServerPool::dropClient(Session *session) {
+  if (-1 != session->clientFd) {
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, session->clientFd, NULL);
+    session->clientFd = -1;
+  }
+  session->server->rspDisconnect();
+}
+
+void GdbServerPool::handleListen(Session *session) {
+  GdbServer *server = session->server;
+  RspConnection *rsp = server->rsp;
+
+  if (rsp->isConnected()) {
+    // Only one client per server: turn away anyone else
+    int fd = accept(rsp->getListenFd(), NULL, NULL);
+    if (fd >= 0) {
+      spdlog::warn("GdbServerPool: Already debugging, connection refused.");
+      close(fd);
+    }
+    return;
+  }
+
+  if (!rsp->rspAccept() || !rsp->isConnected()) {
+    return;
+  }
+  rsp->setAsyncAcks(true);
+  server->clientConnected();
+
+  session->clientFd = rsp->getClientFd();
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.ptr = &(session->client);
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, session->clientFd, &ev);
+}
+
+void GdbServerPool::handleClient(Session *session) {
+  GdbServer *server = session->server;
+
+  if (-1 == session->clientFd) {
+    return;
+  }
+
+  // While the target runs, look for an interrupt. Only in non-stop mode are
+  // requests handled.
+  if (!server->targetStopped) {
+    int res = server->rsp->pollBreak();
+    if (res < 0) {
+      dropClient(session);  // Comms failure
+      return;
+    }
+    if (res > 0) {
+      // The simulator may well stall straight away
+      server->rspInterrupt();
+      server->pollTarget();
+    }
+  }
+
+  // Handle every complete request, until the target is resumed
+  while ((server->targetStopped || server->nonStop) &&
+         !server->shouldStopServer()) {
+    if (-1 == session->clientFd) {
+      return;
+    }
+
+    int res = server->rsp->pollPkt(server->pkt);
+    if (res < 0) {
+      dropClient(session);  // Comms failure
+      return;
+    }
+    if (0 == res) {
+      break;  // Wait for the rest
+    }
+    server->rspDispatch();
+  }
+
+  if (server->shouldStopServer()) {
+    retire(session);
+  } else if (!server->targetStopped && server->pollTarget()) {
+    handleClient(session);  // Stopped straight away
+  }
+}
+
+void GdbServerPool::handleStall(Session *session) {
+  GdbServer *server = session->server;
+
+  if (server->stallNotify) {
+    uint64_t count;
+    if (read(server->stallEventFd, &count, sizeof(count)) < 0) {
+      // Nothing pending (EAGAIN)
+    }
+  }
+
+  if (!server->targetStopped && server->pollTarget()) {
+    // Carry on with any requests that arrived while it was running
+    handleClient(session);
+  }
+}
+
+bool GdbServerPool::needsPolling() {
+  std::lock_guard<std::mutex> guard(lock);
+  for (std::map<GdbServer *, Session *>::iterator it = sessions.begin();
+       it != sessions.end(); ++it) {
+    if (!it->first->stallNotify && !it->first->targetStopped) {
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,241 @@
+/*
+ * Copyright (c) 2019-2020, University of Southampton and Contributors.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <spdlog/spdlog.h>
+#include <algorithm>
+#include <cstring>
+#include <gdb-server/MemoryCache.hpp>
+
+const uint32_t MemoryCache::MAX_READ_AHEAD;
+const uint64_t MemoryCache::ADDR_SPACE_END;
+
+MemoryCache::MemoryCache(SimulationControlInterface *simCtrl,
+                         uint32_t pageSize, std::size_t maxPages)
+    : m_simCtrl(simCtrl),
+      pageSize(pageSize),
+      pageShift(0),
+      maxPages(maxPages),
+      enabled(true),
+      usedPages(0),
+      lastReadEnd(0),
+      readAhead(0) {
+  while ((1u << pageShift) < pageSize) {
+    pageShift++;
+  }
+  if ((1u << pageShift) != pageSize) {
+    spdlog::warn("MemoryCache: page size {:d} not a power of two, using {:d}.",
+                 pageSize, 1u << pageShift);
+    this->pageSize = 1u << pageShift;
+  }
+
+  pool.resize(this->maxPages * this->pageSize);
+  resetStats();
+}
+
+bool MemoryCache::read(uint8_t *out, uint32_t addr, std::size_t len) {
+  if (0 == len) {
+    return true;
+  }
+
+  // Reads that run past the end of the address space aren't cached, as
+  // their pages can't be numbered. The simulator decides what they return.
+  const uint64_t end = (uint64_t)addr + len;
+  if (!enabled || (end > ADDR_SPACE_END) || !isCacheable(addr, len)) {
+    bypasses++;
+    return m_simCtrl->readMem(out, addr, len);
+  }
+
+  const uint32_t firstPage = addr >> pageShift;
+  const uint32_t lastPage = (end - 1) >> pageShift;
+  bool missed = false;
+
+  for (uint32_t page = firstPage;; page++) {
+    uint8_t *data = findPage(page);
+
+    if (NULL == data) {
+      // Fetch the whole run of missing pages in one simulator access
+      uint32_t runEnd = page;
+      while ((runEnd < lastPage) && (NULL == findPage(runEnd + 1))) {
+        runEnd++;
+      }
+
+      // Grow the read-ahead while misses continue where the last read ended
+      if (!missed) {
+        if (addr == lastReadEnd) {
+          readAhead = std::min(std::max(2 * readAhead, 1u), MAX_READ_AHEAD);
+        } else {
+          readAhead = 0;
+        }
+      }
+      missed = true;
+
+      uint32_t extra = (runEnd == lastPage) ? readAhead : 0;
+      if (!fill(page, runEnd - page + 1, extra)) {
+        // Can't cache it (e.g. part of a page is out of range). Fall back to
+        // an exact read of what was asked for.
+        misses++;
+        lastReadEnd = end;
+        return m_simCtrl->readMem(out, addr, len);
+      }
+      data = findPage(page);
+    }
+
+    // Copy the part of this page which was asked for
+    uint64_t pageStart = (uint64_t)page << pageShift;
+    uint64_t from = std::max<uint64_t>(pageStart, addr);
+    uint64_t to = std::min<uint64_t>(pageStart + pageSize, end);
+    memcpy(&out[from - addr], &data[from - pageStart], to - from);
+
+    if (page == lastPage) {
+      break;
+    }
+  }
+
+  lastReadEnd = end;
+  if (missed) {
+    misses++;
+  } else {
+    hits++;
+  }
+  return true;
+}
+
+bool MemoryCache::write(uint8_t *src, uint32_t addr, std::size_t len) {
+  if (0 == len) {
+    return true;
+  }
+
+  const uint64_t end = (uint64_t)addr + len;
+  if (end > ADDR_SPACE_END) {
+    // Past the end of the address space, so drop the whole cache
+    invalidate();
+    return m_simCtrl->writeMem(src, addr, len);
+  }
+
+  if (!m_simCtrl->writeMem(src, addr, len)) {
+    invalidate(addr, len);
+    return false;
+  }
+
+  // Update any cached copy
+  const uint32_t lastPage = (end - 1) >> pageShift;
+  for (uint32_t page = addr >> pageShift;; page++) {
+    uint8_t *data = findPage(page);
+    if (NULL != data) {
+      uint64_t pageStart = (uint64_t)page << pageShift;
+      uint64_t from = std::max<uint64_t>(pageStart, addr);
+      uint64_t to = std::min<uint64_t>(pageStart + pageSize, end);
+      memcpy(&data[from - pageStart], &src[from - addr], to - from);
+    }
+
+    if (page == lastPage) {
+      break;
+    }
+  }
+
+  return true;
+}
+
+void MemoryCache::invalidate() {
+  pageIndex.clear();
+  usedPages = 0;
+  lastReadEnd = 0;
+  readAhead = 0;
+}
+
+void MemoryCache::invalidate(uint32_t addr, std::size_t len) {
+  if ((0 == len) || pageIndex.empty()) {
+    return;
+  }
+  if ((uint64_t)addr + len > ADDR_SPACE_END) {
+    invalidate();
+    return;
+  }
+
+  const uint32_t lastPage = ((uint64_t)addr + len - 1) >> pageShift;
+  for (uint32_t page = addr >> pageShift;; page++) {
+    pageIndex.erase(page);
+    if (page == lastPage) {
+      break;
+    }
+  }
+}
+
+void MemoryCache::addUncacheable(uint32_t addr, uint32_t len) {
+  uncacheable.push_back(std::make_pair((uint64_t)addr, (uint64_t)addr + len));
+  invalidate(addr, len);
+}
+
+void MemoryCache::setEnabled(bool enabled) {
+  this->enabled = enabled;
+  invalidate();
+}
+
+void MemoryCache::resetStats() {
+  hits = 0;
+  misses = 0;
+  bypasses = 0;
+}
+
+bool MemoryCache::isCacheable(uint32_t addr, std::size_t len) const {
+  const uint64_t end = (uint64_t)addr + len;
+  for (std::size_t i = 0; i < uncacheable.size(); i++) {
+    if ((addr < uncacheable[i].second) && (end > uncacheable[i].first)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+uint8_t *MemoryCache::findPage(uint32_t page) {
+  std::unordered_map<uint32_t, std::size_t>::iterator it =
+      pageIndex.find(page);
+  return (pageIndex.end() == it) ? NULL : &pool[it->second * pageSize];
+}
+
+//! Fetch nPages pages starting at firstPage, plus up to extra pages of
+//! read-ahead, into the cache with a single simulator access.
+bool MemoryCache::fill(uint32_t firstPage, uint32_t nPages, uint32_t extra) {
+  if (nPages > maxPages) {
+    return false;
+  }
+
+  // Only read ahead into cacheable, uncached pages within the address space
+  const uint64_t numPages = (uint64_t)1 << (32 - pageShift);
+  uint32_t ahead = 0;
+  while ((ahead < extra) && (firstPage + (uint64_t)nPages + ahead < numPages)) {
+    uint32_t page = firstPage + nPages + ahead;
+    if (!isCacheable(page << pageShift, pageSize) || (NULL != findPage(page))) {
+      break;
+    }
+    ahead++;
+  }
+
+  // The cache only lives until the target runs again, so simply start over
+  // when it fills up
+  if (usedPages + nPages + ahead > maxPages) {
+    invalidate();
+    ahead = std::min<std::size_t>(ahead, maxPages - nPages);
+  }
+
+  uint8_t *dest = &pool[usedPages * pageSize];
+  uint32_t addr = firstPage << pageShift;
+  std::size_t len = (std::size_t)(nPages + ahead) * pageSize;
+  if (!m_simCtrl->readMem(dest, addr, len)) {
+    // The read-ahead may have run off the end of memory: retry without it
+    if ((0 == ahead) ||
+        !m_simCtrl->readMem(dest, addr, (std::size_t)nPages * pageSize)) {
+      return false;
+    }
+    ahead = 0;
+  }
+
+  for (uint32_t i = 0; i < nPages + ahead; i++) {
+    pageIndex[firstPage + i] = usedPages++;
+  }
+  return true;
+}
@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2019-2020, University of Southampton and Contributors.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <gdb-server/Profiler.hpp>
+#include <utility>
+#include <vector>
+
+const unsigned Profiler::DEFAULT_RATE;
+const unsigned Profiler::MAX_RATE;
+const uint64_t Profiler::MAX_BINS;
+
+Profiler::Profiler() : samples(0), rate(DEFAULT_RATE), running(false) {}
+
+void Profiler::start(unsigned rate) {
+  hist.clear();
+  samples = 0;
+  this->rate = std::max(1u, std::min(rate, MAX_RATE));
+  running = true;
+  nextSample = Clock::now();
+}
+
+int Profiler::msUntilSample() const {
+  Clock::duration wait = nextSample - Clock::now();
+  if (wait <= Clock::duration::zero()) {
+    return 0;
+  }
+  // Round up, so we don't wake just before it is due
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             wait + std::chrono::milliseconds(1) - Clock::duration(1))
+      .count();
+}
+
+bool Profiler::sampleDue() {
+  Clock::time_point now = Clock::now();
+  if (!running || (now < nextSample)) {
+    return false;
+  }
+
+  // Keep to the rate, but don't catch up on samples missed while busy
+  nextSample += std::chrono::microseconds(1000000 / rate);
+  if (nextSample < now) {
+    nextSample = now;
+  }
+  return true;
+}
+
+//! Append a value of size bytes in the given byte order
+static void putBytes(std::vector<uint8_t> *out, uint32_t val, int size,
+                     bool bigEndian) {
+  for (int i = 0; i < size; i++) {
+    int shift = 8 * (bigEndian ? size - 1 - i : i);
+    out->push_back((val >> shift) & 0xff);
+  }
+}
+
+bool Profiler::writeGmon(const char *path, bool bigEndian) const {
+  uint64_t low = UINT32_MAX;
+  uint64_t high = 0;
+  for (auto it = hist.begin(); it != hist.end(); ++it) {
+    low = std::min(low, (uint64_t)it->first);
+    high = std::max(high, (uint64_t)it->first + 1);
+  }
+  if (hist.empty()) {
+    low = 0;
+  }
+
+  // One bin per 2 byte instruction slot, unless that makes too many
+  uint64_t binSize = 2;
+  while ((high - low) / binSize >= MAX_BINS) {
+    binSize *= 2;
+  }
+  low &= ~(binSize - 1);
+  high = (high + binSize - 1) & ~(binSize - 1);
+  std::vector<uint16_t> bins((high - low) / binSize, 0);
+  for (auto it = hist.begin(); it != hist.end(); ++it) {
+    uint16_t &bin = bins[(it->first - low) / binSize];
+    bin = std::min((uint64_t)UINT16_MAX, bin + it->second);
+  }
+
+  // gmon.out header, then a single histogram record. Addresses are 32 bits,
+  // as for any 32 bit ELF target.
+  std::vector<uint8_t> out;
+  const char cookie[4] = {'g', 'm', 'o', 'n'};
+  out.insert(out.end(), cookie, cookie + sizeof(cookie));
+  putBytes(&out, 1, 4, bigEndian);  // Version
+  out.insert(out.end(), 12, 0);     // Spare
+
+  char dimen[15] = "seconds";
+  out.push_back(0);  // GMON_TAG_TIME_HIST
+  putBytes(&out, low, 4, bigEndian);
+  putBytes(&out, high, 4, bigEndian);
+  putBytes(&out, bins.size(), 4, bigEndian);
+  putBytes(&out, rate, 4, bigEndian);
+  out.insert(out.end(), dimen, dimen + sizeof(dimen));
+  out.push_back('s');
+  for (size_t i = 0; i < bins.size(); i++) {
+    putBytes(&out, bins[i], 2, bigEndian);
+  }
+
+  std::FILE *file = std::fopen(path, "wb");
+  if (NULL == file) {
+    return false;
+  }
+  bool ok = (out.size() == std::fwrite(out.data(), 1, out.size(), file));
+  return (0 == std::fclose(file)) && ok;
+}
+
+bool Profiler::writeText(const char *path) const {
+  std::vector<std::pair<uint32_t, uint64_t>> byAddr(hist.begin(), hist.end());
+  std::sort(byAddr.begin(), byAddr.end());
+
+  std::FILE *file = std::fopen(path, "w");
+  if (NULL == file) {
+    return false;
+  }
+  std::fprintf(file, "# PC samples: %llu at %u Hz\n",
+               (unsigned long long)samples, rate);
+  for (size_t i = 0; i < byAddr.size(); i++) {
+    std::fprintf(file, "0x%08x %llu\n", byAddr[i].first,
+                 (unsigned long long)byAddr[i].second);
+  }
+  bool ok = !std::ferror(file);
+  return (0 == std::fclose(file)) && ok;
+}
+
+std::string Profiler::summary(std::size_t top) const {
+  std::vector<std::pair<uint64_t, uint32_t>> byCount;
+  for (auto it = hist.begin(); it != hist.end(); ++it) {
+    byCount.push_back(std::make_pair(it->second, it->first));
+  }
+  top = std::min(top, byCount.size());
+  std::partial_sort(byCount.begin(), byCount.begin() + top, byCount.end(),
+                    std::greater<std::pair<uint64_t, uint32_t>>());
+
+  char line[128];
+  snprintf(line, sizeof(line), "%llu samples at %zu addresses, %u Hz%s.\n",
+           (unsigned long long)samples, hist.size(), rate,
+           running ? ", running" : "");
+  std::string out(line);
+  for (size_t i = 0; i < top; i++) {
+    snprintf(line, sizeof(line), "  0x%08x %10llu %5.1f%%\n", byCount[i].second,
+             (unsigned long long)byCount[i].first,
+             100.0 * byCount[i].first / samples);
+    out += line;
+  }
+  return out;
+}
@@ -83,6 +83,8 @@ RspConnection::RspConnection(const char *_serviceName) {
 //-----------------------------------------------------------------------------
 RspConnection::~RspConnection() {
   this->rspClose();  // Don't confuse with any other close ()
+  rspUnlisten();
+  delete[] txBuf;
 
 }  // ~RspConnection ()
 
@@ -104,7 +106,20 @@ RspConnection::~RspConnection() {
 void RspConnection::rspInit(int _portNum, const char *_serviceName) {
   portNum = _portNum;
   serviceName = _serviceName;
+  listenFd = -1;
   clientFd = -1;
+  rxHead = 0;
+  rxTail = 0;
+  txBuf = NULL;
+  txBufSize = 0;
+  txLen = 0;
+  rxState = RX_IDLE;
+  rxCount = 0;
+  asyncAcks = false;
+  noAckMode = false;
+  checkNoAckChecksum = true;
+  recorder = NULL;
+  stats = NULL;
 
 }  // init ()
 
@@ -126,6 +141,26 @@ void RspConnection::rspInit(int _portNum, const char *_serviceName) {
 //!          if the error was so serious the program must be aborted.
 //-----------------------------------------------------------------------------
 bool RspConnection::rspConnect() {
+  if (!rspListen()) {
+    return false;
+  }
+
+  bool ok = rspAccept();
+  rspUnlisten();  // Socket is no longer needed
+  return ok;
+
+}  // rspConnect ()
+
+//-----------------------------------------------------------------------------
+//! Open the socket on which to listen for a client
+
+//! @return  TRUE if we are listening, FALSE on a serious error
+//-----------------------------------------------------------------------------
+bool RspConnection::rspListen() {
+  if (-1 != listenFd) {
+    return true;  // Already listening
+  }
+
   // 0 is used as the RSP port number to indicate that we should use the
   // service name instead.
   if (0 == portNum) {
@@ -159,20 +194,42 @@ bool RspConnection::rspConnect() {
 
   if (bind(tmpFd, (struct sockaddr *)&sockAddr, sizeof(sockAddr))) {
     cerr << "ERROR: Cannot bind to RSP socket" << endl;
+    close(tmpFd);
     return false;
   }
 
   // Listen for (at most one) client
   if (listen(tmpFd, 1)) {
     cerr << "ERROR: Cannot listen on RSP socket" << endl;
+    close(tmpFd);
     return false;
   }
 
   cout << "Listening for RSP on port " << portNum << endl << flush;
+  listenFd = tmpFd;
+  return true;
+
+}  // rspListen ()
+
+//-----------------------------------------------------------------------------
+//! Accept a client on the listening socket
+
+//! Blocks until a client connects, unless the caller already knows one is
+//! waiting.
+
+//! @return  TRUE if the connection was established or can be retried. FALSE
+//!          if we are not listening.
+//-----------------------------------------------------------------------------
+bool RspConnection::rspAccept() {
+  if (-1 == listenFd) {
+    cerr << "Warning: Attempt to accept RSP client without listening" << endl;
+    return false;
+  }
 
   // Accept a client which connects
+  struct sockaddr_in sockAddr;
   socklen_t len = sizeof(sockAddr);  // Size of the socket address
-  clientFd = accept(tmpFd, (struct sockaddr *)&sockAddr, &len);
+  clientFd = accept(listenFd, (struct sockaddr *)&sockAddr, &len);
 
   if (-1 == clientFd) {
     cerr << "Warning: Failed to accept RSP client, failure code: " << errno
@@ -181,7 +238,7 @@ bool RspConnection::rspConnect() {
   }
 
   // Enable TCP keep alive process
-  optval = 1;
+  int optval = 1;
   setsockopt(clientFd, SOL_SOCKET, SO_KEEPALIVE, (char *)&optval,
              sizeof(optval));
 
@@ -191,14 +248,37 @@ bool RspConnection::rspConnect() {
   setsockopt(clientFd, IPPROTO_TCP, TCP_NODELAY, (char *)&optval,
              sizeof(optval));
 
-  // Socket is no longer needed
-  close(tmpFd);              // No longer need this
   signal(SIGPIPE, SIG_IGN);  // So we don't exit if client dies
 
   cout << "Remote debugging from host " << inet_ntoa(sockAddr.sin_addr) << endl;
   return true;
 
-}  // rspConnect ()
+}  // rspAccept ()
+
+//-----------------------------------------------------------------------------
+//! Use an already connected socket as the client connection
+
+//! Any client already connected is closed first. The connection takes over
+//! the socket, which is closed by rspClose ().
+
+//! @param[in] fd  The connected socket, e.g. one end of a socketpair ()
+//-----------------------------------------------------------------------------
+void RspConnection::rspAttach(int fd) {
+  rspClose();
+  clientFd = fd;
+  signal(SIGPIPE, SIG_IGN);  // So we don't exit if client dies
+
+}  // rspAttach ()
+
+//-----------------------------------------------------------------------------
+//! Stop listening for clients. Any connected client is unaffected.
+//-----------------------------------------------------------------------------
+void RspConnection::rspUnlisten() {
+  if (-1 != listenFd) {
+    close(listenFd);
+    listenFd = -1;
+  }
+}  // rspUnlisten ()
 
 //-----------------------------------------------------------------------------
 //! Close a client connection if it is open
@@ -209,6 +289,14 @@ void RspConnection::rspClose() {
     close(clientFd);
     clientFd = -1;
   }
+
+  // Discard anything left over from this client. A new client starts out
+  // acknowledging packets.
+  rxHead = 0;
+  rxTail = 0;
+  rxState = RX_IDLE;
+  txLen = 0;
+  noAckMode = false;
 }  // rspClose ()
 
 //-----------------------------------------------------------------------------
@@ -218,12 +306,89 @@ void RspConnection::rspClose() {
 //-----------------------------------------------------------------------------
 bool RspConnection::isConnected() { return -1 != clientFd; }  // isConnected ()
 
+//-----------------------------------------------------------------------------
+//! Get the listening socket, for an event loop to wait on
+
+//! @return  The file descriptor, or -1 if not listening
+//-----------------------------------------------------------------------------
+int RspConnection::getListenFd() { return listenFd; }  // getListenFd ()
+
+//-----------------------------------------------------------------------------
+//! Get the client socket, for an event loop to wait on
+
+//! @return  The file descriptor, or -1 if not connected
+//-----------------------------------------------------------------------------
+int RspConnection::getClientFd() { return clientFd; }  // getClientFd ()
+
+//-----------------------------------------------------------------------------
+//! Enable or disable asynchronous acks
+
+//! Used when packets are received with pollPkt (), which must never block.
+//! putPkt () then sends each packet once without waiting for the ack, and
+//! pollPkt () skips the ack when it arrives, or resends the last packet if
+//! the client asked for a retransmission.
+
+//! @param[in] async  TRUE to stop putPkt () waiting for acks
+//-----------------------------------------------------------------------------
+void RspConnection::setAsyncAcks(bool async) {
+  asyncAcks = async;
+
+}  // setAsyncAcks ()
+
+//-----------------------------------------------------------------------------
+//! Enable or disable no-ack mode
+
+//! In no-ack mode (negotiated with QStartNoAckMode) neither side sends '+' or
+//! '-' acknowledgements, saving a round trip per packet. The mode is cleared
+//! when the client connection is closed.
+
+//! @param[in] noAck  TRUE to stop sending and waiting for acks
+//-----------------------------------------------------------------------------
+void RspConnection::setNoAckMode(bool noAck) {
+  noAckMode = noAck;
+
+}  // setNoAckMode ()
+
+//-----------------------------------------------------------------------------
+//! Choose whether packet checksums are verified in no-ack mode
+
+//! A bad checksum cannot be retransmitted in no-ack mode, so verifying it only
+//! produces a warning. It can be skipped entirely over reliable transports.
+
+//! @param[in] check  TRUE to warn about bad checksums in no-ack mode
+//-----------------------------------------------------------------------------
+void RspConnection::setNoAckChecksumCheck(bool check) {
+  checkNoAckChecksum = check;
+
+}  // setNoAckChecksumCheck ()
+
+//-----------------------------------------------------------------------------
+//! Record every packet sent and received from now on
+
+//! @param[in] rec  The recorder to use, or NULL to stop recording
+//-----------------------------------------------------------------------------
+void RspConnection::setRecorder(SessionRecorder *rec) {
+  recorder = rec;
+
+}  // setRecorder ()
+
+//-----------------------------------------------------------------------------
+//! Count the bytes sent and the time taken to send them
+
+//! @param[in] s  The statistics to add to, or NULL to stop counting
+//-----------------------------------------------------------------------------
+void RspConnection::setStats(RspStats *s) {
+  stats = s;
+
+}  // setStats ()
+
 //-----------------------------------------------------------------------------
 //! Get the next packet from the RSP connection
 
-//! Modeled on the stub version supplied with GDB. This allows the user to
-//! replace the character read function, which is why we get stuff a character
-//! at at time.
+//! Modeled on the stub version supplied with GDB. Rather than reading a
+//! character at a time from the socket, the packet body is scanned straight
+//! out of the receive buffer, so a whole packet usually costs a single
+//! recv ().
 
 //! Unlike the reference implementation, we don't deal with sequence
 //! numbers. GDB has never used them, and this implementation is only intended
@@ -257,16 +422,18 @@ bool RspConnection::getPkt(RspPacket *pkt) {
       }
     }
 
-    // Read until a '#' or end of buffer is found
+    // Read until a '#' or end of buffer is found. Chars are taken straight
+    // out of the receive buffer, which is only refilled once it is drained.
     checksum = 0;
     count = 0;
+    ch = -1;
     while (count < bufSize - 1) {
-      ch = getRspChar();
-
-      if (-1 == ch) {
+      if ((rxHead == rxTail) && !fillRxBuf()) {
         return false;  // Connection failed
       }
 
+      ch = rxBuf[rxHead++] & 0xff;
+
       // If we hit a start of line char begin all over again
       if ('$' == ch) {
         checksum = 0;
@@ -309,6 +476,24 @@ bool RspConnection::getPkt(RspPacket *pkt) {
 
       xmitcsum += Utils::char2Hex(ch);
 
+      // In no-ack mode there is nobody to ask for a retransmission, so
+      // just accept the packet. Checking the checksum at all is optional.
+      if (noAckMode) {
+        if (checkNoAckChecksum && (checksum != xmitcsum)) {
+          cerr << "Warning: Bad RSP checksum in no-ack mode: Computed 0x"
+               << setw(2) << setfill('0') << hex << (int)checksum
+               << ", received 0x" << (int)xmitcsum << setfill(' ') << dec
+               << endl;
+        }
+#ifdef RSP_TRACE
+        cout << "getPkt: " << *pkt << endl;
+#endif
+        if (NULL != recorder) {
+          recorder->packet(SessionRecorder::PKT_RX, pkt->data, pkt->getLen());
+        }
+        return true;  // Success
+      }
+
       // If the checksums don't match print a warning, and put the
       // negative ack back to the client. Otherwise put a positive ack.
       if (checksum != xmitcsum) {
@@ -327,6 +512,10 @@ bool RspConnection::getPkt(RspPacket *pkt) {
 #ifdef RSP_TRACE
           cout << "getPkt: " << *pkt << endl;
 #endif
+          if (NULL != recorder) {
+            recorder->packet(SessionRecorder::PKT_RX, pkt->data,
+                             pkt->getLen());
+          }
           return true;  // Success
         }
       }
@@ -337,13 +526,169 @@ bool RspConnection::getPkt(RspPacket *pkt) {
 
 }  // getPkt ()
 
+//-----------------------------------------------------------------------------
+//! Get the next packet from the RSP connection without blocking
+
+//! The same protocol as getPkt (), but driven as a state machine: chars are
+//! consumed from the receive buffer, which is refilled with whatever the
+//! socket has ready, until either a whole packet has been received or no
+//! more chars are available. In the latter case the partial packet is kept
+//! in pkt, and the next call carries on from where this one left off, so the
+//! same packet must be passed every time.
+
+//! @param[in] pkt  The packet for storing the result.
+
+//! @return  1 if a packet was received, 0 if more chars are needed, -1 on a
+//!          communications failure
+//-----------------------------------------------------------------------------
+int RspConnection::pollPkt(RspPacket *pkt) {
+  while (true) {
+    if (rxHead == rxTail) {
+      int res = pollRxBuf();
+      if (res <= 0) {
+        return res;  // Nothing more for now, or connection failed
+      }
+    }
+
+    int ch = rxBuf[rxHead++] & 0xff;
+
+    switch (rxState) {
+      case RX_IDLE:
+        // Wait for the start character ('$'). The client may have asked for
+        // the last packet again, otherwise ignore all other characters.
+        if ('$' == ch) {
+          rxChecksum = 0;
+          rxCount = 0;
+          rxState = RX_BODY;
+        } else if (('-' == ch) && (txLen > 0) && !noAckMode) {
+          if (!putRspStr(txBuf, txLen)) {
+            return -1;  // Comms failure
+          }
+        }
+        break;
+
+      case RX_BODY:
+        if ('$' == ch) {
+          // Start of line char, so begin all over again
+          rxChecksum = 0;
+          rxCount = 0;
+        } else if ('#' == ch) {
+          rxState = RX_CSUM_HI;
+        } else if (rxCount < pkt->getBufSize() - 1) {
+          rxChecksum = rxChecksum + (unsigned char)ch;
+          pkt->data[rxCount] = (char)ch;
+          rxCount++;
+        } else {
+          cerr << "Warning: RSP packet overran buffer" << endl;
+          rxState = RX_IDLE;
+        }
+        break;
+
+      case RX_CSUM_HI:
+        rxXmitCsum = Utils::char2Hex(ch) << 4;
+        rxState = RX_CSUM_LO;
+        break;
+
+      case RX_CSUM_LO:
+        rxXmitCsum += Utils::char2Hex(ch);
+        rxState = RX_IDLE;
+
+        // Mark the end of the buffer with EOS - it's convenient for
+        // non-binary data to be valid strings.
+        pkt->data[rxCount] = 0;
+        pkt->setLen(rxCount);
+
+        if (noAckMode) {
+          if (checkNoAckChecksum && (rxChecksum != rxXmitCsum)) {
+            cerr << "Warning: Bad RSP checksum in no-ack mode: Computed 0x"
+                 << setw(2) << setfill('0') << hex << (int)rxChecksum
+                 << ", received 0x" << (int)rxXmitCsum << setfill(' ') << dec
+                 << endl;
+          }
+          return 1;  // Success
+        }
+
+        // Ask for the packet again if the checksums don't match
+        if (rxChecksum != rxXmitCsum) {
+          cerr << "Warning: Bad RSP checksum: Computed 0x" << setw(2)
+               << setfill('0') << hex << (int)rxChecksum << ", received 0x"
+               << (int)rxXmitCsum << setfill(' ') << dec << endl;
+          if (!putRspChar('-')) {
+            return -1;  // Comms failure
+          }
+          break;
+        }
+
+        if (!putRspChar('+')) {
+          return -1;  // Comms failure
+        }
+#ifdef RSP_TRACE
+        cout << "pollPkt: " << *pkt << endl;
+#endif
+        if (NULL != recorder) {
+          recorder->packet(SessionRecorder::PKT_RX, pkt->data, pkt->getLen());
+        }
+        return 1;  // Success
+    }
+  }
+
+}  // pollPkt ()
+
+//-----------------------------------------------------------------------------
+//! Look for an interrupt from the client without blocking
+
+//! While the target is running, GDB only sends the interrupt char (0x03),
+//! and acks for any stop notifications. Consume those, stopping at the start
+//! of a packet, which is left for getPkt () or pollPkt (). Does nothing
+//! while pollPkt () is part way through a packet.
+
+//! @return  1 if an interrupt was received, 0 if not, -1 on a communications
+//!          failure
+//-----------------------------------------------------------------------------
+int RspConnection::pollBreak() {
+  if (RX_IDLE != rxState) {
+    return 0;
+  }
+
+  while (true) {
+    if (rxHead == rxTail) {
+      int res = pollRxBuf();
+      if (res <= 0) {
+        return res;  // Nothing more for now, or connection failed
+      }
+    }
+
+    char ch = rxBuf[rxHead];
+    if (0x03 == ch) {
+      rxHead++;
+      if (NULL != recorder) {
+        recorder->packet(SessionRecorder::BREAK_RX, &ch, 1);
+      }
+      return 1;
+    } else if (('+' == ch) || ('-' == ch)) {
+      rxHead++;
+    } else {
+      return 0;  // Leave it for the packet reader
+    }
+  }
+
+}  // pollBreak ()
+
+//-----------------------------------------------------------------------------
+//! Report whether received chars are waiting in the receive buffer
+
+//! @return  TRUE if there are buffered chars not yet consumed
+//-----------------------------------------------------------------------------
+bool RspConnection::rxPending() {
+  return rxHead != rxTail;
+
+}  // rxPending ()
+
 //-----------------------------------------------------------------------------
 //! Put the packet out on the RSP connection
 
-//! Modeled on the stub version supplied with GDB. Put out the data preceded
-//! by a '$', followed by a '#' and a one byte checksum. '$', '#', '*' and '}'
-//! are escaped by preceding them with '}' and then XORing the character with
-//! 0x20.
+//! Modeled on the stub version supplied with GDB. The packet is framed and
+//! escaped by packTx (), then sent until the client acks it.
 
 //! Since this is SystemC, if we hit something that requires a
 //! restart/retransmission, we wait so another thread gets a lookin.
@@ -354,12 +699,92 @@ bool RspConnection::getPkt(RspPacket *pkt) {
 //!          failure).
 //-----------------------------------------------------------------------------
 bool RspConnection::putPkt(RspPacket *pkt) {
-  static char txbuf[2048];  // tx buffer
+  int cursor = packTx('$', pkt);
+  char ch;
+
+  if (NULL != recorder) {
+    recorder->packet(SessionRecorder::PKT_TX, pkt->data, pkt->getLen());
+  }
+
+  // Transmit packet. In no-ack mode the client will not ack, so send once.
+  // With async acks pollPkt () deals with the ack.
+  uint64_t start = (NULL != stats) ? RspStats::now() : 0;
+  txLen = cursor;
+  bool ok = putRspStr(txBuf, cursor);
+
+  // Otherwise repeat transmission until the GDB client ack's OK
+  while (ok && !noAckMode && !asyncAcks) {
+    // Check for ack of connection failure
+    ch = getRspChar();
+    if ('+' == ch) {
+      break;
+    }
+    ok = (-1 != ch) && putRspStr(txBuf, cursor);  // Else comms failure
+  }
+
+  if (NULL != stats) {
+    stats->sent(cursor, RspStats::now() - start);
+  }
+  return ok;
+
+}  // putPkt ()
+
+//-----------------------------------------------------------------------------
+//! Put a notification out on the RSP connection
+
+//! Notifications (used for asynchronous stop events in non-stop mode) are
+//! framed like packets, but start with '%' and are never acknowledged. The
+//! packet should hold the notification name, ':' and its payload.
+
+//! @param[in] pkt  The notification to transmit
+
+//! @return  TRUE to indicate success, FALSE otherwise (means a communications
+//!          failure).
+//-----------------------------------------------------------------------------
+bool RspConnection::putNotification(RspPacket *pkt) {
+  int len = packTx('%', pkt);
+  txLen = 0;  // Notifications can't be retransmitted
+
+  if (NULL != recorder) {
+    recorder->packet(SessionRecorder::NOTIFY_TX, pkt->data, pkt->getLen());
+  }
+
+  uint64_t start = (NULL != stats) ? RspStats::now() : 0;
+  bool ok = putRspStr(txBuf, len);
+  if (NULL != stats) {
+    stats->sent(len, RspStats::now() - start);
+  }
+  return ok;
+
+}  // putNotification ()
+
+//-----------------------------------------------------------------------------
+//! Build a packet in the transmit buffer
+
+//! Put out the data preceded by the start char, followed by a '#' and a one
+//! byte checksum. '$', '#', '*' and '}' are escaped by preceding them with
+//! '}' and then XORing the character with 0x20.
+
+//! @param[in] start  The start char ('$' for a packet, '%' for a
+//!                   notification)
+//! @param[in] pkt    The packet to build
+
+//! @return  The number of chars in txBuf
+//-----------------------------------------------------------------------------
+int RspConnection::packTx(char start, RspPacket *pkt) {
   int len = pkt->getLen();
 
-  // Construct $<packet info>#<checksum>.
+  // Worst case every char is escaped, plus start, '#' and two checksum chars
+  int maxLen = 2 * len + 4;
+  if (maxLen > txBufSize) {
+    delete[] txBuf;
+    txBuf = new char[maxLen];
+    txBufSize = maxLen;
+  }
+
+  // Construct <start><packet info>#<checksum>.
   unsigned char checksum = 0;
-  txbuf[0] = '$';
+  txBuf[0] = start;
   // Body of the packet
   size_t cursor = 1;
   for (size_t count = 0; count < len; count++) {
@@ -369,41 +794,28 @@ bool RspConnection::putPkt(RspPacket *pkt) {
     if (('$' == ch) || ('#' == ch) || ('*' == ch) || ('}' == ch)) {
       ch ^= 0x20;
       checksum += (unsigned char)'}';
-      txbuf[cursor] = '}';
+      txBuf[cursor] = '}';
       cursor++;
     }
 
     checksum += ch;
-    txbuf[cursor] = ch;
+    txBuf[cursor] = ch;
     cursor++;
   }
 
   // End char
-  txbuf[cursor] = '#';
+  txBuf[cursor] = '#';
   cursor++;
 
   // Computed checksum
-  txbuf[cursor] = Utils::hex2Char(checksum >> 4);
+  txBuf[cursor] = Utils::hex2Char(checksum >> 4);
   cursor++;
-  txbuf[cursor] = Utils::hex2Char(checksum % 16);
+  txBuf[cursor] = Utils::hex2Char(checksum % 16);
   cursor++;
-  char ch;
 
-  // Transmit packet
-  do {  /// Repeat transmission until the GDB client ack's OK
-    if (!putRspStr(txbuf, cursor)) {
-      return false;  // Comms failure
-    }
-    // Check for ack of connection failure
-    ch = getRspChar();
-    if (-1 == ch) {
-      return false;  // Comms failure
-    }
-  } while ('+' != ch);
-
-  return true;
+  return cursor;
 
-}  // putPkt ()
+}  // packTx ()
 
 //-----------------------------------------------------------------------------
 //! Put a single character out on the RSP connection
@@ -460,10 +872,12 @@ bool RspConnection::putRspStr(char *const buf, const size_t len) {
     return false;
   }
 
-  // Write until successful (we retry after interrupts) or catastrophic
-  // failure.
-  while (true) {
-    switch (write(clientFd, buf, len)) {
+  // Write until everything is sent (we retry after interrupts and partial
+  // writes) or catastrophic failure.
+  size_t sent = 0;
+  while (sent < len) {
+    ssize_t n = write(clientFd, buf + sent, len - sent);
+    switch (n) {
       case -1:
         // Error: only allow interrupts or would block
         if ((EAGAIN != errno) && (EINTR != errno)) {
@@ -478,10 +892,13 @@ bool RspConnection::putRspStr(char *const buf, const size_t len) {
         break;  // Nothing written! Try again
 
       default:
-        return true;  // Success, we can return
+        sent += n;
+        break;
     }
   }
-}  // putRspChar ()
+
+  return true;  // Success, we can return
+}  // putRspStr ()
 
 //-----------------------------------------------------------------------------
 //! Get a single character from the RSP connection
@@ -489,22 +906,92 @@ bool RspConnection::putRspStr(char *const buf, const size_t len) {
 //! Utility routine. This should only be called if the client is open, but we
 //! check for safety.
 
+//! Characters are served from the receive buffer, which is refilled by
+//! fillRxBuf () when empty.
+
 //! @return  The character received or -1 on failure
 //-----------------------------------------------------------------------------
 int RspConnection::getRspChar() {
+  if ((rxHead == rxTail) && !fillRxBuf()) {
+    return -1;
+  }
+
+  return rxBuf[rxHead++] & 0xff;  // No sign extend!
+
+}  // getRspChar ()
+
+//-----------------------------------------------------------------------------
+//! Refill the receive buffer from the RSP connection
+
+//! Utility routine. Blocks until at least one char is available, then takes
+//! as many chars as the socket has ready (up to the buffer size) in a single
+//! recv (). Must only be called when the buffer has been drained.
+
+//! @return  TRUE if at least one char was received, FALSE on failure
+//-----------------------------------------------------------------------------
+bool RspConnection::fillRxBuf() {
   if (-1 == clientFd) {
     cerr << "Warning: Attempt to read from "
          << "unopened RSP client: Ignored" << endl;
-    return -1;
+    return false;
   }
 
+  rxHead = 0;
+  rxTail = 0;
+
   // Blocking read until successful (we retry after interrupts) or
   // catastrophic failure.
   while (true) {
-    unsigned char c;
+    ssize_t n = recv(clientFd, rxBuf, RX_BUF_SIZE, 0);
 
-    switch (read(clientFd, &c, sizeof(c))) {
+    switch (n) {
       case -1:
+        // Error: only allow interrupts
+        if (EINTR != errno) {
+          cerr << "Warning: Failed to read from RSP client: "
+               << "Closing client connection: " << strerror(errno) << endl;
+          return false;
+        }
+        break;
+
+      case 0:
+        return false;
+
+      default:
+        rxTail = n;
+        return true;  // Success, we can return
+    }
+  }
+
+}  // fillRxBuf ()
+
+//-----------------------------------------------------------------------------
+//! Refill the receive buffer with whatever the RSP connection has ready
+
+//! Utility routine. Never blocks. Must only be called when the buffer has
+//! been drained.
+
+//! @return  1 if at least one char was received, 0 if none is available, -1
+//!          on failure (including the client closing the connection)
+//-----------------------------------------------------------------------------
+int RspConnection::pollRxBuf() {
+  if (-1 == clientFd) {
+    cerr << "Warning: Attempt to read from "
+         << "unopened RSP client: Ignored" << endl;
+    return -1;
+  }
+
+  rxHead = 0;
+  rxTail = 0;
+
+  while (true) {
+    ssize_t n = recv(clientFd, rxBuf, RX_BUF_SIZE, MSG_DONTWAIT);
+
+    switch (n) {
+      case -1:
+        if ((EAGAIN == errno) || (EWOULDBLOCK == errno)) {
+          return 0;
+        }
         // Error: only allow interrupts
         if (EINTR != errno) {
           cerr << "Warning: Failed to read from RSP client: "
@@ -517,8 +1004,9 @@ int RspConnection::getRspChar() {
         return -1;
 
       default:
-        return c & 0xff;  // Success, we can return (no sign extend!)
+        rxTail = n;
+        return 1;
     }
   }
 
-}  // getRspChar ()
+}  // pollRxBuf ()
@@ -0,0 +1,293 @@
+/*
+ * Copyright (c) 2019-2020, University of Southampton and Contributors.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <gdb-server/RspStats.hpp>
+
+const int RspStats::N_BUCKETS;
+const int RspStats::N_LETTERS;
+
+const char *const RspStats::NAMES[] = {
+    // Queries
+    "qAttached", "qC", "qCRC", "qfThreadInfo", "qsThreadInfo", "qOffsets",
+    "qRcmd", "qSupported", "qSymbol", "qThreadExtraInfo", "qXfer",
+    // Tracepoint queries
+    "qTBuffer", "qTfP", "qTsP", "qTfV", "qTsV", "qTP", "qTStatus", "qTV",
+    // Settings
+    "QNonStop", "QPassSignals", "QProgramSignals", "QStartNoAckMode",
+    // Tracepoint settings
+    "QTBuffer", "QTDP", "QTDPsrc", "QTDV", "QTFrame", "QTinit", "QTNotes",
+    "QTro", "QTStart", "QTStop",
+    // v packets
+    "vAttach", "vCont", "vCont?", "vCtrlC", "vFile", "vFlashDone",
+    "vFlashErase", "vFlashWrite", "vKill", "vMustReplyEmpty", "vRun",
+    "vStopped", NULL};
+
+void RspStats::Histogram::add(uint64_t ns) {
+  uint64_t q = ns >> 8;
+  int b = (0 == q) ? 0 : 64 - __builtin_clzll(q);
+  buckets[std::min(b, N_BUCKETS - 1)]++;
+  count++;
+  totalNs += ns;
+  maxNs = std::max(maxNs, ns);
+}
+
+uint64_t RspStats::Histogram::percentile(double p) const {
+  if (0 == count) {
+    return 0;
+  }
+  uint64_t rank = std::max((uint64_t)1, (uint64_t)std::ceil(count * p / 100));
+  uint64_t seen = 0;
+  for (int b = 0; b < N_BUCKETS - 1; b++) {
+    seen += buckets[b];
+    if (seen >= rank) {
+      return std::min((uint64_t)256 << b, maxNs);
+    }
+  }
+  return maxNs;  // The last bucket has no upper bound
+}
+
+RspStats::RspStats() : generation(0), simNs(0), socketNs(0), txBytes(0) {
+  reset();
+}
+
+void RspStats::reset() {
+  int nNames = 0;
+  while (NULL != NAMES[nNames]) {
+    nNames++;
+  }
+  entries.assign(N_LETTERS + nNames, Entry());
+  wait = Histogram();
+  resetTime = now();
+  generation++;
+}
+
+int RspStats::classify(const char *data, std::size_t len) const {
+  if (0 == len) {
+    return 0;
+  }
+
+  if (('q' == data[0]) || ('Q' == data[0]) || ('v' == data[0])) {
+    std::size_t nameLen = 0;
+    while ((nameLen < len) && (NULL == strchr(":,;", data[nameLen]))) {
+      nameLen++;
+    }
+    for (int i = 0; NULL != NAMES[i]; i++) {
+      if ((0 == strncmp(NAMES[i], data, nameLen)) &&
+          ('\0' == NAMES[i][nameLen])) {
+        return N_LETTERS + i;
+      }
+    }
+  }
+
+  return data[0] & (N_LETTERS - 1);
+}
+
+std::string RspStats::entryName(int entry) const {
+  if (entry >= N_LETTERS) {
+    return NAMES[entry - N_LETTERS];
+  }
+
+  char buf[16];
+  if (('q' == entry) || ('Q' == entry) || ('v' == entry)) {
+    snprintf(buf, sizeof(buf), "%c (other)", entry);
+  } else if ((entry > ' ') && (entry < 0x7f)) {
+    snprintf(buf, sizeof(buf), "%c", entry);
+  } else {
+    snprintf(buf, sizeof(buf), "0x%02x", entry);
+  }
+  return buf;
+}
+
+RspStats::Request RspStats::begin(const char *data, std::size_t len) {
+  Request req;
+  req.entry = classify(data, len);
+  req.generation = generation;
+  req.bytesIn = len;
+  req.simNs = simNs;
+  req.socketNs = socketNs;
+  req.txBytes = txBytes;
+  req.start = now();
+  return req;
+}
+
+void RspStats::end(const Request &req) {
+  if (req.generation != generation) {
+    return;  // Reset while it was handled
+  }
+
+  uint64_t total = now() - req.start;
+  uint64_t sim = simNs - req.simNs;
+  uint64_t socket = socketNs - req.socketNs;
+
+  Entry &e = entries[req.entry];
+  e.count++;
+  e.bytesIn += req.bytesIn;
+  e.bytesOut += txBytes - req.txBytes;
+  e.total.add(total);
+  e.server.add((total > sim + socket) ? total - sim - socket : 0);
+  e.sim.add(sim);
+  e.socket.add(socket);
+}
+
+//! p50/p99 of a histogram in us
+static std::string p50p99(const RspStats::Histogram &h) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.1f/%.1f", h.percentile(50) / 1e3,
+           h.percentile(99) / 1e3);
+  return buf;
+}
+
+std::string RspStats::report() const {
+  std::vector<int> used;
+  for (size_t i = 0; i < entries.size(); i++) {
+    if (0 != entries[i].count) {
+      used.push_back(i);
+    }
+  }
+  std::sort(used.begin(), used.end(), [this](int a, int b) {
+    return entries[a].total.totalNs > entries[b].total.totalNs;
+  });
+
+  std::string out;
+  char line[256];
+  snprintf(line, sizeof(line),
+           "Requests over the last %.1f s. Latency p50/p99 in us.\n",
+           (now() - resetTime) / 1e9);
+  out += line;
+  snprintf(line, sizeof(line),
+           "%-17s %8s %10s %10s %9s %13s %13s %13s %13s\n", "request", "count",
+           "bytes in", "bytes out", "time ms", "total", "server", "simulator",
+           "socket");
+  out += line;
+
+  for (size_t i = 0; i < used.size(); i++) {
+    const Entry &e = entries[used[i]];
+    snprintf(line, sizeof(line),
+             "%-17s %8llu %10llu %10llu %9.1f %13s %13s %13s %13s\n",
+             entryName(used[i]).c_str(), (unsigned long long)e.count,
+             (unsigned long long)e.bytesIn, (unsigned long long)e.bytesOut,
+             e.total.totalNs / 1e6, p50p99(e.total).c_str(),
+             p50p99(e.server).c_str(), p50p99(e.sim).c_str(),
+             p50p99(e.socket).c_str());
+    out += line;
+  }
+
+  snprintf(line, sizeof(line),
+           "Waiting for the client: %llu waits, %.1f ms, p50/p99 %s us.\n",
+           (unsigned long long)wait.count, wait.totalNs / 1e6,
+           p50p99(wait).c_str());
+  out += line;
+  return out;
+}
+
+//! Adds the time from its construction to its destruction to the simulator
+//! time in stats
+class SimTimer {
+ public:
+  SimTimer(RspStats *stats) : stats(stats), start(RspStats::now()) {}
+  ~SimTimer() { stats->simCall(RspStats::now() - start); }
+
+ private:
+  RspStats *stats;
+  uint64_t start;
+};
+
+void TimedSimulationControl::kill() {
+  SimTimer t(stats);
+  simCtrl->kill();
+}
+
+void TimedSimulationControl::reset() {
+  SimTimer t(stats);
+  simCtrl->reset();
+}
+
+void TimedSimulationControl::stall() {
+  SimTimer t(stats);
+  simCtrl->stall();
+}
+
+void TimedSimulationControl::unstall() {
+  SimTimer t(stats);
+  simCtrl->unstall();
+}
+
+bool TimedSimulationControl::isStalled() {
+  SimTimer t(stats);
+  return simCtrl->isStalled();
+}
+
+void TimedSimulationControl::step() {
+  SimTimer t(stats);
+  simCtrl->step();
+}
+
+void TimedSimulationControl::insertBreakpoint(unsigned addr) {
+  SimTimer t(stats);
+  simCtrl->insertBreakpoint(addr);
+}
+
+void TimedSimulationControl::removeBreakpoint(unsigned addr) {
+  SimTimer t(stats);
+  simCtrl->removeBreakpoint(addr);
+}
+
+bool TimedSimulationControl::insertWatchpoint(WatchType type, unsigned addr,
+                                              std::size_t len) {
+  SimTimer t(stats);
+  return simCtrl->insertWatchpoint(type, addr, len);
+}
+
+bool TimedSimulationControl::removeWatchpoint(WatchType type, unsigned addr,
+                                              std::size_t len) {
+  SimTimer t(stats);
+  return simCtrl->removeWatchpoint(type, addr, len);
+}
+
+bool TimedSimulationControl::getWatchpointHit(WatchType *type,
+                                              unsigned *addr) {
+  SimTimer t(stats);
+  return simCtrl->getWatchpointHit(type, addr);
+}
+
+uint32_t TimedSimulationControl::readReg(std::size_t num) {
+  SimTimer t(stats);
+  return simCtrl->readReg(num);
+}
+
+void TimedSimulationControl::writeReg(std::size_t num, uint32_t value) {
+  SimTimer t(stats);
+  simCtrl->writeReg(num, value);
+}
+
+void TimedSimulationControl::readRegs(uint32_t *out, std::size_t first,
+                                      std::size_t count) {
+  SimTimer t(stats);
+  simCtrl->readRegs(out, first, count);
+}
+
+void TimedSimulationControl::writeRegs(const uint32_t *src, std::size_t first,
+                                       std::size_t count) {
+  SimTimer t(stats);
+  simCtrl->writeRegs(src, first, count);
+}
+
+bool TimedSimulationControl::readMem(uint8_t *out, unsigned addr,
+                                     std::size_t len) {
+  SimTimer t(stats);
+  return simCtrl->readMem(out, addr, len);
+}
+
+bool TimedSimulationControl::writeMem(uint8_t *src, unsigned addr,
+                                      std::size_t len) {
+  SimTimer t(stats);
+  return simCtrl->writeMem(src, addr, len);
+}
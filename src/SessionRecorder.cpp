@@ -0,0 +1,290 @@
+/*
+ * Copyright (c) 2019-2020, University of Southampton and Contributors.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <gdb-server/SessionRecorder.hpp>
+#include <spdlog/spdlog.h>
+
+const char SessionRecorder::MAGIC[8] = {'G', 'D', 'B', 'S', 'R', 'E', 'C', '1'};
+const std::size_t SessionRecorder::FLUSH_SIZE;
+
+//! Size of the fixed part of a record, and of the simulator call arguments
+static const std::size_t HEADER_SIZE = 16;
+static const std::size_t ARGS_SIZE = 3 * sizeof(uint32_t);
+
+SessionRecorder::SessionRecorder() : file(NULL) {}
+
+SessionRecorder::~SessionRecorder() { close(); }
+
+bool SessionRecorder::open(const char *path) {
+  close();
+
+  std::FILE *newFile = std::fopen(path, "wb");
+  if (NULL == newFile) {
+    spdlog::warn("SessionRecorder: Cannot open {:s}: {:s}", path,
+                 strerror(errno));
+    return false;
+  }
+
+  std::lock_guard<std::mutex> guard(lock);
+  if (NULL != file) {  // Opened by another thread meanwhile
+    writeOut();
+    std::fclose(file);
+  }
+  file = newFile;
+  buf.clear();
+  buf.reserve(2 * FLUSH_SIZE);
+  buf.insert(buf.end(), MAGIC, MAGIC + sizeof(MAGIC));
+  start = Clock::now();
+  return true;
+}
+
+void SessionRecorder::close() {
+  std::lock_guard<std::mutex> guard(lock);
+  if (NULL == file) {
+    return;
+  }
+
+  writeOut();
+  std::fclose(file);
+  file = NULL;
+}
+
+bool SessionRecorder::isOpen() const {
+  std::lock_guard<std::mutex> guard(lock);
+  return NULL != file;
+}
+
+void SessionRecorder::packet(Kind kind, const char *data, std::size_t len) {
+  append(kind, SIM_STALL, 0, NULL, data, len);
+}
+
+void SessionRecorder::simCall(SimOp op, int core, uint32_t a, uint32_t b,
+                              uint32_t result, const void *data,
+                              std::size_t len) {
+  uint32_t args[3] = {a, b, result};
+  append(SIM_CALL, op, core, args, data, len);
+}
+
+void SessionRecorder::simInfo(int core, SimulationControlInterface *simCtrl) {
+  uint32_t args[3] = {simCtrl->nRegs(), simCtrl->pcRegNum(),
+                      simCtrl->wordSize()};
+  uint32_t one = simCtrl->htotl(1);
+  append(SIM_INFO, SIM_STALL, core, args, &one, sizeof(one));
+}
+
+void SessionRecorder::flush() {
+  std::lock_guard<std::mutex> guard(lock);
+  writeOut();
+  if (NULL != file) {
+    std::fflush(file);
+  }
+}
+
+bool SessionRecorder::load(const char *path, std::vector<Record> *records) {
+  std::FILE *in = std::fopen(path, "rb");
+  if (NULL == in) {
+    return false;
+  }
+
+  char magic[sizeof(MAGIC)];
+  if ((1 != std::fread(magic, sizeof(magic), 1, in)) ||
+      (0 != memcmp(magic, MAGIC, sizeof(MAGIC)))) {
+    std::fclose(in);
+    return false;
+  }
+
+  records->clear();
+  uint8_t header[HEADER_SIZE];
+  while (1 == std::fread(header, sizeof(header), 1, in)) {
+    Record rec;
+    uint32_t len;
+    memcpy(&rec.time, header, sizeof(rec.time));
+    memcpy(&len, header + 8, sizeof(len));
+    rec.kind = (Kind)header[12];
+    rec.op = (SimOp)header[13];
+    rec.core = header[14];
+    memset(rec.args, 0, sizeof(rec.args));
+
+    bool hasArgs = (SIM_CALL == rec.kind) || (SIM_INFO == rec.kind);
+    rec.data.resize(len);
+    if ((hasArgs && (1 != std::fread(rec.args, ARGS_SIZE, 1, in))) ||
+        ((len > 0) && (1 != std::fread(rec.data.data(), len, 1, in)))) {
+      break;  // Cut short
+    }
+    records->push_back(rec);
+  }
+
+  std::fclose(in);
+  return true;
+}
+
+void SessionRecorder::append(Kind kind, SimOp op, int core,
+                             const uint32_t *args, const void *data,
+                             std::size_t len) {
+  std::lock_guard<std::mutex> guard(lock);
+  if (NULL == file) {
+    return;
+  }
+
+  uint64_t time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      Clock::now() - start)
+                      .count();
+  uint32_t len32 = len;
+  uint8_t header[HEADER_SIZE] = {0};
+  memcpy(header, &time, sizeof(time));
+  memcpy(header + 8, &len32, sizeof(len32));
+  header[12] = kind;
+  header[13] = op;
+  header[14] = core;
+
+  buf.insert(buf.end(), header, header + sizeof(header));
+  if (NULL != args) {
+    const uint8_t *p = (const uint8_t *)args;
+    buf.insert(buf.end(), p, p + ARGS_SIZE);
+  }
+  if (len > 0) {
+    const uint8_t *p = (const uint8_t *)data;
+    buf.insert(buf.end(), p, p + len);
+  }
+
+  if (buf.size() >= FLUSH_SIZE) {
+    writeOut();
+  }
+}
+
+//! Write out the buffer. The caller holds the lock.
+void SessionRecorder::writeOut() {
+  if ((NULL != file) && !buf.empty() &&
+      (1 != std::fwrite(buf.data(), buf.size(), 1, file))) {
+    spdlog::warn("SessionRecorder: Failed to write log: {:s}",
+                 strerror(errno));
+  }
+  buf.clear();
+}
+
+RecordingSimulationControl::RecordingSimulationControl(
+    SimulationControlInterface *simCtrl, SessionRecorder *recorder, int core)
+    : simCtrl(simCtrl), recorder(recorder), core(core), lastStalled(false) {
+  recorder->simInfo(core, simCtrl);
+}
+
+void RecordingSimulationControl::kill() {
+  recorder->simCall(SessionRecorder::SIM_KILL, core, 0, 0, 0);
+  simCtrl->kill();
+}
+
+void RecordingSimulationControl::reset() {
+  recorder->simCall(SessionRecorder::SIM_RESET, core, 0, 0, 0);
+  simCtrl->reset();
+}
+
+void RecordingSimulationControl::stall() {
+  recorder->simCall(SessionRecorder::SIM_STALL, core, 0, 0, 0);
+  simCtrl->stall();
+}
+
+void RecordingSimulationControl::unstall() {
+  recorder->simCall(SessionRecorder::SIM_UNSTALL, core, 0, 0, 0);
+  simCtrl->unstall();
+}
+
+bool RecordingSimulationControl::isStalled() {
+  bool stalled = simCtrl->isStalled();
+  // The server polls this while the target runs, so only record changes
+  if (stalled != lastStalled) {
+    recorder->simCall(SessionRecorder::SIM_IS_STALLED, core, 0, 0, stalled);
+    lastStalled = stalled;
+  }
+  return stalled;
+}
+
+void RecordingSimulationControl::step() {
+  recorder->simCall(SessionRecorder::SIM_STEP, core, 0, 0, 0);
+  simCtrl->step();
+}
+
+void RecordingSimulationControl::insertBreakpoint(unsigned addr) {
+  recorder->simCall(SessionRecorder::SIM_INSERT_BP, core, addr, 0, 0);
+  simCtrl->insertBreakpoint(addr);
+}
+
+void RecordingSimulationControl::removeBreakpoint(unsigned addr) {
+  recorder->simCall(SessionRecorder::SIM_REMOVE_BP, core, addr, 0, 0);
+  simCtrl->removeBreakpoint(addr);
+}
+
+bool RecordingSimulationControl::insertWatchpoint(WatchType type,
+                                                  unsigned addr,
+                                                  std::size_t len) {
+  bool res = simCtrl->insertWatchpoint(type, addr, len);
+  uint8_t t = type;
+  recorder->simCall(SessionRecorder::SIM_INSERT_WP, core, addr, len, res, &t,
+                    sizeof(t));
+  return res;
+}
+
+bool RecordingSimulationControl::removeWatchpoint(WatchType type,
+                                                  unsigned addr,
+                                                  std::size_t len) {
+  bool res = simCtrl->removeWatchpoint(type, addr, len);
+  uint8_t t = type;
+  recorder->simCall(SessionRecorder::SIM_REMOVE_WP, core, addr, len, res, &t,
+                    sizeof(t));
+  return res;
+}
+
+bool RecordingSimulationControl::getWatchpointHit(WatchType *type,
+                                                  unsigned *addr) {
+  bool res = simCtrl->getWatchpointHit(type, addr);
+  recorder->simCall(SessionRecorder::SIM_WATCH_HIT, core, res ? *addr : 0,
+                    res ? *type : 0, res);
+  return res;
+}
+
+uint32_t RecordingSimulationControl::readReg(std::size_t num) {
+  uint32_t value = simCtrl->readReg(num);
+  recorder->simCall(SessionRecorder::SIM_READ_REG, core, num, 0, value);
+  return value;
+}
+
+void RecordingSimulationControl::writeReg(std::size_t num, uint32_t value) {
+  recorder->simCall(SessionRecorder::SIM_WRITE_REG, core, num, value, 0);
+  simCtrl->writeReg(num, value);
+}
+
+void RecordingSimulationControl::readRegs(uint32_t *out, std::size_t first,
+                                          std::size_t count) {
+  simCtrl->readRegs(out, first, count);
+  recorder->simCall(SessionRecorder::SIM_READ_REGS, core, first, count, 0, out,
+                    count * sizeof(uint32_t));
+}
+
+void RecordingSimulationControl::writeRegs(const uint32_t *src,
+                                           std::size_t first,
+                                           std::size_t count) {
+  recorder->simCall(SessionRecorder::SIM_WRITE_REGS, core, first, count, 0, src,
+                    count * sizeof(uint32_t));
+  simCtrl->writeRegs(src, first, count);
+}
+
+bool RecordingSimulationControl::readMem(uint8_t *out, unsigned addr,
+                                         std::size_t len) {
+  bool res = simCtrl->readMem(out, addr, len);
+  recorder->simCall(SessionRecorder::SIM_READ_MEM, core, addr, len, res, out,
+                    res ? len : 0);
+  return res;
+}
+
+bool RecordingSimulationControl::writeMem(uint8_t *src, unsigned addr,
+                                          std::size_t len) {
+  bool res = simCtrl->writeMem(src, addr, len);
+  recorder->simCall(SessionRecorder::SIM_WRITE_MEM, core, addr, len, res, src,
+                    len);
+  return res;
+}
@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2019-2020, University of Southampton and Contributors.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <gdb-server/TraceBuffer.hpp>
+
+const std::size_t TraceBuffer::DEFAULT_SIZE;
+const std::size_t TraceBuffer::MAX_SIZE;
+
+TraceBuffer::TraceBuffer(std::size_t size) : circular(false) { resize(size); }
+
+void TraceBuffer::clear() {
+  frames.clear();
+  tail = 0;
+  created = 0;
+  pending.clear();
+  pendingOverflow = false;
+}
+
+bool TraceBuffer::resize(std::size_t size) {
+  bool ok = true;
+  try {
+    ring.assign(size, 0);
+    pending.clear();
+    pending.reserve(size);
+  } catch (const std::bad_alloc &) {
+    std::vector<uint8_t>().swap(ring);
+    std::vector<uint8_t>().swap(pending);
+    ok = false;
+  }
+  clear();
+  return ok;
+}
+
+void TraceBuffer::startFrame(uint32_t tpNum, uint32_t pc) {
+  pending.clear();
+  pendingTp = tpNum;
+  pendingPc = pc;
+  pendingOverflow = false;
+}
+
+void TraceBuffer::addRegisters(const uint32_t *regs, std::size_t count) {
+  uint32_t n = count;
+  if (!reserve(1 + sizeof(n) + count * sizeof(uint32_t))) {
+    return;
+  }
+
+  pending.push_back(BLOCK_REGS);
+  const uint8_t *p = (const uint8_t *)&n;
+  pending.insert(pending.end(), p, p + sizeof(n));
+  p = (const uint8_t *)regs;
+  pending.insert(pending.end(), p, p + count * sizeof(uint32_t));
+}
+
+void TraceBuffer::addMemory(uint32_t addr, const uint8_t *data,
+                            std::size_t len) {
+  uint32_t n = len;
+  if (!reserve(1 + sizeof(addr) + sizeof(n) + len)) {
+    return;
+  }
+
+  pending.push_back(BLOCK_MEM);
+  const uint8_t *p = (const uint8_t *)&addr;
+  pending.insert(pending.end(), p, p + sizeof(addr));
+  p = (const uint8_t *)&n;
+  pending.insert(pending.end(), p, p + sizeof(n));
+  pending.insert(pending.end(), data, data + len);
+}
+
+bool TraceBuffer::commitFrame() {
+  std::size_t len = pending.size();
+  if (pendingOverflow || (0 == len) || (len > ring.size())) {
+    return false;
+  }
+
+  // Frames are never split: if it won't fit before the end, start again at
+  // the beginning. Make room by dropping the oldest frames, which are the
+  // ones in the way, and when we wrap, also any still held after the tail.
+  std::size_t oldTail = tail;
+  bool wrapped = (tail + len > ring.size());
+  std::size_t pos = wrapped ? 0 : tail;
+
+  while (!frames.empty()) {
+    const Frame &f = frames.front();
+    bool overlap = (f.offset < pos + len) && (pos < f.offset + f.len);
+    if (!overlap && !(wrapped && (f.offset >= oldTail))) {
+      break;
+    }
+    if (!circular) {
+      return false;
+    }
+    frames.pop_front();
+  }
+
+  memcpy(&ring[pos], pending.data(), len);
+  Frame f = {pos, len, pendingTp, pendingPc};
+  frames.push_back(f);
+  tail = pos + len;
+  created++;
+  pending.clear();
+  return true;
+}
+
+std::size_t TraceBuffer::bytesFree() const {
+  std::size_t used = 0;
+  for (std::size_t i = 0; i < frames.size(); i++) {
+    used += frames[i].len;
+  }
+  return ring.size() - used;
+}
+
+bool TraceBuffer::readRegister(std::size_t n, std::size_t regNum,
+                               uint32_t *value) const {
+  const uint8_t *p = &ring[frames[n].offset];
+  const uint8_t *end = p + frames[n].len;
+
+  while (p < end) {
+    uint32_t a, count;
+    if (BLOCK_REGS == p[0]) {
+      memcpy(&count, p + 1, sizeof(count));
+      if (regNum < count) {
+        memcpy(value, p + 1 + sizeof(count) + regNum * sizeof(uint32_t),
+               sizeof(*value));
+        return true;
+      }
+      p += 1 + sizeof(count) + count * sizeof(uint32_t);
+    } else {
+      memcpy(&count, p + 1 + sizeof(a), sizeof(count));
+      p += 1 + sizeof(a) + sizeof(count) + count;
+    }
+  }
+
+  return false;
+}
+
+std::size_t TraceBuffer::readMemory(std::size_t n, uint32_t addr,
+                                    uint8_t *out, std::size_t len) const {
+  const uint8_t *start = &ring[frames[n].offset];
+  const uint8_t *end = start + frames[n].len;
+  std::size_t done = 0;
+
+  // Blocks may be in any order and may overlap, so look again from the
+  // start for each piece
+  bool found = true;
+  while (found && (done < len)) {
+    found = false;
+    uint64_t want = (uint64_t)addr + done;
+
+    for (const uint8_t *p = start; p < end;) {
+      uint32_t a, count;
+      if (BLOCK_REGS == p[0]) {
+        memcpy(&count, p + 1, sizeof(count));
+        p += 1 + sizeof(count) + count * sizeof(uint32_t);
+        continue;
+      }
+
+      memcpy(&a, p + 1, sizeof(a));
+      memcpy(&count, p + 1 + sizeof(a), sizeof(count));
+      const uint8_t *data = p + 1 + sizeof(a) + sizeof(count);
+      p = data + count;
+
+      if ((want >= a) && (want < (uint64_t)a + count)) {
+        std::size_t chunk =
+            std::min((std::size_t)((uint64_t)a + count - want), len - done);
+        memcpy(out + done, data + (want - a), chunk);
+        done += chunk;
+        found = true;
+        break;
+      }
+    }
+  }
+
+  return done;
+}
+
+bool TraceBuffer::reserve(std::size_t len) {
+  if (pendingOverflow || (pending.size() + len > ring.size())) {
+    pendingOverflow = true;
+    return false;
+  }
+  return true;
+}
@@ -27,8 +27,50 @@
 // $Id: Utils.cpp 324 2009-03-07 09:42:52Z jeremy $
 
 #include <spdlog/spdlog.h>
+#include <cstring>
 #include <gdb-server/Utils.hpp>
 
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define UTILS_X86_SIMD
+#include <immintrin.h>
+#endif
+
+//! Value of each char as a hex digit, or 0xff if it is not a hex digit
+static const uint8_t hexDigitVal[256] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff};
+
+//! Each byte value as a pair of lower case hex digits
+static const char byteHex[] =
+    "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"
+    "202122232425262728292a2b2c2d2e2f303132333435363738393a3b3c3d3e3f"
+    "404142434445464748494a4b4c4d4e4f505152535455565758595a5b5c5d5e5f"
+    "606162636465666768696a6b6c6d6e6f707172737475767778797a7b7c7d7e7f"
+    "808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f"
+    "a0a1a2a3a4a5a6a7a8a9aaabacadaeafb0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+    "c0c1c2c3c4c5c6c7c8c9cacbcccdcecfd0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+    "e0e1e2e3e4e5e6e7e8e9eaebecedeeeff0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+
 //-----------------------------------------------------------------------------
 //! Utility to give the value of a hex char
 
@@ -40,11 +82,7 @@
 //!          invalid.
 //-----------------------------------------------------------------------------
 uint8_t Utils::char2Hex(int c) {
-  return ((c >= 'a') && (c <= 'f'))
-             ? c - 'a' + 10
-             : ((c >= '0') && (c <= '9'))
-                   ? c - '0'
-                   : ((c >= 'A') && (c <= 'F')) ? c - 'A' + 10 : -1;
+  return hexDigitVal[c & 0xff];
 
 }  // char2Hex ()
 
@@ -83,9 +121,8 @@ const char Utils::hex2Char(uint8_t d) {
 //-----------------------------------------------------------------------------
 void Utils::reg2Hex(uint32_t val, char *buf) {
   for (int n = 0; n < sizeof(uint32_t); n++) {
-    // Swap nibbles
-    buf[2 * n + 1] = hex2Char(val & 0xf);
-    buf[2 * n] = hex2Char((val >> 4) & 0xf);
+    // Lowest byte first, each as a pair of hex digits
+    memcpy(&buf[2 * n], &byteHex[2 * (val & 0xff)], 2);
     val >>= 8;
   }
 
@@ -115,17 +152,10 @@ uint32_t Utils::hex2Reg(char *buf, size_t nBytes) {
 //! @param[in]  src   The ASCII string (null terminated)                      */
 //-----------------------------------------------------------------------------
 void Utils::ascii2Hex(char *dest, char *src) {
-  int i;
-
-  // Step through converting the source string
-  for (i = 0; src[i] != '\0'; i++) {
-    char ch = src[i];
+  size_t len = strlen(src);
 
-    dest[i * 2] = hex2Char(ch >> 4 & 0xf);
-    dest[i * 2 + 1] = hex2Char(ch & 0xf);
-  }
-
-  dest[i * 2] = '\0';
+  bytesToHex((const uint8_t *)src, len, dest);
+  dest[len * 2] = '\0';
 
 }  // ascii2hex ()
 
@@ -182,3 +212,378 @@ int Utils::rspUnescape(char *buf, int len) {
   return toOffset;
 
 }  // rspUnescape () */
+
+//-----------------------------------------------------------------------------
+// Bulk hex conversion kernels. Each implementation has the same contract as
+// Utils::bytesToHex () and Utils::hexToBytes ().
+//-----------------------------------------------------------------------------
+typedef void (*BytesToHexFn)(const uint8_t *src, size_t len, char *dest);
+typedef bool (*HexToBytesFn)(const char *src, size_t len, uint8_t *dest);
+
+static void bytesToHexScalar(const uint8_t *src, size_t len, char *dest) {
+  for (size_t i = 0; i < len; i++) {
+    memcpy(&dest[2 * i], &byteHex[2 * src[i]], 2);
+  }
+}  // bytesToHexScalar ()
+
+static bool hexToBytesScalar(const char *src, size_t len, uint8_t *dest) {
+  uint8_t bad = 0;  // Top bit set if any digit was invalid (0xff)
+
+  for (size_t i = 0; i < len; i++) {
+    uint8_t hi = hexDigitVal[(uint8_t)src[2 * i]];
+    uint8_t lo = hexDigitVal[(uint8_t)src[2 * i + 1]];
+    bad |= hi | lo;
+    dest[i] = (hi << 4) | (lo & 0xf);
+  }
+
+  return 0 == (bad & 0x80);
+}  // hexToBytesScalar ()
+
+#ifdef UTILS_X86_SIMD
+
+//! Map 16 nibbles (0-15) to lower case hex digits
+__attribute__((target("sse2"))) static inline __m128i nibbleToHexSse2(
+    __m128i n) {
+  __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(n, _mm_set1_epi8(9)),
+                                _mm_set1_epi8('a' - '0' - 10));
+  return _mm_add_epi8(_mm_add_epi8(n, _mm_set1_epi8('0')), alpha);
+}  // nibbleToHexSse2 ()
+
+//! Map 16 hex digits to their values. Lanes which are not hex digits are set
+//! in bad.
+__attribute__((target("sse2"))) static inline __m128i hexToNibbleSse2(
+    __m128i c, __m128i &bad) {
+  __m128i isDigit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)),
+                                  _mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)));
+  __m128i lc = _mm_or_si128(c, _mm_set1_epi8(0x20));  // Fold to lower case
+  __m128i isAlpha = _mm_and_si128(_mm_cmpgt_epi8(lc, _mm_set1_epi8('a' - 1)),
+                                  _mm_cmplt_epi8(lc, _mm_set1_epi8('f' + 1)));
+  __m128i digit = _mm_and_si128(_mm_sub_epi8(c, _mm_set1_epi8('0')), isDigit);
+  __m128i alpha =
+      _mm_and_si128(_mm_sub_epi8(lc, _mm_set1_epi8('a' - 10)), isAlpha);
+
+  bad = _mm_or_si128(
+      bad, _mm_andnot_si128(_mm_or_si128(isDigit, isAlpha), _mm_set1_epi8(-1)));
+  return _mm_or_si128(digit, alpha);
+}  // hexToNibbleSse2 ()
+
+//! Combine 8 (high, low) nibble pairs into 16-bit lanes holding one byte each
+__attribute__((target("sse2"))) static inline __m128i nibblePairsSse2(
+    __m128i n) {
+  return _mm_or_si128(_mm_and_si128(_mm_slli_epi16(n, 4), _mm_set1_epi16(0xf0)),
+                      _mm_srli_epi16(n, 8));
+}  // nibblePairsSse2 ()
+
+__attribute__((target("sse2"))) static void bytesToHexSse2(const uint8_t *src,
+                                                           size_t len,
+                                                           char *dest) {
+  const __m128i mask = _mm_set1_epi8(0x0f);
+  size_t i = 0;
+
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)&src[i]);
+    __m128i hi = nibbleToHexSse2(_mm_and_si128(_mm_srli_epi16(v, 4), mask));
+    __m128i lo = nibbleToHexSse2(_mm_and_si128(v, mask));
+    _mm_storeu_si128((__m128i *)&dest[2 * i], _mm_unpacklo_epi8(hi, lo));
+    _mm_storeu_si128((__m128i *)&dest[2 * i + 16], _mm_unpackhi_epi8(hi, lo));
+  }
+
+  bytesToHexScalar(&src[i], len - i, &dest[2 * i]);
+}  // bytesToHexSse2 ()
+
+__attribute__((target("sse2"))) static bool hexToBytesSse2(const char *src,
+                                                           size_t len,
+                                                           uint8_t *dest) {
+  __m128i bad = _mm_setzero_si128();
+  size_t i = 0;
+
+  for (; i + 16 <= len; i += 16) {
+    __m128i c0 = _mm_loadu_si128((const __m128i *)&src[2 * i]);
+    __m128i c1 = _mm_loadu_si128((const __m128i *)&src[2 * i + 16]);
+    __m128i b0 = nibblePairsSse2(hexToNibbleSse2(c0, bad));
+    __m128i b1 = nibblePairsSse2(hexToNibbleSse2(c1, bad));
+    _mm_storeu_si128((__m128i *)&dest[i], _mm_packus_epi16(b0, b1));
+  }
+
+  bool ok = hexToBytesScalar(&src[2 * i], len - i, &dest[i]);
+  return ok && (0 == _mm_movemask_epi8(bad));
+}  // hexToBytesSse2 ()
+
+//! Map 32 nibbles (0-15) to lower case hex digits
+__attribute__((target("avx2"))) static inline __m256i nibbleToHexAvx2(
+    __m256i n) {
+  __m256i alpha = _mm256_and_si256(_mm256_cmpgt_epi8(n, _mm256_set1_epi8(9)),
+                                   _mm256_set1_epi8('a' - '0' - 10));
+  return _mm256_add_epi8(_mm256_add_epi8(n, _mm256_set1_epi8('0')), alpha);
+}  // nibbleToHexAvx2 ()
+
+//! Map 32 hex digits to their values. Lanes which are not hex digits are set
+//! in bad.
+__attribute__((target("avx2"))) static inline __m256i hexToNibbleAvx2(
+    __m256i c, __m256i &bad) {
+  __m256i isDigit =
+      _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('0' - 1)),
+                       _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), c));
+  __m256i lc = _mm256_or_si256(c, _mm256_set1_epi8(0x20));
+  __m256i isAlpha =
+      _mm256_and_si256(_mm256_cmpgt_epi8(lc, _mm256_set1_epi8('a' - 1)),
+                       _mm256_cmpgt_epi8(_mm256_set1_epi8('f' + 1), lc));
+  __m256i digit =
+      _mm256_and_si256(_mm256_sub_epi8(c, _mm256_set1_epi8('0')), isDigit);
+  __m256i alpha = _mm256_and_si256(
+      _mm256_sub_epi8(lc, _mm256_set1_epi8('a' - 10)), isAlpha);
+
+  bad = _mm256_or_si256(
+      bad, _mm256_andnot_si256(_mm256_or_si256(isDigit, isAlpha),
+                               _mm256_set1_epi8(-1)));
+  return _mm256_or_si256(digit, alpha);
+}  // hexToNibbleAvx2 ()
+
+//! Combine 16 (high, low) nibble pairs into 16-bit lanes holding one byte each
+__attribute__((target("avx2"))) static inline __m256i nibblePairsAvx2(
+    __m256i n) {
+  return _mm256_or_si256(
+      _mm256_and_si256(_mm256_slli_epi16(n, 4), _mm256_set1_epi16(0xf0)),
+      _mm256_srli_epi16(n, 8));
+}  // nibblePairsAvx2 ()
+
+__attribute__((target("avx2"))) static void bytesToHexAvx2(const uint8_t *src,
+                                                           size_t len,
+                                                           char *dest) {
+  const __m256i mask = _mm256_set1_epi8(0x0f);
+  size_t i = 0;
+
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)&src[i]);
+    __m256i hi =
+        nibbleToHexAvx2(_mm256_and_si256(_mm256_srli_epi16(v, 4), mask));
+    __m256i lo = nibbleToHexAvx2(_mm256_and_si256(v, mask));
+
+    // Unpacking works within 128-bit lanes, so put the lanes back in order
+    __m256i a = _mm256_unpacklo_epi8(hi, lo);
+    __m256i b = _mm256_unpackhi_epi8(hi, lo);
+    _mm256_storeu_si256((__m256i *)&dest[2 * i],
+                        _mm256_permute2x128_si256(a, b, 0x20));
+    _mm256_storeu_si256((__m256i *)&dest[2 * i + 32],
+                        _mm256_permute2x128_si256(a, b, 0x31));
+  }
+
+  bytesToHexSse2(&src[i], len - i, &dest[2 * i]);
+}  // bytesToHexAvx2 ()
+
+__attribute__((target("avx2"))) static bool hexToBytesAvx2(const char *src,
+                                                           size_t len,
+                                                           uint8_t *dest) {
+  __m256i bad = _mm256_setzero_si256();
+  size_t i = 0;
+
+  for (; i + 32 <= len; i += 32) {
+    __m256i c0 = _mm256_loadu_si256((const __m256i *)&src[2 * i]);
+    __m256i c1 = _mm256_loadu_si256((const __m256i *)&src[2 * i + 32]);
+    __m256i b0 = nibblePairsAvx2(hexToNibbleAvx2(c0, bad));
+    __m256i b1 = nibblePairsAvx2(hexToNibbleAvx2(c1, bad));
+
+    // Packing works within 128-bit lanes, so put the 64-bit quarters back in
+    // order
+    __m256i packed = _mm256_packus_epi16(b0, b1);
+    _mm256_storeu_si256((__m256i *)&dest[i],
+                        _mm256_permute4x64_epi64(packed, 0xd8));
+  }
+
+  bool ok = hexToBytesSse2(&src[2 * i], len - i, &dest[i]);
+  return ok && (0 == _mm256_movemask_epi8(bad));
+}  // hexToBytesAvx2 ()
+
+#endif  // UTILS_X86_SIMD
+
+//! The currently selected bulk hex kernels
+struct HexKernels {
+  Utils::HexImpl impl;
+  BytesToHexFn bytesToHex;
+  HexToBytesFn hexToBytes;
+};
+
+//-----------------------------------------------------------------------------
+//! Check whether the host CPU supports a hex kernel implementation
+
+//! @param[in] impl  The implementation to check
+//! @return  TRUE if it can be used
+//-----------------------------------------------------------------------------
+static bool hexImplSupported(Utils::HexImpl impl) {
+  switch (impl) {
+    case Utils::HEX_IMPL_SCALAR:
+      return true;
+#ifdef UTILS_X86_SIMD
+    case Utils::HEX_IMPL_SSE2:
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("sse2");
+    case Utils::HEX_IMPL_AVX2:
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("avx2");
+#endif
+    default:
+      return false;
+  }
+}  // hexImplSupported ()
+
+//-----------------------------------------------------------------------------
+//! Get the kernels for a hex kernel implementation
+
+//! @param[in] impl  The implementation, which must be supported
+//-----------------------------------------------------------------------------
+static HexKernels hexKernelsFor(Utils::HexImpl impl) {
+  HexKernels k = {Utils::HEX_IMPL_SCALAR, bytesToHexScalar, hexToBytesScalar};
+
+#ifdef UTILS_X86_SIMD
+  if (Utils::HEX_IMPL_SSE2 == impl) {
+    k.impl = impl;
+    k.bytesToHex = bytesToHexSse2;
+    k.hexToBytes = hexToBytesSse2;
+  } else if (Utils::HEX_IMPL_AVX2 == impl) {
+    k.impl = impl;
+    k.bytesToHex = bytesToHexAvx2;
+    k.hexToBytes = hexToBytesAvx2;
+  }
+#endif
+
+  return k;
+}  // hexKernelsFor ()
+
+//-----------------------------------------------------------------------------
+//! The selected hex kernels, initialized to the best the CPU supports
+//-----------------------------------------------------------------------------
+static HexKernels &hexKernels() {
+  static HexKernels kernels =
+      hexKernelsFor(hexImplSupported(Utils::HEX_IMPL_AVX2)
+                        ? Utils::HEX_IMPL_AVX2
+                        : hexImplSupported(Utils::HEX_IMPL_SSE2)
+                              ? Utils::HEX_IMPL_SSE2
+                              : Utils::HEX_IMPL_SCALAR);
+  return kernels;
+}  // hexKernels ()
+
+//-----------------------------------------------------------------------------
+//! Convert a buffer of bytes to pairs of lower case hex digits
+
+//! Uses the fastest kernel the host CPU supports. The result is not null
+//! terminated.
+
+//! @param[in]  src   The bytes to convert
+//! @param[in]  len   The number of bytes to convert
+//! @param[out] dest  Buffer for 2 * len hex digits
+//-----------------------------------------------------------------------------
+void Utils::bytesToHex(const uint8_t *src, size_t len, char *dest) {
+  hexKernels().bytesToHex(src, len, dest);
+
+}  // bytesToHex ()
+
+//-----------------------------------------------------------------------------
+//! Convert pairs of hex digits (either case) to a buffer of bytes
+
+//! Uses the fastest kernel the host CPU supports. Every digit is validated.
+
+//! @param[in]  src   Buffer holding 2 * len hex digits
+//! @param[in]  len   The number of bytes to produce
+//! @param[out] dest  Buffer for len bytes
+
+//! @return  TRUE if all digits were valid, FALSE if any was malformed (dest
+//!          then holds garbage)
+//-----------------------------------------------------------------------------
+bool Utils::hexToBytes(const char *src, size_t len, uint8_t *dest) {
+  return hexKernels().hexToBytes(src, len, dest);
+
+}  // hexToBytes ()
+
+//-----------------------------------------------------------------------------
+//! Get the bulk hex kernel implementation in use
+
+//! @return  The implementation in use
+//-----------------------------------------------------------------------------
+Utils::HexImpl Utils::getHexImpl() {
+  return hexKernels().impl;
+
+}  // getHexImpl ()
+
+//-----------------------------------------------------------------------------
+//! Force a particular bulk hex kernel implementation
+
+//! Intended for benchmarking and testing. Not thread safe with respect to
+//! concurrent conversions.
+
+//! @param[in] impl  The implementation to use
+
+//! @return  TRUE if selected, FALSE if the host CPU doesn't support it
+//-----------------------------------------------------------------------------
+bool Utils::setHexImpl(HexImpl impl) {
+  if (!hexImplSupported(impl)) {
+    return false;
+  }
+
+  hexKernels() = hexKernelsFor(impl);
+  return true;
+
+}  // setHexImpl ()
+
+//-----------------------------------------------------------------------------
+//! Lookup tables for the slice-by-8 CRC-32
+
+//! table[0] is the usual byte-at-a-time table for the (non-reflected)
+//! polynomial 0x04c11db7. table[k] gives the contribution of a byte followed
+//! by k zero bytes.
+//-----------------------------------------------------------------------------
+struct Crc32Tables {
+  uint32_t table[8][256];
+
+  Crc32Tables() {
+    for (uint32_t b = 0; b < 256; b++) {
+      uint32_t c = b << 24;
+      for (int bit = 0; bit < 8; bit++) {
+        c = (c & 0x80000000) ? (c << 1) ^ 0x04c11db7 : (c << 1);
+      }
+      table[0][b] = c;
+    }
+
+    for (int k = 1; k < 8; k++) {
+      for (uint32_t b = 0; b < 256; b++) {
+        uint32_t c = table[k - 1][b];
+        table[k][b] = (c << 8) ^ table[0][c >> 24];
+      }
+    }
+  }
+};
+
+//-----------------------------------------------------------------------------
+//! Compute a CRC-32 the way GDB does for qCRC
+
+//! Uses the non-reflected polynomial 0x04c11db7 with no final XOR, matching
+//! GDB's xcrc32 (). Processes 8 bytes per step with the slice-by-8 tables.
+//! May be called repeatedly over consecutive chunks of a region, passing the
+//! previous result as crc.
+
+//! @param[in] buf  The data
+//! @param[in] len  Number of bytes of data
+//! @param[in] crc  The initial value (0xffffffff for a new region)
+
+//! @return  The CRC-32 of the data
+//-----------------------------------------------------------------------------
+uint32_t Utils::crc32(const uint8_t *buf, size_t len, uint32_t crc) {
+  static const Crc32Tables tables;
+  const uint32_t(*t)[256] = tables.table;
+
+  while (len >= 8) {
+    uint32_t w1 = crc ^ ((uint32_t)buf[0] << 24 | (uint32_t)buf[1] << 16 |
+                         (uint32_t)buf[2] << 8 | buf[3]);
+    crc = t[7][w1 >> 24] ^ t[6][(w1 >> 16) & 0xff] ^ t[5][(w1 >> 8) & 0xff] ^
+          t[4][w1 & 0xff] ^ t[3][buf[4]] ^ t[2][buf[5]] ^ t[1][buf[6]] ^
+          t[0][buf[7]];
+    buf += 8;
+    len -= 8;
+  }
+
+  while (len--) {
+    crc = (crc << 8) ^ t[0][((crc >> 24) ^ *buf++) & 0xff];
+  }
+
+  return crc;
+
+}  // crc32 ()
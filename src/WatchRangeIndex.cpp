@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2019-2020, University of Southampton and Contributors.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <algorithm>
+#include <gdb-server/WatchRangeIndex.hpp>
+
+const int WatchRangeIndex::PAGE_BITS;
+const uint64_t WatchRangeIndex::FILTER_SIZE;
+
+WatchRangeIndex::WatchRangeIndex() : pageCount(FILTER_SIZE, 0), wideRanges(0) {}
+
+void WatchRangeIndex::insert(WatchType type, uint32_t addr, std::size_t len) {
+  if (0 == len) {
+    return;
+  }
+
+  Range r = {addr, (uint64_t)addr + len, type};
+  std::vector<Range>::iterator it = ranges.begin();
+  while ((ranges.end() != it) && (it->start <= addr)) {
+    if ((it->start == r.start) && (it->end == r.end) && (it->type == type)) {
+      return;  // Already watched
+    }
+    ++it;
+  }
+
+  ranges.insert(it, r);
+  updateFilter(r, 1);
+  rebuildMaxEnd();
+}
+
+bool WatchRangeIndex::remove(WatchType type, uint32_t addr, std::size_t len) {
+  uint64_t end = (uint64_t)addr + len;
+  for (std::vector<Range>::iterator it = ranges.begin(); ranges.end() != it;
+       ++it) {
+    if ((it->start == addr) && (it->end == end) && (it->type == type)) {
+      updateFilter(*it, -1);
+      ranges.erase(it);
+      rebuildMaxEnd();
+      return true;
+    }
+  }
+  return false;
+}
+
+void WatchRangeIndex::clear() {
+  ranges.clear();
+  maxEnd.clear();
+  std::fill(pageCount.begin(), pageCount.end(), 0);
+  wideRanges = 0;
+}
+
+bool WatchRangeIndex::startsBefore(const Range &r, uint64_t addr) {
+  return r.start < addr;
+}
+
+bool WatchRangeIndex::lookup(uint32_t addr, std::size_t len, bool isWrite,
+                             Hit *hit) const {
+  uint64_t end = (uint64_t)addr + len;
+
+  // Only ranges starting before the end of the access can overlap it. Going
+  // backwards, stop once no earlier range reaches the access.
+  std::size_t i = std::lower_bound(ranges.begin(), ranges.end(), end,
+                                   startsBefore) -
+                  ranges.begin();
+  for (; (i > 0) && (maxEnd[i - 1] > addr); i--) {
+    const Range &r = ranges[i - 1];
+    if (r.end <= addr) {
+      continue;
+    }
+
+    bool match = (SimulationControlInterface::WATCH_ACCESS == r.type) ||
+                 ((SimulationControlInterface::WATCH_WRITE == r.type) ==
+                  isWrite);
+    if (match) {
+      if (NULL != hit) {
+        hit->type = r.type;
+        hit->addr = std::max(addr, r.start);
+      }
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void WatchRangeIndex::updateFilter(const Range &r, int delta) {
+  uint64_t first = r.start >> PAGE_BITS;
+  uint64_t last = (r.end - 1) >> PAGE_BITS;
+
+  if (last - first >= FILTER_SIZE) {
+    wideRanges += delta;
+    return;
+  }
+  for (uint64_t page = first; page <= last; page++) {
+    pageCount[page & (FILTER_SIZE - 1)] += delta;
+  }
+}
+
+void WatchRangeIndex::rebuildMaxEnd() {
+  maxEnd.resize(ranges.size());
+  uint64_t m = 0;
+  for (std::size_t i = 0; i < ranges.size(); i++) {
+    m = std::max(m, ranges[i].end);
+    maxEnd[i] = m;
+  }
+}